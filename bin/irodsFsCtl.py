@@ -24,6 +24,10 @@ import array
 IOCTL_APP_NUMBER = 0xEE
 IFUSEIOC_RESET_METADATA_CACHE = 0
 IFUSEIOC_SHOW_CONNECTIONS = 1
+IFUSEIOC_SHOW_BUFFER_CACHE = 2
+IFUSEIOC_SHOW_PRELOAD = 3
+
+IFUSE_PRELOAD_REPORT_FD_NUM = 64
 
 
 _IOC_NRBITS = 8
@@ -96,14 +100,81 @@ def show_connections(mount_path):
         print("Done!")
     os.close(fd)
 
+def show_buffer_cache(mount_path):
+    print("show buffer cache: %s" % (mount_path))
+
+    fd = os.open(mount_path, os.O_DIRECTORY)
+    buf = array.array('q', [0,0,0,0,0,0,0])
+    status = fcntl.ioctl(fd, _IOR(IOCTL_APP_NUMBER, IFUSEIOC_SHOW_BUFFER_CACHE, 56), buf, 1)
+    if status != 0:
+        print("failed to show buffer cache", file=sys.stderr)
+    else:
+        hits = buf[0]
+        misses = buf[1]
+        evictions = buf[2]
+        cachedBlocks = buf[3]
+        cachedBytes = buf[4]
+        fetches = buf[5]
+        fetchedBytes = buf[6]
+
+        print("Hits: %d" % hits)
+        print("Misses: %d" % misses)
+        print("Evictions: %d" % evictions)
+        print("Cached Blocks: %d" % cachedBlocks)
+        print("Cached Bytes: %d" % cachedBytes)
+        print("Fetches: %d" % fetches)
+        print("Fetched Bytes: %d" % fetchedBytes)
+        print("Done!")
+    os.close(fd)
+
+def show_preload(path):
+    print("show preload: %s" % (path))
+
+    if os.path.isdir(path):
+        fd = os.open(path, os.O_DIRECTORY)
+    else:
+        fd = os.open(path, os.O_RDONLY)
+    buf = array.array('q', [0] * (9 + IFUSE_PRELOAD_REPORT_FD_NUM * 5))
+    status = fcntl.ioctl(fd, _IOR(IOCTL_APP_NUMBER, IFUSEIOC_SHOW_PRELOAD, len(buf) * 8), buf, 1)
+    if status != 0:
+        print("failed to show preload", file=sys.stderr)
+    else:
+        blockSize = buf[0]
+        maxWindow = buf[1]
+        memBudget = buf[2]
+        inflightBudget = buf[3]
+        residentBytes = buf[4]
+        inflightBytes = buf[5]
+        streamNum = buf[6]
+        streamShare = buf[7]
+        fdNum = buf[8]
+
+        print("Max Readahead Window: %d blocks (%d bytes)" % (maxWindow, maxWindow * blockSize))
+        print("Preloaded Bytes: %d / %d" % (residentBytes + inflightBytes, memBudget))
+        print("In-Flight Bytes: %d / %d" % (inflightBytes, inflightBudget))
+        print("Streams: %d, Share %d blocks" % (streamNum, streamShare))
+        for i in range(fdNum):
+            fdId = buf[9 + i * 5]
+            stride = buf[9 + i * 5 + 1]
+            window = buf[9 + i * 5 + 2]
+            inflightBlocks = buf[9 + i * 5 + 3]
+            residentBlocks = buf[9 + i * 5 + 4]
+            print("FD %d: Readahead Window %d steps, Stride %d blocks, Preloaded %d blocks, In-Flight %d blocks" % (fdId, window, stride, residentBlocks, inflightBlocks))
+        print("Done!")
+    os.close(fd)
+
 COMMANDS = {
     "reset_cache": reset_cache,
     "show_connections": show_connections,
+    "show_buffer_cache": show_buffer_cache,
+    "show_preload": show_preload,
 }
 
 COMMANDS_DESCS = {
     "reset_cache": "invalidate all caches",
-    "show_connections": "show all established connections"
+    "show_connections": "show all established connections",
+    "show_buffer_cache": "show buffer cache statistics",
+    "show_preload": "show preload budget, readahead windows and strides of open files under the path"
 }
 
 def ioctl(command, mount_path, oargs):
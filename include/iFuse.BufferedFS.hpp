@@ -19,19 +19,118 @@
 #ifndef IFUSE_BUFFEREDFS_HPP
 #define IFUSE_BUFFEREDFS_HPP
 
+#include <map>
+#include <set>
+#include <string>
 #include <pthread.h>
+#include "iFuse.FS.hpp"
 #include "iFuse.Lib.Fd.hpp"
 
 #define IFUSE_BUFFER_CACHE_BLOCK_SIZE         (64*1024)
+#define IFUSE_BUFFER_CACHE_SIZE               (IFUSE_BUFFER_CACHE_BLOCK_SIZE*1024)
+#define IFUSE_BUFFER_CACHE_SHARD_NUM          16
+#define IFUSE_BUFFER_CACHE_DIRTY_LIMIT        (IFUSE_BUFFER_CACHE_BLOCK_SIZE*256)
+#define IFUSE_BUFFER_CACHE_FLUSH_BATCH_SIZE   (4*1024*1024)
+#define IFUSE_BUFFER_CACHE_FLUSH_THREAD_NUM   2
+#define IFUSE_BUFFER_CACHE_POOL_SIZE          (64*1024*1024)
+#define IFUSE_BUFFER_CACHE_POOL_LOCAL_NUM     4
+#define IFUSE_BUFFER_CACHE_HUGEPAGE_SIZE      (2*1024*1024)
+#define IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE     (4*1024*1024)
+#define IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE      (4*1024)
+#define IFUSE_BUFFER_CACHE_WHOLE_FILE_SIZE    (1024*1024)
 
 typedef struct IFuseBufferCache {
     unsigned long fdId;
-    char *iRodsPath;
     off_t offset;
     size_t size;
     char *buffer;
+    bool pooled;
+    unsigned long lastAccess;
+    struct IFuseFileBufferCache *fileCache;
+    struct IFuseBufferCache *lruPrev;
+    struct IFuseBufferCache *lruNext;
 } iFuseBufferCache_t;
 
+typedef struct IFuseBlockBufferList {
+    char *head;
+    unsigned int count;
+} iFuseBlockBufferList_t;
+
+typedef struct IFuseFileBufferCache {
+    char *iRodsPath;
+    off_t fileSize;
+    time_t mtime;
+    ino_t dataId;
+    bool persistent;
+    unsigned int openCount;
+    size_t cachedSize;
+    unsigned long version;
+    std::map<unsigned int, iFuseBufferCache_t*> *blocks;
+    pthread_rwlockattr_t lockAttr;
+    pthread_rwlock_t lock;
+} iFuseFileBufferCache_t;
+
+typedef struct IFuseFileDelta {
+    char *iRodsPath;
+    size_t dirtySize;
+    std::map<off_t, iFuseBufferCache_t*> *ranges;
+    std::set<unsigned long> *writers;
+} iFuseFileDelta_t;
+
+typedef struct IFusePathFlushState {
+    char *iRodsPath;
+    unsigned long queued;
+    unsigned long done;
+    unsigned int waiters;
+    bool busy;
+} iFusePathFlushState_t;
+
+typedef struct IFuseFlushJob {
+    iFuseFd_t *iFuseFd;
+    iFuseFileDelta_t *iFuseFileDelta;
+    iFusePathFlushState_t *pathState;
+} iFuseFlushJob_t;
+
+typedef struct IFuseFdFlushState {
+    unsigned long fdId;
+    int error;
+} iFuseFdFlushState_t;
+
+typedef struct IFuseFdReadState {
+    unsigned long fdId;
+    off_t nextOffset;
+    unsigned int extentBlocks;
+    bool random;
+    bool wholeFile;
+} iFuseFdReadState_t;
+
+typedef struct IFuseFsBufferCacheReport {
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long cachedBlocks;
+    long long cachedBytes;
+    long long fetches;
+    long long fetchedBytes;
+} iFuseFsBufferCacheReport_t;
+
+typedef struct IFuseBufferCacheShard {
+    std::map<std::string, iFuseFileBufferCache_t*> *cacheMap;
+    std::map<std::string, iFuseFileDelta_t*> *deltaMap;
+    std::multimap<std::string, iFuseFileDelta_t*> *flushingMap;
+    unsigned long version;
+    iFuseBufferCache_t *lruHead;
+    iFuseBufferCache_t *lruTail;
+    pthread_mutex_t lruLock;
+    iFuseFsBufferCacheReport_t stat;
+    pthread_rwlockattr_t statLockAttr;
+    pthread_rwlock_t statLock;
+    pthread_rwlockattr_t lockAttr;
+    pthread_rwlock_t lock;
+} iFuseBufferCacheShard_t;
+
+#define IFUSEIOC_SHOW_BUFFER_CACHE _IOR(IOCTL_APP_NUMBER, 2, iFuseFsBufferCacheReport_t)
+
 void iFuseBufferedFSInit();
 void iFuseBufferedFSDestroy();
 
@@ -40,12 +139,20 @@ unsigned int getBlockID(off_t off);
 off_t getBlockStartOffset(unsigned int blockID);
 off_t getInBlockOffset(off_t off);
 
+void iFuseBufferedFsReport(iFuseFsBufferCacheReport_t *report);
+
+char *iFuseBufferedFsAllocBlockBuffer();
+void iFuseBufferedFsFreeBlockBuffer(char *buf);
+
+void iFuseBufferedFsInvalidateCache(const char *iRodsPath);
 int iFuseBufferedFsGetAttr(const char *iRodsPath, struct stat *stbuf);
 int iFuseBufferedFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag);
 int iFuseBufferedFsClose(iFuseFd_t *iFuseFd);
 int iFuseBufferedFsFlush(iFuseFd_t *iFuseFd);
-int iFuseBufferedFsReadBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID);
+bool iFuseBufferedFsIsWholeFile(iFuseFd_t *iFuseFd);
+int iFuseBufferedFsReadBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size);
 int iFuseBufferedFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size);
 int iFuseBufferedFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size);
+int iFuseBufferedFsIoctl(const char *iRodsPath, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data);
 
 #endif	/* IFUSE_BUFFEREDFS_HPP */
@@ -42,6 +42,7 @@ void iFuseFsInit();
 void iFuseFsDestroy();
 int iFuseFsGetAttr(const char *iRodsPath, struct stat *stbuf);
 int iFuseFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag);
+int iFuseFsDetach(iFuseFd_t *iFuseFd);
 int iFuseFsClose(iFuseFd_t *iFuseFd);
 int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size);
 int iFuseFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size);
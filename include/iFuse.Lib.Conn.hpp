@@ -24,6 +24,10 @@
 #include "rodsClient.h"
 
 #define IFUSE_MAX_NUM_CONN	10
+#define IFUSE_MAX_NUM_SHORTOP_CONN	4
+#define IFUSE_MIN_NUM_CONN	0
+
+#define IFUSE_CONN_GROW_THRESHOLD_PERCENT   50
 
 #define IFUSE_CONN_TYPE_FOR_FILE_IO      0
 #define IFUSE_CONN_TYPE_FOR_SHORTOP      1
@@ -33,6 +37,10 @@
 #define IFUSE_FREE_CONN_TIMEOUT_SEC         (60*5)
 #define IFUSE_FREE_CONN_KEEPALIVE_SEC       (60*3)
 
+#define IFUSE_CONN_KEEPALIVE_THREAD_NUM     4
+
+#define IFUSE_CONN_PATH_GEN_MAX_NUM         1024
+
 typedef struct IFuseConn {
     unsigned long connId;
     int type;
@@ -40,6 +48,12 @@ typedef struct IFuseConn {
     time_t lastActTime;
     time_t lastUseTime;
     int inuseCnt;
+    bool checking;
+    unsigned long viewGen;
+    bool connecting;
+    int connectStatus;
+    pthread_mutex_t connectLock;
+    pthread_cond_t connectCond;
     pthread_rwlockattr_t lockAttr;
     pthread_rwlock_t lock;
 } iFuseConn_t;
@@ -66,10 +80,13 @@ typedef struct IFuseFsConnReport {
 int iFuseConnTest();
 void iFuseConnInit();
 void iFuseConnDestroy();
+void iFuseConnWarmUp();
 void iFuseConnReport(iFuseFsConnReport_t *report);
-int iFuseConnGetAndUse(iFuseConn_t **iFuseConn, int connType);
+int iFuseConnGetAndUse(iFuseConn_t **iFuseConn, int connType, const char *iRodsPath);
 int iFuseConnUnuse(iFuseConn_t *iFuseConn);
 void iFuseConnUpdateLastActTime(iFuseConn_t *iFuseConn, bool lock);
+void iFuseConnMarkMutation(iFuseConn_t *iFuseConn);
+void iFuseConnMarkPathMutation(iFuseConn_t *iFuseConn, const char *iRodsPath);
 int iFuseConnReconnect(iFuseConn_t *iFuseConn);
 void iFuseConnLock(iFuseConn_t *iFuseConn);
 void iFuseConnUnlock(iFuseConn_t *iFuseConn);
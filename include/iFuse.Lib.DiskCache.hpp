@@ -0,0 +1,61 @@
+/*** Copyright (c), The Regents of the University of California            ***
+ *** For more information please refer to files in the COPYRIGHT directory ***/
+/*
+    Copyright 2020 The Trustees of University of Arizona and CyVerse
+
+    Licensed under the Apache License, Version 2.0 (the "License" );
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef IFUSE_LIB_DISKCACHE_HPP
+#define IFUSE_LIB_DISKCACHE_HPP
+
+#include <sys/types.h>
+#include <time.h>
+
+#define IFUSE_DISK_CACHE_SIZE_GB           10
+#define IFUSE_DISK_CACHE_DIR_NUM           256
+#define IFUSE_DISK_CACHE_MAGIC             0x69467544
+
+/*
+ * identifies a version of file content
+ * blocks are stored and found only with the same key
+ */
+typedef struct IFuseDiskCacheKey {
+    const char *iRodsPath;
+    ino_t dataId;
+    time_t mtime;
+    off_t fileSize;
+    size_t blockSize;
+} iFuseDiskCacheKey_t;
+
+typedef struct IFuseDiskCacheHeader {
+    unsigned int magic;
+    unsigned int keyLen;
+    unsigned long long dataSize;
+} iFuseDiskCacheHeader_t;
+
+typedef struct IFuseDiskCacheEntry {
+    char *name;
+    size_t size;
+    unsigned long lastAccess;
+} iFuseDiskCacheEntry_t;
+
+void iFuseDiskCacheInit();
+void iFuseDiskCacheDestroy();
+bool iFuseDiskCacheEnabled();
+bool iFuseDiskCacheHas(const iFuseDiskCacheKey_t *key, unsigned int blockID);
+int iFuseDiskCacheGet(const iFuseDiskCacheKey_t *key, unsigned int blockID, char *buf, size_t size);
+int iFuseDiskCachePut(const iFuseDiskCacheKey_t *key, unsigned int blockID, const char *buf, size_t size);
+int iFuseDiskCacheRemove(const iFuseDiskCacheKey_t *key, unsigned int blockID);
+
+#endif	/* IFUSE_LIB_DISKCACHE_HPP */
@@ -30,6 +30,7 @@ typedef struct IFuseFd {
     char *iRodsPath;
     int openFlag;
     off_t lastFilePointer;
+    bool written;
     pthread_rwlockattr_t lockAttr;
     pthread_rwlock_t lock;
 } iFuseFd_t;
@@ -48,6 +49,8 @@ typedef struct IFuseDir {
 void iFuseFdInit();
 void iFuseFdDestroy();
 int iFuseFdOpen(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, const char* iRodsPath, int openFlag);
+int iFuseFdAttach(iFuseFd_t *iFuseFd, iFuseConn_t *iFuseConn);
+int iFuseFdDetach(iFuseFd_t *iFuseFd, iFuseConn_t **iFuseConn);
 int iFuseFdReopen(iFuseFd_t *iFuseFd);
 int iFuseDirOpen(iFuseDir_t **iFuseDir, iFuseConn_t *iFuseConn, const char* iRodsPath);
 int iFuseDirOpenWithCache(iFuseDir_t **iFuseDir, const char* iRodsPath, const char* cachedEntries, unsigned int entryBufferLen);
@@ -0,0 +1,48 @@
+/*** Copyright (c), The Regents of the University of California            ***
+ *** For more information please refer to files in the COPYRIGHT directory ***/
+/*
+    Copyright 2020 The Trustees of University of Arizona and CyVerse
+
+    Licensed under the Apache License, Version 2.0 (the "License" );
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef IFUSE_LIB_IOSCHED_HPP
+#define IFUSE_LIB_IOSCHED_HPP
+
+#define IFUSE_IO_PRIORITY_FOREGROUND       0
+#define IFUSE_IO_PRIORITY_STREAM           1
+#define IFUSE_IO_PRIORITY_BACKGROUND       2
+#define IFUSE_IO_PRIORITY_NUM              3
+
+#define IFUSE_IO_SCHED_MAX_DEFER_MSEC      100
+
+/*
+ * Usage pattern
+ * - iFuseIOSchedInit
+ * - iFuseIOSchedSetPriority (background worker threads)
+ * - iFuseIOSchedBegin
+ * - a data request to iRODS
+ * - iFuseIOSchedEnd
+ * - iFuseIOSchedDestroy
+ */
+
+void iFuseIOSchedInit();
+void iFuseIOSchedDestroy();
+void iFuseIOSchedSetPriority(int priority);
+int iFuseIOSchedGetPriority();
+bool iFuseIOSchedHasForeground();
+bool iFuseIOSchedWaitBackground(int timeoutMsec);
+void iFuseIOSchedBegin();
+void iFuseIOSchedEnd();
+
+#endif	/* IFUSE_LIB_IOSCHED_HPP */
@@ -39,7 +39,15 @@ typedef struct IFuseOpt {
     bool preload;
     bool cacheMetadata;
     int maxConn;
+    int maxShortopConn;
+    int minConn;
     int blocksize;
+    int bufferCacheSize;
+    int dirtyLimit;
+    int flushThreads;
+    int wholeFileSize;
+    char *diskCacheDir;
+    int diskCacheSize;
     bool connReuse;
     int connTimeoutSec;
     int connKeepAliveSec;
@@ -47,6 +55,8 @@ typedef struct IFuseOpt {
     int rodsapiTimeoutSec;
     int preloadNumThreads;
     int preloadNumBlocks;
+    int preloadMemSize;
+    int preloadInflightSize;
     int metadataCacheTimeoutSec;
     char *host;
     int port;
@@ -24,39 +24,74 @@
 #include "iFuse.BufferedFS.hpp"
 #include "iFuse.Lib.Fd.hpp"
 
-#define IFUSE_PRELOAD_PBLOCK_NUM             3
+#define IFUSE_PRELOAD_PBLOCK_NUM             64
 #define IFUSE_PRELOAD_THREAD_NUM             3
-#define IFUSE_PRELOAD_MAX_PBLOCK_NUM         10
+#define IFUSE_PRELOAD_MAX_WINDOW_SIZE        (8*1024*1024)
 #define IFUSE_PRELOAD_MAX_THREAD_NUM         10
+#define IFUSE_PRELOAD_WINDOW_INIT_PBLOCK_NUM 2
+#define IFUSE_PRELOAD_REPORT_FD_NUM          64
+#define IFUSE_PRELOAD_MEM_SIZE               (32*1024*1024)
+#define IFUSE_PRELOAD_INFLIGHT_SIZE          (8*1024*1024)
+#define IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM   2
 
 #define IFUSE_PRELOAD_PBLOCK_STATUS_INIT                 0
 #define IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING              1
 #define IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED            2
 #define IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED          3
-#define IFUSE_PRELOAD_PBLOCK_STATUS_CREATION_FAILED      4
+#define IFUSE_PRELOAD_PBLOCK_STATUS_CANCELLED            4
 
 typedef struct IFusePreloadPBlock {
-    iFuseFd_t *fd;
+    struct IFusePreload *preload;
     unsigned int blockID;
     int status;
-    bool threadJoined;
-    pthread_t thread;
-    pthread_rwlockattr_t lockAttr;
-    pthread_rwlock_t lock;
+    bool abandoned;
 } iFusePreloadPBlock_t;
 
+typedef struct IFusePreloadHandles {
+    char *iRodsPath;
+    unsigned int refCount;
+    std::list<iFuseFd_t*> *fds;
+} iFusePreloadHandles_t;
+
 typedef struct IFusePreload {
     unsigned long fdId;
+    unsigned int refCount;
     char *iRodsPath;
+    iFusePreloadHandles_t *handles;
+    bool accessed;
+    unsigned int lastBlockID;
+    unsigned int lastBlockNum;
+    long long stride;
+    unsigned int window;
+    unsigned int inflightBlocks;
+    unsigned int residentBlocks;
     std::list<iFusePreloadPBlock_t*> *pblocks;
     pthread_rwlockattr_t lockAttr;
     pthread_rwlock_t lock;
 } iFusePreload_t;
 
-typedef struct IFusePreloadThreadParam {
-    iFusePreload_t *preload;
-    iFusePreloadPBlock_t *pblock;
-} iFusePreloadThreadParam_t;
+typedef struct IFusePreloadFdReport {
+    long long fdId;
+    long long stride;
+    long long window;
+    long long inflightBlocks;
+    long long residentBlocks;
+} iFusePreloadFdReport_t;
+
+typedef struct IFusePreloadReport {
+    long long blockSize;
+    long long maxWindow;
+    long long memBudget;
+    long long inflightBudget;
+    long long residentBytes;
+    long long inflightBytes;
+    long long streamNum;
+    long long streamShare;
+    long long fdNum;
+    iFusePreloadFdReport_t fds[IFUSE_PRELOAD_REPORT_FD_NUM];
+} iFusePreloadReport_t;
+
+#define IFUSEIOC_SHOW_PRELOAD _IOR(IOCTL_APP_NUMBER, 3, iFusePreloadReport_t)
 
 void iFusePreloadInit();
 void iFusePreloadDestroy();
@@ -64,5 +99,8 @@ void iFusePreloadDestroy();
 int iFusePreloadOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag);
 int iFusePreloadClose(iFuseFd_t *iFuseFd);
 int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size);
+int iFusePreloadIoctl(const char *iRodsPath, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data);
+
+void iFusePreloadReport(const char *iRodsPath, iFusePreloadReport_t *report);
 
 #endif	/* IFUSE_PRELOAD_HPP */
@@ -21,9 +21,6 @@
 
 #include "iFuse.Lib.hpp"
 
-// for Postgresql-iCAT only
-//#define USE_CONNREUSE
-
 #define IFUSE_CMD_ARG_MAX_TOKEN_LEN 200
 #define MAX_PASSWORD_INPUT_LEN 100
 
@@ -22,24 +22,105 @@
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sys/mman.h>
 #include <map>
+#include <list>
 #include <string>
 #include <cstring>
 #include "iFuse.FS.hpp"
 #include "iFuse.Lib.hpp"
 #include "iFuse.Lib.Fd.hpp"
+#include "iFuse.Lib.DiskCache.hpp"
+#include "iFuse.Lib.IOSched.hpp"
 #include "iFuse.BufferedFS.hpp"
 #include "iFuse.Lib.Util.hpp"
 #include "iFuse.Lib.RodsClientAPI.hpp"
 #include "miscUtil.h"
 
-static pthread_rwlockattr_t g_BufferCacheLockAttr;
-static pthread_rwlock_t g_BufferCacheLock;
+static iFuseBufferCacheShard_t g_CacheShards[IFUSE_BUFFER_CACHE_SHARD_NUM];
 
-static std::map<std::string, iFuseBufferCache_t*> g_DeltaMap;
-static std::map<unsigned long, iFuseBufferCache_t*> g_CacheMap;
+static pthread_rwlockattr_t g_CachedSizeLockAttr;
+static pthread_rwlock_t g_CachedSizeLock;
+
+static pthread_rwlockattr_t g_DirtySizeLockAttr;
+static pthread_rwlock_t g_DirtySizeLock;
 
 static int g_Blocksize = IFUSE_BUFFER_CACHE_BLOCK_SIZE;
+static size_t g_CacheSize = IFUSE_BUFFER_CACHE_SIZE;
+static size_t g_CachedSize = 0;
+static size_t g_DirtyLimit = IFUSE_BUFFER_CACHE_DIRTY_LIMIT;
+static size_t g_DirtySize = 0;
+static off_t g_WholeFileSize = IFUSE_BUFFER_CACHE_WHOLE_FILE_SIZE;
+
+static pthread_mutex_t g_FlushLock;
+static pthread_cond_t g_FlushJobCond;
+static pthread_cond_t g_FlushDoneCond;
+static std::list<iFuseFlushJob_t*> g_FlushJobs;
+static std::map<unsigned long, iFuseFdFlushState_t*> g_FlushStateMap;
+static std::map<std::string, iFusePathFlushState_t*> g_PathFlushStateMap;
+static pthread_t *g_FlushThreads = NULL;
+static int g_FlushThreadNum = IFUSE_BUFFER_CACHE_FLUSH_THREAD_NUM;
+static bool g_FlushRunning = false;
+
+static pthread_mutex_t g_ReadStateLock;
+static std::map<unsigned long, iFuseFdReadState_t*> g_ReadStateMap;
+
+static pthread_mutex_t g_BlockPoolLock;
+static pthread_key_t g_BlockPoolKey;
+static iFuseBlockBufferList_t g_BlockPool;
+static unsigned int g_BlockPoolLimit = 0;
+
+static pthread_key_t g_FetchBufferKey;
+
+/*
+ * Block caches are shared by all file handles of the same path and kept
+ * after close until evicted or invalidated.
+ *
+ * Caches and deltas are partitioned into shards by path so that accesses
+ * to different files rarely contend on the same lock.
+ *
+ * Dirty data are kept per file as sorted, disjoint ranges that never cross
+ * a block boundary. A delta is detached and handed to flusher threads when
+ * it grows to a flush batch, when g_DirtyLimit is exceeded or on flush/close.
+ * Detached deltas stay in flushingMap, so reads see them, until written.
+ * A delta holds writes of every file descriptor of the path and remembers
+ * them. Jobs of a path are written one at a time in detach order, as
+ * background requests unless a flush or close is waiting for them. Flush
+ * and close of a file descriptor wait for all jobs of the path queued
+ * before, and a write error is reported to every writer of the delta.
+ * A delta failed to be written is not applied to cached blocks, they are
+ * dropped instead.
+ *
+ * Lock order :
+ * - iFuseBufferCacheShard_t
+ * - iFuseFileBufferCache_t / g_FlushLock
+ * - statLock / lruLock of iFuseBufferCacheShard_t / g_CachedSizeLock / g_DirtySizeLock
+ *
+ * Cached blocks of a shard are linked in a LRU list. Eviction compares the
+ * oldest blocks of shards under their lruLock and write-locks only the
+ * shard of the victim, so it costs the same regardless of cached files
+ * and blocks.
+ *
+ * Reads fetch missing blocks in extents whose size is adapted per file
+ * descriptor: it doubles while reads stay sequential and halves otherwise.
+ * Once it is down to a block and reads are still random, a read within a
+ * block that is not cached fetches only the IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE
+ * pages it covers, which are not cached. Reads served by Preload do not
+ * reach here, so the extent grows only for sequential reads Preload misses.
+ *
+ * Read-only opens of files up to g_WholeFileSize fetch the whole file with
+ * a single read and detach the descriptor from iRODS, or do not read at all
+ * if all blocks are cached. The file is opened on iRODS in either case, so
+ * that permission of the user is checked before cached blocks are served.
+ * Reads missing the caches later open the file again.
+ *
+ * g_FlushLock is taken under a shard lock only to queue a detached delta.
+ * g_ReadStateLock is never held together with any of above.
+ *
+ * Block maps are modified only with the shard write-locked,
+ * file locks guard block access when the shard is read-locked.
+ * No two shards are locked at the same time.
+ */
 
 static int _newBufferCache(iFuseBufferCache_t **iFuseBufferCache) {
     iFuseBufferCache_t *tmpIFuseBufferCache = NULL;
@@ -61,463 +142,2784 @@ static int _freeBufferCache(iFuseBufferCache_t *iFuseBufferCache) {
 
     iFuseBufferCache->fdId = 0;
 
-    if(iFuseBufferCache->iRodsPath != NULL) {
-        free(iFuseBufferCache->iRodsPath);
-        iFuseBufferCache->iRodsPath = NULL;
-    }
-
     if(iFuseBufferCache->buffer != NULL) {
-        free(iFuseBufferCache->buffer);
+        if(iFuseBufferCache->pooled) {
+            iFuseBufferedFsFreeBlockBuffer(iFuseBufferCache->buffer);
+        } else {
+            free(iFuseBufferCache->buffer);
+        }
         iFuseBufferCache->buffer = NULL;
     }
 
     iFuseBufferCache->offset = 0;
     iFuseBufferCache->size = 0;
+    iFuseBufferCache->lastAccess = 0;
+    iFuseBufferCache->fileCache = NULL;
+    iFuseBufferCache->lruPrev = NULL;
+    iFuseBufferCache->lruNext = NULL;
 
     free(iFuseBufferCache);
     return 0;
 }
 
-size_t getBufferCacheBlockSize() {
-    return g_Blocksize;
+/*
+ * Block buffers are recycled through a small free list per thread
+ * backed by a shared free list, both linked through the buffers themselves.
+ * Buffers of huge page multiples are aligned and advised to use huge pages.
+ */
+static char *_allocBufferMemory(size_t size) {
+#ifdef MADV_HUGEPAGE
+    if(size % IFUSE_BUFFER_CACHE_HUGEPAGE_SIZE == 0) {
+        void *ptr = NULL;
+
+        if(posix_memalign(&ptr, IFUSE_BUFFER_CACHE_HUGEPAGE_SIZE, size) != 0) {
+            return NULL;
+        }
+
+        madvise(ptr, size, MADV_HUGEPAGE);
+        return (char*)ptr;
+    }
+#endif
+    return (char*)malloc(size);
 }
 
-unsigned int getBlockID(off_t off) {
-    assert(off >= 0);
+static void _pushBlockBuffer(iFuseBlockBufferList_t *list, char *buf) {
+    *(char**)buf = list->head;
+    list->head = buf;
+    list->count++;
+}
 
-    return off / g_Blocksize;
+static char *_popBlockBuffer(iFuseBlockBufferList_t *list) {
+    char *buf = list->head;
+
+    if(buf != NULL) {
+        list->head = *(char**)buf;
+        list->count--;
+    }
+    return buf;
 }
 
-off_t getBlockStartOffset(unsigned int blockID) {
-    off_t blockStartOffset = 0;
+static void _releaseLocalBlockPool(void *param) {
+    iFuseBlockBufferList_t *local = (iFuseBlockBufferList_t*)param;
+    char *buf = NULL;
 
-    blockStartOffset = (off_t)blockID * g_Blocksize;
+    // called at thread exit
+    pthread_mutex_lock(&g_BlockPoolLock);
 
-    assert(blockStartOffset >= 0);
+    while((buf = _popBlockBuffer(local)) != NULL) {
+        if(g_BlockPool.count < g_BlockPoolLimit) {
+            _pushBlockBuffer(&g_BlockPool, buf);
+        } else {
+            free(buf);
+        }
+    }
 
-    return blockStartOffset;
+    pthread_mutex_unlock(&g_BlockPoolLock);
+
+    free(local);
 }
 
-off_t getInBlockOffset(off_t off) {
-    off_t inBlockOffset = 0;
+static iFuseBlockBufferList_t *_getLocalBlockPool() {
+    iFuseBlockBufferList_t *local = (iFuseBlockBufferList_t*)pthread_getspecific(g_BlockPoolKey);
 
-    assert(off >= 0);
+    if(local == NULL) {
+        local = (iFuseBlockBufferList_t*)calloc(1, sizeof(iFuseBlockBufferList_t));
+        if(local != NULL) {
+            pthread_setspecific(g_BlockPoolKey, local);
+        }
+    }
+    return local;
+}
 
-    inBlockOffset = off - getBlockStartOffset(getBlockID(off));
+/*
+ * Get a buffer of a block size, contents are not initialized
+ */
+char *iFuseBufferedFsAllocBlockBuffer() {
+    iFuseBlockBufferList_t *local = _getLocalBlockPool();
+    char *buf = NULL;
+
+    if(local != NULL) {
+        buf = _popBlockBuffer(local);
+        if(buf != NULL) {
+            return buf;
+        }
+    }
 
-    assert(inBlockOffset >= 0);
+    pthread_mutex_lock(&g_BlockPoolLock);
+    buf = _popBlockBuffer(&g_BlockPool);
+    pthread_mutex_unlock(&g_BlockPoolLock);
 
-    return inBlockOffset;
+    if(buf == NULL) {
+        buf = _allocBufferMemory(g_Blocksize);
+    }
+    return buf;
 }
 
-static bool _isSameBlock(off_t off1, off_t off2) {
-    return getBlockID(off1) == getBlockID(off2);
+void iFuseBufferedFsFreeBlockBuffer(char *buf) {
+    iFuseBlockBufferList_t *local = _getLocalBlockPool();
+
+    assert(buf != NULL);
+
+    if(local != NULL && local->count < IFUSE_BUFFER_CACHE_POOL_LOCAL_NUM) {
+        _pushBlockBuffer(local, buf);
+        return;
+    }
+
+    pthread_mutex_lock(&g_BlockPoolLock);
+
+    if(g_BlockPool.count < g_BlockPoolLimit) {
+        _pushBlockBuffer(&g_BlockPool, buf);
+        buf = NULL;
+    }
+
+    pthread_mutex_unlock(&g_BlockPoolLock);
+
+    if(buf != NULL) {
+        free(buf);
+    }
 }
 
-static void _applyDeltaToCache(const char *iRodsPath, const char *buf, off_t off, size_t size) {
-    std::map<unsigned long, iFuseBufferCache_t*>::iterator it_cachemap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
+/*
+ * Get the buffer a thread receives multi-block fetches into
+ * it is IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE long, allocated at first use
+ * and kept until the thread exits
+ */
+static char *_getFetchBuffer() {
+    char *buf = (char*)pthread_getspecific(g_FetchBufferKey);
+
+    if(buf == NULL) {
+        buf = _allocBufferMemory(IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE);
+        if(buf != NULL) {
+            pthread_setspecific(g_FetchBufferKey, buf);
+        }
+    }
+    return buf;
+}
+
+static iFuseBufferCacheShard_t *_getCacheShard(const char *iRodsPath) {
+    unsigned long hash = 5381;
+    const char *p = NULL;
 
     assert(iRodsPath != NULL);
-    assert(buf != NULL);
-    assert(off >= 0);
-    assert(size > 0);
 
-    for (it_cachemap = g_CacheMap.begin(); it_cachemap != g_CacheMap.end(); it_cachemap++) {
-        iFuseBufferCache = it_cachemap->second;
+    // djb2
+    for(p = iRodsPath; *p != 0; p++) {
+        hash = ((hash << 5) + hash) + (unsigned char)*p;
+    }
+
+    return &g_CacheShards[hash % IFUSE_BUFFER_CACHE_SHARD_NUM];
+}
+
+static void _updateCacheStat(iFuseBufferCacheShard_t *shard, long long hits, long long misses, long long evictions, long long blocks, long long bytes) {
+    assert(shard != NULL);
+
+    pthread_rwlock_wrlock(&shard->statLock);
+
+    shard->stat.hits += hits;
+    shard->stat.misses += misses;
+    shard->stat.evictions += evictions;
+    shard->stat.cachedBlocks += blocks;
+    shard->stat.cachedBytes += bytes;
+
+    pthread_rwlock_unlock(&shard->statLock);
+
+    if(bytes != 0) {
+        pthread_rwlock_wrlock(&g_CachedSizeLock);
+
+        g_CachedSize += bytes;
+
+        pthread_rwlock_unlock(&g_CachedSizeLock);
+    }
+}
+
+static void _updateFetchStat(iFuseBufferCacheShard_t *shard, long long fetches, long long bytes) {
+    assert(shard != NULL);
+
+    pthread_rwlock_wrlock(&shard->statLock);
+
+    shard->stat.fetches += fetches;
+    shard->stat.fetchedBytes += bytes;
+
+    pthread_rwlock_unlock(&shard->statLock);
+}
+
+static size_t _getCachedSize() {
+    size_t cachedSize = 0;
+
+    pthread_rwlock_rdlock(&g_CachedSizeLock);
+
+    cachedSize = g_CachedSize;
+
+    pthread_rwlock_unlock(&g_CachedSizeLock);
+    return cachedSize;
+}
+
+/*
+ * Access stamps are taken from monotonic clock so they can be compared
+ * across shards without a global counter
+ */
+static unsigned long _getAccessStamp() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+static void _unlinkLRULocked(iFuseBufferCacheShard_t *shard, iFuseBufferCache_t *iFuseBufferCache) {
+    if(iFuseBufferCache->lruPrev != NULL) {
+        iFuseBufferCache->lruPrev->lruNext = iFuseBufferCache->lruNext;
+    } else {
+        shard->lruHead = iFuseBufferCache->lruNext;
+    }
+
+    if(iFuseBufferCache->lruNext != NULL) {
+        iFuseBufferCache->lruNext->lruPrev = iFuseBufferCache->lruPrev;
+    } else {
+        shard->lruTail = iFuseBufferCache->lruPrev;
+    }
+
+    iFuseBufferCache->lruPrev = NULL;
+    iFuseBufferCache->lruNext = NULL;
+}
+
+/*
+ * Mark a cached block as most recently used
+ * the block is linked to the LRU list of the shard if not yet
+ * must be called with the shard locked
+ */
+static void _touchLRU(iFuseBufferCacheShard_t *shard, iFuseBufferCache_t *iFuseBufferCache) {
+    pthread_mutex_lock(&shard->lruLock);
+
+    if(shard->lruHead != iFuseBufferCache) {
+        if(iFuseBufferCache->lruPrev != NULL) {
+            _unlinkLRULocked(shard, iFuseBufferCache);
+        }
+
+        iFuseBufferCache->lruNext = shard->lruHead;
+        if(shard->lruHead != NULL) {
+            shard->lruHead->lruPrev = iFuseBufferCache;
+        } else {
+            shard->lruTail = iFuseBufferCache;
+        }
+        shard->lruHead = iFuseBufferCache;
+    }
+
+    iFuseBufferCache->lastAccess = _getAccessStamp();
+
+    pthread_mutex_unlock(&shard->lruLock);
+}
+
+/*
+ * Unlink a block removed from a file buffer cache
+ */
+static void _unlinkLRU(iFuseBufferCacheShard_t *shard, iFuseBufferCache_t *iFuseBufferCache) {
+    pthread_mutex_lock(&shard->lruLock);
+
+    _unlinkLRULocked(shard, iFuseBufferCache);
+
+    pthread_mutex_unlock(&shard->lruLock);
+}
+
+static int _newFileBufferCache(iFuseFileBufferCache_t **iFuseFileBufferCache) {
+    iFuseFileBufferCache_t *tmpIFuseFileBufferCache = NULL;
+
+    assert(iFuseFileBufferCache != NULL);
+
+    tmpIFuseFileBufferCache = (iFuseFileBufferCache_t *) calloc(1, sizeof ( iFuseFileBufferCache_t));
+    if (tmpIFuseFileBufferCache == NULL) {
+        *iFuseFileBufferCache = NULL;
+        return SYS_MALLOC_ERR;
+    }
+
+    // we must use new keyword instead of calloc since it contains c++ stl map object
+    tmpIFuseFileBufferCache->blocks = new std::map<unsigned int, iFuseBufferCache_t*>();
+    if(tmpIFuseFileBufferCache->blocks == NULL) {
+        *iFuseFileBufferCache = NULL;
+        free(tmpIFuseFileBufferCache);
+        return SYS_MALLOC_ERR;
+    }
+
+    tmpIFuseFileBufferCache->fileSize = -1;
+
+    pthread_rwlockattr_init(&tmpIFuseFileBufferCache->lockAttr);
+    pthread_rwlock_init(&tmpIFuseFileBufferCache->lock, &tmpIFuseFileBufferCache->lockAttr);
+
+    *iFuseFileBufferCache = tmpIFuseFileBufferCache;
+    return 0;
+}
+
+/*
+ * Release all blocks cached for a file
+ * must be called with the shard write-locked
+ */
+static void _clearFileBufferCache(iFuseBufferCacheShard_t *shard, iFuseFileBufferCache_t *iFuseFileBufferCache) {
+    std::map<unsigned int, iFuseBufferCache_t*>::iterator it_blockmap;
+    long long releasedBlocks = 0;
+    long long releasedBytes = 0;
+
+    assert(shard != NULL);
+    assert(iFuseFileBufferCache != NULL);
+
+    while(!iFuseFileBufferCache->blocks->empty()) {
+        it_blockmap = iFuseFileBufferCache->blocks->begin();
+
+        releasedBlocks++;
+        releasedBytes += it_blockmap->second->size;
+
+        _unlinkLRU(shard, it_blockmap->second);
+        _freeBufferCache(it_blockmap->second);
+        iFuseFileBufferCache->blocks->erase(it_blockmap);
+    }
+
+    iFuseFileBufferCache->cachedSize = 0;
+
+    _updateCacheStat(shard, 0, 0, 0, -releasedBlocks, -releasedBytes);
+}
+
+static int _freeFileBufferCache(iFuseBufferCacheShard_t *shard, iFuseFileBufferCache_t *iFuseFileBufferCache) {
+    assert(shard != NULL);
+    assert(iFuseFileBufferCache != NULL);
+
+    if(iFuseFileBufferCache->blocks != NULL) {
+        _clearFileBufferCache(shard, iFuseFileBufferCache);
+
+        delete iFuseFileBufferCache->blocks;
+        iFuseFileBufferCache->blocks = NULL;
+    }
+
+    if(iFuseFileBufferCache->iRodsPath != NULL) {
+        free(iFuseFileBufferCache->iRodsPath);
+        iFuseFileBufferCache->iRodsPath = NULL;
+    }
+
+    iFuseFileBufferCache->fileSize = 0;
+    iFuseFileBufferCache->mtime = 0;
+    iFuseFileBufferCache->dataId = 0;
+    iFuseFileBufferCache->persistent = false;
+    iFuseFileBufferCache->openCount = 0;
+    iFuseFileBufferCache->version = 0;
+
+    pthread_rwlock_destroy(&iFuseFileBufferCache->lock);
+    pthread_rwlockattr_destroy(&iFuseFileBufferCache->lockAttr);
+
+    free(iFuseFileBufferCache);
+    return 0;
+}
+
+/*
+ * Remove a file buffer cache if it is not used by anyone
+ * must be called with the shard write-locked
+ */
+static void _releaseFileBufferCacheIfUnused(iFuseBufferCacheShard_t *shard, std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap) {
+    iFuseFileBufferCache_t *iFuseFileBufferCache = it_cachemap->second;
 
-        iFuseLibLog(LOG_DEBUG, "_applyDeltaToCache: comp %s - %s", iFuseBufferCache->iRodsPath, iRodsPath);
-        if (strcmp(iFuseBufferCache->iRodsPath, iRodsPath) == 0) {
-            if (_isSameBlock(iFuseBufferCache->offset, off)) {
-                // update
-                off_t endOffset = off + size >  iFuseBufferCache->offset + iFuseBufferCache->size ? off + size : iFuseBufferCache->offset + iFuseBufferCache->size;
-                size_t newSize = endOffset - iFuseBufferCache->offset;
+    if(iFuseFileBufferCache->openCount == 0 && iFuseFileBufferCache->blocks->empty()) {
+        shard->cacheMap->erase(it_cachemap);
+        _freeFileBufferCache(shard, iFuseFileBufferCache);
+    }
+}
+
+/*
+ * Find a shard whose least recently used block is the oldest
+ * only lruLock of shards is taken
+ */
+static iFuseBufferCacheShard_t *_findVictimShard() {
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseBufferCacheShard_t *victimShard = NULL;
+    unsigned long victimLastAccess = 0;
+    int i;
 
-                assert(newSize > 0);
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
 
-                memcpy(iFuseBufferCache->buffer + (off - iFuseBufferCache->offset), buf, size);
+        pthread_mutex_lock(&shard->lruLock);
 
-                iFuseBufferCache->size = newSize;
+        if(shard->lruTail != NULL) {
+            if(victimShard == NULL || shard->lruTail->lastAccess < victimLastAccess) {
+                victimShard = shard;
+                victimLastAccess = shard->lruTail->lastAccess;
             }
         }
+
+        pthread_mutex_unlock(&shard->lruLock);
     }
+
+    return victimShard;
 }
 
-static int _flushDelta(iFuseFd_t *iFuseFd) {
-    int status = 0;
-    std::map<std::string, iFuseBufferCache_t*>::iterator it_deltamap;
+/*
+ * Evict least recently used blocks until cached blocks fit in the budget
+ * must be called without holding any shard lock
+ */
+static void _evictBufferCache() {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
     iFuseBufferCache_t *iFuseBufferCache = NULL;
-    std::string pathkey(iFuseFd->iRodsPath);
 
-    assert(iFuseFd != NULL);
+    while(_getCachedSize() > g_CacheSize) {
+        shard = _findVictimShard();
+        if(shard == NULL) {
+            // nothing to evict
+            break;
+        }
 
-    if((iFuseFd->openFlag & O_ACCMODE) != O_RDONLY) {
-        pthread_rwlock_wrlock(&g_BufferCacheLock);
+        pthread_rwlock_wrlock(&shard->lock);
+
+        // the oldest block may have been changed while unlocked
+        iFuseBufferCache = shard->lruTail;
+        if(iFuseBufferCache == NULL) {
+            pthread_rwlock_unlock(&shard->lock);
+            continue;
+        }
 
-        it_deltamap = g_DeltaMap.find(pathkey);
-        if(it_deltamap != g_DeltaMap.end()) {
-            // has it - flush
-            iFuseBufferCache = it_deltamap->second;
+        iFuseFileBufferCache = iFuseBufferCache->fileCache;
+        assert(iFuseFileBufferCache != NULL);
 
-            g_DeltaMap.erase(it_deltamap);
+        _unlinkLRU(shard, iFuseBufferCache);
+        iFuseFileBufferCache->blocks->erase(getBlockID(iFuseBufferCache->offset));
 
-            // apply to caches
-            _applyDeltaToCache(iFuseFd->iRodsPath, iFuseBufferCache->buffer, iFuseBufferCache->offset, iFuseBufferCache->size);
+        iFuseLibLog(LOG_DEBUG, "_evictBufferCache: evict a block of %s - offset: %lld, size: %lld", iFuseFileBufferCache->iRodsPath, (long long)iFuseBufferCache->offset, (long long)iFuseBufferCache->size);
 
-            // release lock before making a write request
-            pthread_rwlock_unlock(&g_BufferCacheLock);
+        assert(iFuseFileBufferCache->cachedSize >= iFuseBufferCache->size);
+        iFuseFileBufferCache->cachedSize -= iFuseBufferCache->size;
 
-            status = iFuseFsWrite(iFuseFd, iFuseBufferCache->buffer, iFuseBufferCache->offset, iFuseBufferCache->size);
-            if (status < 0) {
-                iFuseLibLogError(LOG_ERROR, status, "_flushDelta: iFuseFsWrite of %s error, status = %d",
-                        iFuseFd->iRodsPath, status);
-                return -ENOENT;
-            }
+        _updateCacheStat(shard, 0, 0, 1, -1, -(long long)iFuseBufferCache->size);
+
+        _freeBufferCache(iFuseBufferCache);
+
+        it_cachemap = shard->cacheMap->find(std::string(iFuseFileBufferCache->iRodsPath));
+        if(it_cachemap != shard->cacheMap->end()) {
+            _releaseFileBufferCacheIfUnused(shard, it_cachemap);
+        }
+
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Drop cached blocks of a file and remember its new size and mtime
+ * blocks on disk are used only when they are known
+ * must be called with the shard write-locked
+ */
+static void _invalidateFileBufferCache(iFuseBufferCacheShard_t *shard, iFuseFileBufferCache_t *iFuseFileBufferCache, off_t fileSize, time_t mtime, ino_t dataId) {
+    assert(shard != NULL);
+    assert(iFuseFileBufferCache != NULL);
+
+    _clearFileBufferCache(shard, iFuseFileBufferCache);
+
+    iFuseFileBufferCache->fileSize = fileSize;
+    iFuseFileBufferCache->mtime = mtime;
+    iFuseFileBufferCache->dataId = dataId;
+    iFuseFileBufferCache->persistent = (fileSize >= 0);
+    iFuseFileBufferCache->version = ++shard->version;
+}
+
+/*
+ * Make sure cached blocks of a file are still valid at open time
+ * blocks are dropped if size or mtime of the file has been changed
+ */
+static int _openFileBufferCache(const char *iRodsPath, const struct stat *stbuf, bool truncate) {
+    int status = 0;
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    std::string pathkey(iRodsPath);
+    off_t fileSize = -1;
+    time_t mtime = 0;
+    ino_t dataId = 0;
+
+    assert(iRodsPath != NULL);
+
+    if(stbuf != NULL && !truncate) {
+        fileSize = stbuf->st_size;
+        mtime = stbuf->st_mtime;
+        dataId = stbuf->st_ino;
+    }
+
+    shard = _getCacheShard(iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        iFuseFileBufferCache = it_cachemap->second;
+
+        if(iFuseFileBufferCache->fileSize != fileSize || iFuseFileBufferCache->mtime != mtime ||
+            iFuseFileBufferCache->dataId != dataId || fileSize < 0) {
+            iFuseLibLog(LOG_DEBUG, "_openFileBufferCache: invalidate cache of %s - size: %lld => %lld, mtime: %lld => %lld", iRodsPath,
+                    (long long)iFuseFileBufferCache->fileSize, (long long)fileSize, (long long)iFuseFileBufferCache->mtime, (long long)mtime);
+            _invalidateFileBufferCache(shard, iFuseFileBufferCache, fileSize, mtime, dataId);
+        }
+    } else {
+        status = _newFileBufferCache(&iFuseFileBufferCache);
+        if(status < 0) {
+            pthread_rwlock_unlock(&shard->lock);
+            return status;
+        }
+
+        iFuseFileBufferCache->iRodsPath = strdup(iRodsPath);
+        iFuseFileBufferCache->fileSize = fileSize;
+        iFuseFileBufferCache->mtime = mtime;
+        iFuseFileBufferCache->dataId = dataId;
+        iFuseFileBufferCache->persistent = (fileSize >= 0);
+        iFuseFileBufferCache->version = shard->version;
+
+        (*shard->cacheMap)[pathkey] = iFuseFileBufferCache;
+    }
+
+    iFuseFileBufferCache->openCount++;
+
+    pthread_rwlock_unlock(&shard->lock);
+    return 0;
+}
+
+static void _closeFileBufferCache(const char *iRodsPath) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    std::string pathkey(iRodsPath);
+
+    assert(iRodsPath != NULL);
+
+    shard = _getCacheShard(iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        if(it_cachemap->second->openCount > 0) {
+            it_cachemap->second->openCount--;
+        }
+
+        _releaseFileBufferCacheIfUnused(shard, it_cachemap);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+static unsigned long _getCacheVersion(iFuseBufferCacheShard_t *shard) {
+    unsigned long version = 0;
+
+    assert(shard != NULL);
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    version = shard->version;
+
+    pthread_rwlock_unlock(&shard->lock);
+    return version;
+}
+
+/*
+ * Make a disk cache key of a file from size and mtime known at open
+ * returns false if the file content may differ from what iRODS reported
+ */
+static bool _getDiskCacheKey(iFuseBufferCacheShard_t *shard, const char *iRodsPath, iFuseDiskCacheKey_t *key) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    std::string pathkey(iRodsPath);
+    bool hasKey = false;
+
+    assert(shard != NULL);
+    assert(key != NULL);
+
+    if(!iFuseDiskCacheEnabled()) {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        iFuseFileBufferCache = it_cachemap->second;
+
+        if(iFuseFileBufferCache->persistent) {
+            key->iRodsPath = iRodsPath;
+            key->dataId = iFuseFileBufferCache->dataId;
+            key->mtime = iFuseFileBufferCache->mtime;
+            key->fileSize = iFuseFileBufferCache->fileSize;
+            key->blockSize = g_Blocksize;
+            hasKey = true;
+        }
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+    return hasKey;
+}
+
+/*
+ * Get size of a file on the server if local content is known to match it
+ * returns -1 if unknown
+ */
+static off_t _getServerFileSize(iFuseBufferCacheShard_t *shard, const char *iRodsPath) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::string pathkey(iRodsPath);
+    off_t fileSize = -1;
+
+    assert(shard != NULL);
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end() && it_cachemap->second->persistent) {
+        fileSize = it_cachemap->second->fileSize;
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+    return fileSize;
+}
+
+/*
+ * Copy a part of block data, returns copied size
+ */
+static size_t _copyBlockData(char *buf, const char *blockBuf, size_t blockSize, off_t inBlockOffset, size_t size) {
+    size_t copySize = 0;
+
+    if(buf == NULL || (size_t)inBlockOffset >= blockSize) {
+        return 0;
+    }
+
+    copySize = blockSize - inBlockOffset > size ? size : blockSize - inBlockOffset;
+    memcpy(buf, blockBuf + inBlockOffset, copySize);
+    return copySize;
+}
+
+/*
+ * Copy a part of a cached block to buf while the block is locked
+ * readSize is set to the size of whole block
+ * returns true if the block is cached
+ */
+static bool _getCachedBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size, size_t *readSize) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::map<unsigned int, iFuseBufferCache_t*>::iterator it_blockmap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    bool hasCache = false;
+    std::string pathkey(iFuseFd->iRodsPath);
+
+    assert(iFuseFd != NULL);
+    assert(readSize != NULL);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        iFuseFileBufferCache = it_cachemap->second;
+
+        pthread_rwlock_wrlock(&iFuseFileBufferCache->lock);
+
+        it_blockmap = iFuseFileBufferCache->blocks->find(blockID);
+        if(it_blockmap != iFuseFileBufferCache->blocks->end()) {
+            // has it
+            iFuseBufferCache = it_blockmap->second;
+
+            if(iFuseBufferCache->buffer != NULL) {
+                _copyBlockData(buf, iFuseBufferCache->buffer, iFuseBufferCache->size, inBlockOffset, size);
+
+                _touchLRU(shard, iFuseBufferCache);
+
+                *readSize = iFuseBufferCache->size;
+                hasCache = true;
+            }
+        }
+
+        pthread_rwlock_unlock(&iFuseFileBufferCache->lock);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(hasCache) {
+        _updateCacheStat(shard, 1, 0, 0, 0, 0);
+    } else {
+        _updateCacheStat(shard, 0, 1, 0, 0, 0);
+    }
+
+    return hasCache;
+}
+
+/*
+ * Put a block to the shared buffer cache
+ * ownership of the block is transferred to the cache
+ * the block is dropped if the file has been modified since the given version
+ */
+static int _putCachedBlock(iFuseFd_t *iFuseFd, unsigned int blockID, iFuseBufferCache_t *iFuseBufferCache, unsigned long version) {
+    int status = 0;
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::map<unsigned int, iFuseBufferCache_t*>::iterator it_blockmap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    iFuseBufferCache_t *oldIFuseBufferCache = NULL;
+    std::string pathkey(iFuseFd->iRodsPath);
+
+    assert(iFuseFd != NULL);
+    assert(iFuseBufferCache != NULL);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        iFuseFileBufferCache = it_cachemap->second;
+
+        if(iFuseFileBufferCache->version > version) {
+            // modified while reading
+            pthread_rwlock_unlock(&shard->lock);
+            _freeBufferCache(iFuseBufferCache);
+            return 0;
+        }
+    } else {
+        if(shard->version != version) {
+            // may be modified while reading
+            pthread_rwlock_unlock(&shard->lock);
+            _freeBufferCache(iFuseBufferCache);
+            return 0;
+        }
+
+        status = _newFileBufferCache(&iFuseFileBufferCache);
+        if(status < 0) {
+            pthread_rwlock_unlock(&shard->lock);
+            _freeBufferCache(iFuseBufferCache);
+            return status;
+        }
+
+        // size and mtime are unknown, will be invalidated at next open
+        iFuseFileBufferCache->iRodsPath = strdup(iFuseFd->iRodsPath);
+        iFuseFileBufferCache->version = shard->version;
+
+        (*shard->cacheMap)[pathkey] = iFuseFileBufferCache;
+    }
+
+    it_blockmap = iFuseFileBufferCache->blocks->find(blockID);
+    if(it_blockmap != iFuseFileBufferCache->blocks->end()) {
+        // replace
+        oldIFuseBufferCache = it_blockmap->second;
+        iFuseFileBufferCache->blocks->erase(it_blockmap);
+
+        iFuseFileBufferCache->cachedSize -= oldIFuseBufferCache->size;
+        _updateCacheStat(shard, 0, 0, 0, -1, -(long long)oldIFuseBufferCache->size);
+
+        _unlinkLRU(shard, oldIFuseBufferCache);
+        _freeBufferCache(oldIFuseBufferCache);
+    }
+
+    iFuseBufferCache->fileCache = iFuseFileBufferCache;
+    _touchLRU(shard, iFuseBufferCache);
+
+    (*iFuseFileBufferCache->blocks)[blockID] = iFuseBufferCache;
+    iFuseFileBufferCache->cachedSize += iFuseBufferCache->size;
+
+    _updateCacheStat(shard, 0, 0, 0, 1, iFuseBufferCache->size);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    // make a room
+    _evictBufferCache();
+    return 0;
+}
+
+size_t getBufferCacheBlockSize() {
+    return g_Blocksize;
+}
+
+unsigned int getBlockID(off_t off) {
+    assert(off >= 0);
+
+    return off / g_Blocksize;
+}
+
+off_t getBlockStartOffset(unsigned int blockID) {
+    off_t blockStartOffset = 0;
+
+    blockStartOffset = (off_t)blockID * g_Blocksize;
+
+    assert(blockStartOffset >= 0);
+
+    return blockStartOffset;
+}
+
+off_t getInBlockOffset(off_t off) {
+    off_t inBlockOffset = 0;
+
+    assert(off >= 0);
+
+    inBlockOffset = off - getBlockStartOffset(getBlockID(off));
+
+    assert(inBlockOffset >= 0);
+
+    return inBlockOffset;
+}
+
+static bool _isSameBlock(off_t off1, off_t off2) {
+    return getBlockID(off1) == getBlockID(off2);
+}
+
+/*
+ * Apply dirty ranges of a delta to cached blocks of the same file
+ * the file cache is looked up once and locked once for all ranges
+ * must be called with the shard write-locked
+ */
+static void _applyDeltaToCache(iFuseBufferCacheShard_t *shard, iFuseFileDelta_t *iFuseFileDelta) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::map<unsigned int, iFuseBufferCache_t*>::iterator it_blockmap;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    iFuseBufferCache_t *iFuseDeltaRange = NULL;
+    std::string pathkey(iFuseFileDelta->iRodsPath);
+
+    assert(shard != NULL);
+    assert(iFuseFileDelta != NULL);
+
+    // blocks being read now may not have this change
+    shard->version++;
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap == shard->cacheMap->end()) {
+        return;
+    }
+
+    iFuseFileBufferCache = it_cachemap->second;
+
+    pthread_rwlock_wrlock(&iFuseFileBufferCache->lock);
+
+    iFuseFileBufferCache->version = shard->version;
+    // content no longer matches size and mtime known at open
+    iFuseFileBufferCache->persistent = false;
+
+    for(it_rangemap = iFuseFileDelta->ranges->begin(); it_rangemap != iFuseFileDelta->ranges->end(); it_rangemap++) {
+        iFuseDeltaRange = it_rangemap->second;
+
+        it_blockmap = iFuseFileBufferCache->blocks->find(getBlockID(iFuseDeltaRange->offset));
+        if(it_blockmap != iFuseFileBufferCache->blocks->end()) {
+            iFuseBufferCache = it_blockmap->second;
+
+            // update
+            off_t endOffset = iFuseDeltaRange->offset + iFuseDeltaRange->size > iFuseBufferCache->offset + iFuseBufferCache->size ? iFuseDeltaRange->offset + iFuseDeltaRange->size : iFuseBufferCache->offset + iFuseBufferCache->size;
+            size_t newSize = endOffset - iFuseBufferCache->offset;
+
+            assert(newSize > 0);
+
+            if(iFuseDeltaRange->offset > (off_t)(iFuseBufferCache->offset + iFuseBufferCache->size)) {
+                // hole - block buffers are not zero-filled
+                bzero(iFuseBufferCache->buffer + iFuseBufferCache->size, iFuseDeltaRange->offset - iFuseBufferCache->offset - iFuseBufferCache->size);
+            }
+
+            memcpy(iFuseBufferCache->buffer + (iFuseDeltaRange->offset - iFuseBufferCache->offset), iFuseDeltaRange->buffer, iFuseDeltaRange->size);
+
+            iFuseFileBufferCache->cachedSize += newSize - iFuseBufferCache->size;
+            _updateCacheStat(shard, 0, 0, 0, 0, (long long)newSize - (long long)iFuseBufferCache->size);
+
+            iFuseBufferCache->size = newSize;
+        }
+    }
+
+    pthread_rwlock_unlock(&iFuseFileBufferCache->lock);
+}
+
+static void _updateDirtySize(long long bytes) {
+    pthread_rwlock_wrlock(&g_DirtySizeLock);
+
+    g_DirtySize += bytes;
+
+    pthread_rwlock_unlock(&g_DirtySizeLock);
+}
+
+static size_t _getDirtySize() {
+    size_t dirtySize = 0;
+
+    pthread_rwlock_rdlock(&g_DirtySizeLock);
+
+    dirtySize = g_DirtySize;
+
+    pthread_rwlock_unlock(&g_DirtySizeLock);
+    return dirtySize;
+}
+
+static int _newFileDelta(iFuseFileDelta_t **iFuseFileDelta) {
+    iFuseFileDelta_t *tmpIFuseFileDelta = NULL;
+
+    assert(iFuseFileDelta != NULL);
+
+    tmpIFuseFileDelta = (iFuseFileDelta_t *) calloc(1, sizeof ( iFuseFileDelta_t));
+    if (tmpIFuseFileDelta == NULL) {
+        *iFuseFileDelta = NULL;
+        return SYS_MALLOC_ERR;
+    }
+
+    // we must use new keyword instead of calloc since it contains c++ stl map object
+    tmpIFuseFileDelta->ranges = new std::map<off_t, iFuseBufferCache_t*>();
+    if(tmpIFuseFileDelta->ranges == NULL) {
+        *iFuseFileDelta = NULL;
+        free(tmpIFuseFileDelta);
+        return SYS_MALLOC_ERR;
+    }
+
+    tmpIFuseFileDelta->writers = new std::set<unsigned long>();
+    if(tmpIFuseFileDelta->writers == NULL) {
+        *iFuseFileDelta = NULL;
+        delete tmpIFuseFileDelta->ranges;
+        free(tmpIFuseFileDelta);
+        return SYS_MALLOC_ERR;
+    }
+
+    *iFuseFileDelta = tmpIFuseFileDelta;
+    return 0;
+}
+
+static int _freeFileDelta(iFuseFileDelta_t *iFuseFileDelta) {
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+
+    assert(iFuseFileDelta != NULL);
+
+    if(iFuseFileDelta->ranges != NULL) {
+        while(!iFuseFileDelta->ranges->empty()) {
+            it_rangemap = iFuseFileDelta->ranges->begin();
+
+            _freeBufferCache(it_rangemap->second);
+            iFuseFileDelta->ranges->erase(it_rangemap);
+        }
+
+        delete iFuseFileDelta->ranges;
+        iFuseFileDelta->ranges = NULL;
+    }
+
+    if(iFuseFileDelta->writers != NULL) {
+        delete iFuseFileDelta->writers;
+        iFuseFileDelta->writers = NULL;
+    }
+
+    _updateDirtySize(-(long long)iFuseFileDelta->dirtySize);
+    iFuseFileDelta->dirtySize = 0;
+
+    if(iFuseFileDelta->iRodsPath != NULL) {
+        free(iFuseFileDelta->iRodsPath);
+        iFuseFileDelta->iRodsPath = NULL;
+    }
+
+    free(iFuseFileDelta);
+    return 0;
+}
+
+/*
+ * Add a dirty range to a file delta
+ * ranges overlapping or adjacent in the same block are merged
+ * must be called with the shard write-locked
+ */
+static int _addDeltaRange(iFuseFileDelta_t *iFuseFileDelta, iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
+    int status = 0;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_first;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_last;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    off_t blockStartOffset = getBlockStartOffset(getBlockID(off));
+    off_t startOffset = off;
+    off_t endOffset = off + size;
+    size_t oldSize = 0;
+    char *newBuf = NULL;
+
+    assert(iFuseFileDelta != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+    assert(_isSameBlock(off, off + size - 1));
+
+    // find ranges to be merged - they are sorted and disjoint
+    it_first = iFuseFileDelta->ranges->end();
+    it_last = iFuseFileDelta->ranges->end();
+    for(it_rangemap = iFuseFileDelta->ranges->lower_bound(blockStartOffset); it_rangemap != iFuseFileDelta->ranges->end(); it_rangemap++) {
+        iFuseBufferCache = it_rangemap->second;
+
+        if(iFuseBufferCache->offset > (off_t)(off + size) || !_isSameBlock(iFuseBufferCache->offset, off)) {
+            break;
+        }
+
+        if((off_t)(iFuseBufferCache->offset + iFuseBufferCache->size) >= off) {
+            // intersect
+            if(it_first == iFuseFileDelta->ranges->end()) {
+                it_first = it_rangemap;
+            }
+            it_last = it_rangemap;
+
+            if(iFuseBufferCache->offset < startOffset) {
+                startOffset = iFuseBufferCache->offset;
+            }
+
+            if((off_t)(iFuseBufferCache->offset + iFuseBufferCache->size) > endOffset) {
+                endOffset = iFuseBufferCache->offset + iFuseBufferCache->size;
+            }
+
+            oldSize += iFuseBufferCache->size;
+        }
+    }
+
+    if(it_first != iFuseFileDelta->ranges->end() && it_first == it_last &&
+        it_first->second->offset == startOffset && it_first->second->size == (size_t)(endOffset - startOffset)) {
+        // overwrite in place
+        iFuseBufferCache = it_first->second;
+        memcpy(iFuseBufferCache->buffer + (off - startOffset), buf, size);
+        return 0;
+    }
+
+    newBuf = (char*)calloc(1, endOffset - startOffset);
+    if(newBuf == NULL) {
+        return SYS_MALLOC_ERR;
+    }
+
+    if(it_first != iFuseFileDelta->ranges->end()) {
+        it_last++;
+        it_rangemap = it_first;
+        while(it_rangemap != it_last) {
+            iFuseBufferCache = it_rangemap->second;
+
+            memcpy(newBuf + (iFuseBufferCache->offset - startOffset), iFuseBufferCache->buffer, iFuseBufferCache->size);
+
+            _freeBufferCache(iFuseBufferCache);
+            iFuseFileDelta->ranges->erase(it_rangemap++);
+        }
+    }
+
+    memcpy(newBuf + (off - startOffset), buf, size);
+
+    status = _newBufferCache(&iFuseBufferCache);
+    if(status < 0) {
+        free(newBuf);
+        return status;
+    }
+
+    iFuseBufferCache->fdId = iFuseFd->fdId;
+    iFuseBufferCache->buffer = newBuf;
+    iFuseBufferCache->offset = startOffset;
+    iFuseBufferCache->size = endOffset - startOffset;
+
+    (*iFuseFileDelta->ranges)[startOffset] = iFuseBufferCache;
+
+    iFuseFileDelta->dirtySize += iFuseBufferCache->size - oldSize;
+    _updateDirtySize((long long)iFuseBufferCache->size - (long long)oldSize);
+    return 0;
+}
+
+/*
+ * Write dirty ranges to iRODS in offset order
+ * contiguous ranges are merged into a request up to IFUSE_BUFFER_CACHE_FLUSH_BATCH_SIZE
+ */
+static int _writeFileDelta(iFuseFd_t *iFuseFd, iFuseFileDelta_t *iFuseFileDelta) {
+    int status = 0;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_batchstart;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_batchend;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+
+    assert(iFuseFd != NULL);
+    assert(iFuseFileDelta != NULL);
+
+    it_rangemap = iFuseFileDelta->ranges->begin();
+    while(it_rangemap != iFuseFileDelta->ranges->end()) {
+        off_t batchOffset = it_rangemap->second->offset;
+        size_t batchSize = 0;
+        int batchCount = 0;
+
+        // collect contiguous ranges
+        it_batchstart = it_rangemap;
+        it_batchend = it_rangemap;
+        while(it_batchend != iFuseFileDelta->ranges->end()) {
+            iFuseBufferCache = it_batchend->second;
+
+            if(iFuseBufferCache->offset != (off_t)(batchOffset + batchSize)) {
+                break;
+            }
+
+            if(batchCount > 0 && batchSize + iFuseBufferCache->size > IFUSE_BUFFER_CACHE_FLUSH_BATCH_SIZE) {
+                break;
+            }
+
+            batchSize += iFuseBufferCache->size;
+            batchCount++;
+            it_batchend++;
+        }
+
+        iFuseLibLog(LOG_DEBUG, "_writeFileDelta: write %d ranges of %s - offset: %lld, size: %lld", batchCount, iFuseFd->iRodsPath, (long long)batchOffset, (long long)batchSize);
+
+        if(batchCount == 1) {
+            status = iFuseFsWrite(iFuseFd, it_batchstart->second->buffer, batchOffset, batchSize);
+        } else {
+            char *batchBuf = (char*)calloc(1, batchSize);
+            if(batchBuf == NULL) {
+                return SYS_MALLOC_ERR;
+            }
+
+            for(it_rangemap = it_batchstart; it_rangemap != it_batchend; it_rangemap++) {
+                iFuseBufferCache = it_rangemap->second;
+                memcpy(batchBuf + (iFuseBufferCache->offset - batchOffset), iFuseBufferCache->buffer, iFuseBufferCache->size);
+            }
+
+            status = iFuseFsWrite(iFuseFd, batchBuf, batchOffset, batchSize);
+
+            free(batchBuf);
+        }
+
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_writeFileDelta: iFuseFsWrite of %s error, status = %d",
+                    iFuseFd->iRodsPath, status);
+            return status;
+        }
+
+        it_rangemap = it_batchend;
+    }
+
+    return 0;
+}
+
+/*
+ * Detach a delta of a file to be written
+ * the delta is kept in flushingMap until _completeDelta is called
+ * must be called with the shard write-locked
+ */
+static iFuseFileDelta_t *_detachDeltaLocked(iFuseBufferCacheShard_t *shard, const char *iRodsPath) {
+    std::map<std::string, iFuseFileDelta_t*>::iterator it_deltamap;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+    std::string pathkey(iRodsPath);
+
+    it_deltamap = shard->deltaMap->find(pathkey);
+    if(it_deltamap != shard->deltaMap->end()) {
+        iFuseFileDelta = it_deltamap->second;
+
+        shard->deltaMap->erase(it_deltamap);
+        shard->flushingMap->insert(std::pair<std::string, iFuseFileDelta_t*>(pathkey, iFuseFileDelta));
+    }
+
+    return iFuseFileDelta;
+}
+
+static iFuseFileDelta_t *_detachDelta(iFuseFd_t *iFuseFd) {
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    iFuseFileDelta = _detachDeltaLocked(shard, iFuseFd->iRodsPath);
+
+    pthread_rwlock_unlock(&shard->lock);
+    return iFuseFileDelta;
+}
+
+/*
+ * Drop cached blocks covered by a delta failed to be written,
+ * they are read from iRODS again
+ * must be called with the shard write-locked
+ */
+static void _dropDeltaBlocks(iFuseBufferCacheShard_t *shard, iFuseFileDelta_t *iFuseFileDelta) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::map<unsigned int, iFuseBufferCache_t*>::iterator it_blockmap;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    std::string pathkey(iFuseFileDelta->iRodsPath);
+
+    assert(shard != NULL);
+    assert(iFuseFileDelta != NULL);
+
+    // blocks being read now may have been merged with the delta
+    shard->version++;
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap == shard->cacheMap->end()) {
+        return;
+    }
+
+    iFuseFileBufferCache = it_cachemap->second;
+
+    pthread_rwlock_wrlock(&iFuseFileBufferCache->lock);
+
+    iFuseFileBufferCache->version = shard->version;
+    iFuseFileBufferCache->persistent = false;
+
+    for(it_rangemap = iFuseFileDelta->ranges->begin(); it_rangemap != iFuseFileDelta->ranges->end(); it_rangemap++) {
+        it_blockmap = iFuseFileBufferCache->blocks->find(getBlockID(it_rangemap->second->offset));
+        if(it_blockmap != iFuseFileBufferCache->blocks->end()) {
+            iFuseBufferCache = it_blockmap->second;
+            iFuseFileBufferCache->blocks->erase(it_blockmap);
+
+            iFuseLibLog(LOG_DEBUG, "_dropDeltaBlocks: drop a block of %s - offset: %lld", iFuseFileDelta->iRodsPath, (long long)iFuseBufferCache->offset);
+
+            assert(iFuseFileBufferCache->cachedSize >= iFuseBufferCache->size);
+            iFuseFileBufferCache->cachedSize -= iFuseBufferCache->size;
+            _updateCacheStat(shard, 0, 0, 0, -1, -(long long)iFuseBufferCache->size);
+
+            _unlinkLRU(shard, iFuseBufferCache);
+            _freeBufferCache(iFuseBufferCache);
+        }
+    }
+
+    pthread_rwlock_unlock(&iFuseFileBufferCache->lock);
+
+    _releaseFileBufferCacheIfUnused(shard, it_cachemap);
+}
+
+/*
+ * Apply a written delta to caches and release it
+ * written = false drops cached blocks the delta covers instead
+ */
+static void _completeDelta(iFuseFileDelta_t *iFuseFileDelta, bool written) {
+    std::multimap<std::string, iFuseFileDelta_t*>::iterator it_flushingmap;
+    std::pair<std::multimap<std::string, iFuseFileDelta_t*>::iterator, std::multimap<std::string, iFuseFileDelta_t*>::iterator> range;
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseDiskCacheKey_t diskCacheKey;
+    bool hasDiskCacheKey = false;
+    std::string pathkey(iFuseFileDelta->iRodsPath);
+
+    shard = _getCacheShard(iFuseFileDelta->iRodsPath);
+
+    // blocks on disk with the key known at open become stale
+    hasDiskCacheKey = _getDiskCacheKey(shard, iFuseFileDelta->iRodsPath, &diskCacheKey);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    if(written) {
+        // apply to caches
+        _applyDeltaToCache(shard, iFuseFileDelta);
+    } else {
+        // partly written or not at all
+        _dropDeltaBlocks(shard, iFuseFileDelta);
+    }
+
+    range = shard->flushingMap->equal_range(pathkey);
+    for(it_flushingmap = range.first; it_flushingmap != range.second; it_flushingmap++) {
+        if(it_flushingmap->second == iFuseFileDelta) {
+            shard->flushingMap->erase(it_flushingmap);
+            break;
+        }
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(hasDiskCacheKey) {
+        unsigned int lastBlockID = 0;
+
+        for(it_rangemap = iFuseFileDelta->ranges->begin(); it_rangemap != iFuseFileDelta->ranges->end(); it_rangemap++) {
+            unsigned int blockID = getBlockID(it_rangemap->second->offset);
+
+            if(it_rangemap == iFuseFileDelta->ranges->begin() || blockID != lastBlockID) {
+                iFuseDiskCacheRemove(&diskCacheKey, blockID);
+                lastBlockID = blockID;
+            }
+        }
+    }
+
+    _freeFileDelta(iFuseFileDelta);
+}
+
+/*
+ * Record a write error for file descriptors written into a delta
+ * g_FlushLock must be held
+ */
+static int _setFlushError(iFuseFileDelta_t *iFuseFileDelta, int error) {
+    std::set<unsigned long>::iterator it_writer;
+    std::map<unsigned long, iFuseFdFlushState_t*>::iterator it_statemap;
+    iFuseFdFlushState_t *iFuseFdFlushState = NULL;
+
+    for(it_writer = iFuseFileDelta->writers->begin(); it_writer != iFuseFileDelta->writers->end(); it_writer++) {
+        it_statemap = g_FlushStateMap.find(*it_writer);
+        if(it_statemap != g_FlushStateMap.end()) {
+            iFuseFdFlushState = it_statemap->second;
+        } else {
+            iFuseFdFlushState = (iFuseFdFlushState_t *) calloc(1, sizeof ( iFuseFdFlushState_t));
+            if (iFuseFdFlushState == NULL) {
+                return SYS_MALLOC_ERR;
+            }
+
+            iFuseFdFlushState->fdId = *it_writer;
+            g_FlushStateMap[*it_writer] = iFuseFdFlushState;
+        }
+
+        if(iFuseFdFlushState->error == 0) {
+            iFuseFdFlushState->error = error;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Release flush state of a path if no job or waiter refers to it
+ * g_FlushLock must be held
+ */
+static void _releasePathFlushStateIfIdle(iFusePathFlushState_t *iFusePathFlushState) {
+    if(iFusePathFlushState->done == iFusePathFlushState->queued && iFusePathFlushState->waiters == 0 && !iFusePathFlushState->busy) {
+        g_PathFlushStateMap.erase(std::string(iFusePathFlushState->iRodsPath));
+
+        free(iFusePathFlushState->iRodsPath);
+        free(iFusePathFlushState);
+    }
+}
+
+static void *_flushThread(void *param) {
+    std::list<iFuseFlushJob_t*>::iterator it_joblist;
+    iFuseFlushJob_t *iFuseFlushJob = NULL;
+    iFusePathFlushState_t *iFusePathFlushState = NULL;
+    int status = 0;
+
+    UNUSED(param);
+
+    iFuseIOSchedSetPriority(IFUSE_IO_PRIORITY_BACKGROUND);
+
+    pthread_mutex_lock(&g_FlushLock);
+
+    while(true) {
+        // pick the oldest job of a path not being written by others
+        iFuseFlushJob = NULL;
+        for(it_joblist = g_FlushJobs.begin(); it_joblist != g_FlushJobs.end(); it_joblist++) {
+            if(!(*it_joblist)->pathState->busy) {
+                iFuseFlushJob = *it_joblist;
+                g_FlushJobs.erase(it_joblist);
+                break;
+            }
+        }
+
+        if(iFuseFlushJob == NULL) {
+            if(!g_FlushRunning && g_FlushJobs.empty()) {
+                break;
+            }
+
+            pthread_cond_wait(&g_FlushJobCond, &g_FlushLock);
+            continue;
+        }
+
+        iFusePathFlushState = iFuseFlushJob->pathState;
+        iFusePathFlushState->busy = true;
+
+        // someone waits for the job - do not defer it behind demand requests
+        if(iFusePathFlushState->waiters > 0) {
+            iFuseIOSchedSetPriority(IFUSE_IO_PRIORITY_FOREGROUND);
+        } else {
+            iFuseIOSchedSetPriority(IFUSE_IO_PRIORITY_BACKGROUND);
+        }
+
+        pthread_mutex_unlock(&g_FlushLock);
+
+        status = _writeFileDelta(iFuseFlushJob->iFuseFd, iFuseFlushJob->iFuseFileDelta);
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_flushThread: _writeFileDelta of %s error, status = %d",
+                    iFuseFlushJob->iFuseFd->iRodsPath, status);
+
+            pthread_mutex_lock(&g_FlushLock);
+            _setFlushError(iFuseFlushJob->iFuseFileDelta, status);
+            pthread_mutex_unlock(&g_FlushLock);
+        }
+
+        _completeDelta(iFuseFlushJob->iFuseFileDelta, status >= 0);
+
+        pthread_mutex_lock(&g_FlushLock);
+
+        iFusePathFlushState->busy = false;
+        iFusePathFlushState->done++;
+
+        free(iFuseFlushJob);
+
+        pthread_cond_broadcast(&g_FlushDoneCond);
+        // jobs of the path may be waiting
+        pthread_cond_broadcast(&g_FlushJobCond);
+
+        _releasePathFlushStateIfIdle(iFusePathFlushState);
+    }
+
+    pthread_mutex_unlock(&g_FlushLock);
+    return NULL;
+}
+
+/*
+ * Detach a delta of a file and queue it to flusher threads at once, so
+ * that jobs of a path are queued in detach order and waiters see them
+ * returns 0 if there is nothing to write
+ */
+static int _queueFlushJob(iFuseFd_t *iFuseFd) {
+    std::map<std::string, iFusePathFlushState_t*>::iterator it_pathstatemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+    iFuseFlushJob_t *iFuseFlushJob = NULL;
+    iFusePathFlushState_t *iFusePathFlushState = NULL;
+    iFusePathFlushState_t *newIFusePathFlushState = NULL;
+    std::string pathkey(iFuseFd->iRodsPath);
+
+    // allocate before locking, no failure after detaching
+    iFuseFlushJob = (iFuseFlushJob_t *) calloc(1, sizeof ( iFuseFlushJob_t));
+    newIFusePathFlushState = (iFusePathFlushState_t *) calloc(1, sizeof ( iFusePathFlushState_t));
+    if (iFuseFlushJob == NULL || newIFusePathFlushState == NULL) {
+        free(iFuseFlushJob);
+        free(newIFusePathFlushState);
+        return SYS_MALLOC_ERR;
+    }
+
+    newIFusePathFlushState->iRodsPath = strdup(iFuseFd->iRodsPath);
+    if (newIFusePathFlushState->iRodsPath == NULL) {
+        free(iFuseFlushJob);
+        free(newIFusePathFlushState);
+        return SYS_MALLOC_ERR;
+    }
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    iFuseFileDelta = _detachDeltaLocked(shard, iFuseFd->iRodsPath);
+    if(iFuseFileDelta != NULL) {
+        pthread_mutex_lock(&g_FlushLock);
+
+        it_pathstatemap = g_PathFlushStateMap.find(pathkey);
+        if(it_pathstatemap != g_PathFlushStateMap.end()) {
+            iFusePathFlushState = it_pathstatemap->second;
+        } else {
+            iFusePathFlushState = newIFusePathFlushState;
+            newIFusePathFlushState = NULL;
+            g_PathFlushStateMap[pathkey] = iFusePathFlushState;
+        }
+
+        iFuseFlushJob->iFuseFd = iFuseFd;
+        iFuseFlushJob->iFuseFileDelta = iFuseFileDelta;
+        iFuseFlushJob->pathState = iFusePathFlushState;
+
+        iFusePathFlushState->queued++;
+        g_FlushJobs.push_back(iFuseFlushJob);
+        iFuseFlushJob = NULL;
+
+        pthread_cond_signal(&g_FlushJobCond);
+
+        pthread_mutex_unlock(&g_FlushLock);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    free(iFuseFlushJob);
+    if(newIFusePathFlushState != NULL) {
+        free(newIFusePathFlushState->iRodsPath);
+        free(newIFusePathFlushState);
+    }
+    return 0;
+}
+
+/*
+ * Wait for jobs of the path of a file descriptor queued so far,
+ * they hold all data written through the file descriptor
+ * returns and clears the first error occurred since last wait
+ * release = true also releases flush state of the file descriptor
+ */
+static int _waitFlushJobs(iFuseFd_t *iFuseFd, bool release) {
+    std::map<std::string, iFusePathFlushState_t*>::iterator it_pathstatemap;
+    std::map<unsigned long, iFuseFdFlushState_t*>::iterator it_statemap;
+    iFusePathFlushState_t *iFusePathFlushState = NULL;
+    std::string pathkey(iFuseFd->iRodsPath);
+    unsigned long target = 0;
+    int status = 0;
+
+    pthread_mutex_lock(&g_FlushLock);
+
+    it_pathstatemap = g_PathFlushStateMap.find(pathkey);
+    if(it_pathstatemap != g_PathFlushStateMap.end()) {
+        iFusePathFlushState = it_pathstatemap->second;
+
+        // jobs of a path complete in queued order
+        target = iFusePathFlushState->queued;
+
+        iFusePathFlushState->waiters++;
+        while(iFusePathFlushState->done < target) {
+            pthread_cond_wait(&g_FlushDoneCond, &g_FlushLock);
+        }
+        iFusePathFlushState->waiters--;
+
+        _releasePathFlushStateIfIdle(iFusePathFlushState);
+    }
+
+    it_statemap = g_FlushStateMap.find(iFuseFd->fdId);
+    if(it_statemap != g_FlushStateMap.end()) {
+        status = it_statemap->second->error;
+        it_statemap->second->error = 0;
+
+        if(release) {
+            free(it_statemap->second);
+            g_FlushStateMap.erase(it_statemap);
+        }
+    }
+
+    pthread_mutex_unlock(&g_FlushLock);
+    return status;
+}
+
+/*
+ * Write dirty data of a file
+ * the delta is queued to flusher threads if available,
+ * wait = true blocks until all data written through the file descriptor
+ * are written
+ */
+static int _flushDelta(iFuseFd_t *iFuseFd, bool wait) {
+    int status = 0;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+    bool queued = false;
+
+    assert(iFuseFd != NULL);
+
+    if((iFuseFd->openFlag & O_ACCMODE) == O_RDONLY) {
+        return 0;
+    }
+
+    if(g_FlushThreadNum > 0) {
+        status = _queueFlushJob(iFuseFd);
+        if(status == 0) {
+            queued = true;
+        } else {
+            // write on the calling thread after queued ones
+            status = _waitFlushJobs(iFuseFd, false);
+            if (status < 0) {
+                iFuseLibLogError(LOG_ERROR, status, "_flushDelta: background write of %s error, status = %d",
+                        iFuseFd->iRodsPath, status);
+                return -ENOENT;
+            }
+        }
+    }
+
+    if(!queued) {
+        iFuseFileDelta = _detachDelta(iFuseFd);
+        if(iFuseFileDelta != NULL) {
+            status = _writeFileDelta(iFuseFd, iFuseFileDelta);
+            _completeDelta(iFuseFileDelta, status >= 0);
+
+            if (status < 0) {
+                iFuseLibLogError(LOG_ERROR, status, "_flushDelta: _writeFileDelta of %s error, status = %d",
+                        iFuseFd->iRodsPath, status);
+                return -ENOENT;
+            }
+        }
+    }
+
+    if(wait && g_FlushThreadNum > 0) {
+        status = _waitFlushJobs(iFuseFd, false);
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_flushDelta: background write of %s error, status = %d",
+                    iFuseFd->iRodsPath, status);
+            return -ENOENT;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Release flush state of a file descriptor being closed
+ * waits for queued jobs as they may refer to the file descriptor
+ */
+static void _releaseFlushState(iFuseFd_t *iFuseFd) {
+    _waitFlushJobs(iFuseFd, true);
+}
+
+/*
+ * Copy dirty ranges of a delta in a block over the buffer
+ * buf holds a part of the block from inBlockOffset up to size,
+ * holes between block data and dirty ranges are zero-filled
+ */
+static void _overlayDelta(iFuseFileDelta_t *iFuseFileDelta, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size, size_t *readSize) {
+    std::map<off_t, iFuseBufferCache_t*>::iterator it_rangemap;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    off_t blockStartOffset = getBlockStartOffset(blockID);
+    size_t windowStart = inBlockOffset;
+    size_t windowEnd = inBlockOffset + size;
+
+    for(it_rangemap = iFuseFileDelta->ranges->lower_bound(blockStartOffset); it_rangemap != iFuseFileDelta->ranges->end(); it_rangemap++) {
+        size_t deltaStart = 0;
+        size_t deltaEnd = 0;
+        size_t start = 0;
+        size_t end = 0;
+
+        iFuseBufferCache = it_rangemap->second;
+
+        if(getBlockID(iFuseBufferCache->offset) != blockID) {
+            break;
+        }
+
+        assert((iFuseBufferCache->offset - blockStartOffset) >= 0);
+
+        deltaStart = iFuseBufferCache->offset - blockStartOffset;
+        deltaEnd = deltaStart + iFuseBufferCache->size;
+
+        if(buf != NULL) {
+            if(*readSize < deltaStart) {
+                // hole
+                start = *readSize > windowStart ? *readSize : windowStart;
+                end = deltaStart < windowEnd ? deltaStart : windowEnd;
+                if(start < end) {
+                    bzero(buf + (start - windowStart), end - start);
+                }
+            }
+
+            start = deltaStart > windowStart ? deltaStart : windowStart;
+            end = deltaEnd < windowEnd ? deltaEnd : windowEnd;
+            if(start < end) {
+                memcpy(buf + (start - windowStart), iFuseBufferCache->buffer + (start - deltaStart), end - start);
+            }
+        }
+
+        if(*readSize < deltaEnd) {
+            *readSize = deltaEnd;
+        }
+    }
+}
+
+static off_t _getDeltaEndOffset(iFuseFileDelta_t *iFuseFileDelta) {
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+
+    if(iFuseFileDelta->ranges->empty()) {
+        return 0;
+    }
+
+    // the last range decides the size
+    iFuseBufferCache = iFuseFileDelta->ranges->rbegin()->second;
+    return iFuseBufferCache->offset + iFuseBufferCache->size;
+}
+
+/*
+ * Update access pattern of a file descriptor with a read
+ * *random is set if reads are random even with the smallest extent
+ * returns number of blocks to fetch at once
+ */
+static unsigned int _updateReadState(iFuseFd_t *iFuseFd, off_t off, size_t size, bool *random) {
+    std::map<unsigned long, iFuseFdReadState_t*>::iterator it_statemap;
+    iFuseFdReadState_t *iFuseFdReadState = NULL;
+    unsigned int maxExtentBlocks = IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE / g_Blocksize;
+    unsigned int extentBlocks = 1;
+    off_t distance = 0;
+
+    assert(iFuseFd != NULL);
+    assert(random != NULL);
+
+    *random = false;
+
+    if(maxExtentBlocks < 1) {
+        maxExtentBlocks = 1;
+    }
+
+    pthread_mutex_lock(&g_ReadStateLock);
+
+    it_statemap = g_ReadStateMap.find(iFuseFd->fdId);
+    if(it_statemap != g_ReadStateMap.end()) {
+        iFuseFdReadState = it_statemap->second;
+
+        // reads may arrive slightly out of order
+        distance = off - iFuseFdReadState->nextOffset;
+        if(distance < 0) {
+            distance = -distance;
+        }
+
+        if(distance <= (off_t)iFuseFdReadState->extentBlocks * g_Blocksize) {
+            // sequential - grow
+            if(iFuseFdReadState->extentBlocks * 2 <= maxExtentBlocks) {
+                iFuseFdReadState->extentBlocks *= 2;
+            } else {
+                iFuseFdReadState->extentBlocks = maxExtentBlocks;
+            }
+            iFuseFdReadState->random = false;
+        } else if(iFuseFdReadState->extentBlocks > 1) {
+            // random - shrink
+            iFuseFdReadState->extentBlocks /= 2;
+        } else {
+            // random - fetch less than a block
+            iFuseFdReadState->random = true;
+        }
+    } else {
+        iFuseFdReadState = (iFuseFdReadState_t *)calloc(1, sizeof(iFuseFdReadState_t));
+        if(iFuseFdReadState == NULL) {
+            pthread_mutex_unlock(&g_ReadStateLock);
+            return 1;
+        }
+
+        iFuseFdReadState->fdId = iFuseFd->fdId;
+        iFuseFdReadState->extentBlocks = 1;
+        g_ReadStateMap[iFuseFd->fdId] = iFuseFdReadState;
+    }
+
+    iFuseFdReadState->nextOffset = off + size;
+    extentBlocks = iFuseFdReadState->extentBlocks;
+    *random = iFuseFdReadState->random;
+
+    pthread_mutex_unlock(&g_ReadStateLock);
+    return extentBlocks;
+}
+
+/*
+ * Mark a file descriptor whose file is read whole at open
+ */
+static void _setWholeFileReadState(iFuseFd_t *iFuseFd) {
+    iFuseFdReadState_t *iFuseFdReadState = NULL;
+
+    assert(iFuseFd != NULL);
+
+    iFuseFdReadState = (iFuseFdReadState_t *)calloc(1, sizeof(iFuseFdReadState_t));
+    if(iFuseFdReadState == NULL) {
+        return;
+    }
+
+    iFuseFdReadState->fdId = iFuseFd->fdId;
+    iFuseFdReadState->extentBlocks = 1;
+    iFuseFdReadState->wholeFile = true;
+
+    pthread_mutex_lock(&g_ReadStateLock);
+
+    g_ReadStateMap[iFuseFd->fdId] = iFuseFdReadState;
+
+    pthread_mutex_unlock(&g_ReadStateLock);
+}
+
+static void _releaseReadState(iFuseFd_t *iFuseFd) {
+    std::map<unsigned long, iFuseFdReadState_t*>::iterator it_statemap;
+
+    pthread_mutex_lock(&g_ReadStateLock);
+
+    it_statemap = g_ReadStateMap.find(iFuseFd->fdId);
+    if(it_statemap != g_ReadStateMap.end()) {
+        free(it_statemap->second);
+        g_ReadStateMap.erase(it_statemap);
+    }
+
+    pthread_mutex_unlock(&g_ReadStateLock);
+}
+
+/*
+ * Check if a block can be read without a request to the server
+ */
+static bool _hasLocalBlock(const char *iRodsPath, unsigned int blockID, const iFuseDiskCacheKey_t *diskCacheKey) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    bool hasCache = false;
+    std::string pathkey(iRodsPath);
+
+    assert(iRodsPath != NULL);
+
+    shard = _getCacheShard(iRodsPath);
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        iFuseFileBufferCache = it_cachemap->second;
+
+        pthread_rwlock_rdlock(&iFuseFileBufferCache->lock);
+        hasCache = iFuseFileBufferCache->blocks->find(blockID) != iFuseFileBufferCache->blocks->end();
+        pthread_rwlock_unlock(&iFuseFileBufferCache->lock);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(!hasCache && diskCacheKey != NULL) {
+        hasCache = iFuseDiskCacheHas(diskCacheKey, blockID);
+    }
+
+    return hasCache;
+}
+
+/*
+ * Fetch consecutive blocks with a single read request and put them to cache
+ * the part of the fetched data from off up to size is also copied to buf,
+ * buf can be NULL to only fill caches
+ * returns size of data read
+ */
+static int _fetchBlocks(iFuseFd_t *iFuseFd, unsigned int startBlockID, unsigned int blockNum, char *buf, off_t off, size_t size) {
+    int status = 0;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    unsigned long version = 0;
+    iFuseDiskCacheKey_t diskCacheKey;
+    bool hasDiskCacheKey = false;
+    char *fetchBuffer = NULL;
+    bool localFetchBuffer = false;
+    off_t fetchOffset = getBlockStartOffset(startBlockID);
+    size_t fetchSize = (size_t)blockNum * g_Blocksize;
+    size_t readSize = 0;
+    off_t copyStart = 0;
+    off_t copyEnd = 0;
+    unsigned int i;
+
+    assert(iFuseFd != NULL);
+    assert(blockNum > 0);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+    version = _getCacheVersion(shard);
+    hasDiskCacheKey = _getDiskCacheKey(shard, iFuseFd->iRodsPath, &diskCacheKey);
+
+    // reuse the buffer of this thread, larger fetches are rare
+    if(fetchSize <= IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE) {
+        fetchBuffer = _getFetchBuffer();
+        localFetchBuffer = true;
+    } else {
+        fetchBuffer = (char*)malloc(fetchSize);
+    }
+
+    if(fetchBuffer == NULL) {
+        return SYS_MALLOC_ERR;
+    }
+
+    status = iFuseFsRead(iFuseFd, fetchBuffer, fetchOffset, fetchSize);
+    if(status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_fetchBlocks: iFuseFsRead of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+        if(!localFetchBuffer) {
+            free(fetchBuffer);
+        }
+        return status;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "_fetchBlocks: iFuseFsRead of %s - blockID: %u, blocks: %u, size: %lld", iFuseFd->iRodsPath, startBlockID, blockNum, (long long)status);
+
+    _updateFetchStat(shard, 1, status);
+
+    readSize = status;
+
+    // give the caller its part before splitting
+    if(buf != NULL) {
+        copyStart = off > fetchOffset ? off : fetchOffset;
+        copyEnd = off + (off_t)size < fetchOffset + (off_t)readSize ? off + (off_t)size : fetchOffset + (off_t)readSize;
+        if(copyStart < copyEnd) {
+            memcpy(buf + (copyStart - off), fetchBuffer + (copyStart - fetchOffset), copyEnd - copyStart);
+        }
+    }
+
+    // split into cache blocks
+    for(i=0;i<blockNum;i++) {
+        size_t blockOffset = (size_t)i * g_Blocksize;
+        size_t blockSize = 0;
+
+        if(blockOffset >= readSize) {
+            // eof
+            break;
+        }
+
+        blockSize = readSize - blockOffset > (size_t)g_Blocksize ? (size_t)g_Blocksize : readSize - blockOffset;
+
+        status = _newBufferCache(&iFuseBufferCache);
+        if(status < 0) {
+            break;
+        }
+
+        iFuseBufferCache->buffer = iFuseBufferedFsAllocBlockBuffer();
+        if(iFuseBufferCache->buffer == NULL) {
+            _freeBufferCache(iFuseBufferCache);
+            break;
+        }
+
+        memcpy(iFuseBufferCache->buffer, fetchBuffer + blockOffset, blockSize);
+
+        iFuseBufferCache->fdId = iFuseFd->fdId;
+        iFuseBufferCache->pooled = true;
+        iFuseBufferCache->offset = getBlockStartOffset(startBlockID + i);
+        iFuseBufferCache->size = blockSize;
+
+        // nothing in the shard changed while reading
+        if(hasDiskCacheKey && _getCacheVersion(shard) == version) {
+            iFuseDiskCachePut(&diskCacheKey, startBlockID + i, iFuseBufferCache->buffer, blockSize);
+        }
+
+        status = _putCachedBlock(iFuseFd, startBlockID + i, iFuseBufferCache, version);
+        if(status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_fetchBlocks: _putCachedBlock of %s error, status = %d",
+                    iFuseFd->iRodsPath, status);
+            break;
+        }
+    }
+
+    if(!localFetchBuffer) {
+        free(fetchBuffer);
+    }
+    return readSize;
+}
+
+/*
+ * Fetch blocks missing in caches in the given range with as few read
+ * requests as possible. A fetch starting at a missing block covers up to
+ * extentBlocks blocks, possibly beyond the range, as long as they are missing.
+ * Blocks beyond the range are fetched only up to the size of the file on
+ * the server, if known. A single missing block is left to _readBlock.
+ *
+ * The first fetch also fills its part of buf, which holds the range, and
+ * *fetchedOffset and *fetchedSize tell the data it read, so that the caller
+ * does not read the blocks back from cache. *fetchedSize is 0 if none.
+ */
+static void _fetchMissingBlocks(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size, unsigned int extentBlocks, off_t *fetchedOffset, size_t *fetchedSize) {
+    int status = 0;
+    iFuseDiskCacheKey_t diskCacheKey;
+    bool hasDiskCacheKey = false;
+    unsigned int startBlockID = 0;
+    unsigned int endBlockID = 0;
+    unsigned int maxRunBlockNum = 0;
+    unsigned int extentEndBlockID = 0;
+    off_t serverFileSize = -1;
+    unsigned int blockID;
+
+    assert(iFuseFd != NULL);
+    assert(fetchedOffset != NULL);
+    assert(fetchedSize != NULL);
+
+    *fetchedOffset = 0;
+    *fetchedSize = 0;
+
+    if(size == 0) {
+        return;
+    }
+
+    startBlockID = getBlockID(off);
+    endBlockID = getBlockID(off + size - 1);
+    if(startBlockID == endBlockID && extentBlocks <= 1) {
+        return;
+    }
+
+    maxRunBlockNum = IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE / g_Blocksize;
+    if(maxRunBlockNum < 2) {
+        return;
+    }
+
+    hasDiskCacheKey = _getDiskCacheKey(_getCacheShard(iFuseFd->iRodsPath), iFuseFd->iRodsPath, &diskCacheKey);
+
+    serverFileSize = _getServerFileSize(_getCacheShard(iFuseFd->iRodsPath), iFuseFd->iRodsPath);
+
+    blockID = startBlockID;
+    while(blockID <= endBlockID) {
+        unsigned int runBlockNum = 0;
+        unsigned int runLimit = 0;
+
+        if(_hasLocalBlock(iFuseFd->iRodsPath, blockID, hasDiskCacheKey ? &diskCacheKey : NULL)) {
+            blockID++;
+            continue;
+        }
+
+        // extend the run to the end of the range or the extent
+        runLimit = endBlockID - blockID + 1;
+        if(runLimit < extentBlocks && serverFileSize > 0) {
+            extentEndBlockID = getBlockID(serverFileSize - 1);
+            if(extentEndBlockID > blockID + extentBlocks - 1) {
+                extentEndBlockID = blockID + extentBlocks - 1;
+            }
+
+            if(extentEndBlockID > endBlockID) {
+                runLimit = extentEndBlockID - blockID + 1;
+            }
+        }
+        if(runLimit > maxRunBlockNum) {
+            runLimit = maxRunBlockNum;
+        }
+
+        runBlockNum = 1;
+        while(runBlockNum < runLimit &&
+            !_hasLocalBlock(iFuseFd->iRodsPath, blockID + runBlockNum, hasDiskCacheKey ? &diskCacheKey : NULL)) {
+            runBlockNum++;
+        }
+
+        if(runBlockNum >= 2) {
+            if(*fetchedSize == 0) {
+                status = _fetchBlocks(iFuseFd, blockID, runBlockNum, buf, off, size);
+                if(status > 0) {
+                    *fetchedOffset = getBlockStartOffset(blockID);
+                    *fetchedSize = status;
+                }
+            } else {
+                status = _fetchBlocks(iFuseFd, blockID, runBlockNum, NULL, 0, 0);
+            }
+
+            if(status < 0) {
+                // blocks are read one by one
+                return;
+            } else if((size_t)status < (size_t)runBlockNum * g_Blocksize) {
+                // eof
+                return;
+            }
+        }
+
+        blockID += runBlockNum;
+    }
+}
+
+/*
+ * Copy dirty ranges of deltas being flushed and the current delta in a
+ * block over buf, which holds a part of the block from inBlockOffset up to size
+ * *readSize is extended to the end of dirty ranges
+ */
+static void _overlayDeltas(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size, size_t *readSize) {
+    std::map<std::string, iFuseFileDelta_t*>::iterator it_deltamap;
+    std::multimap<std::string, iFuseFileDelta_t*>::iterator it_flushingmap;
+    std::pair<std::multimap<std::string, iFuseFileDelta_t*>::iterator, std::multimap<std::string, iFuseFileDelta_t*>::iterator> range;
+    iFuseBufferCacheShard_t *shard = NULL;
+    std::string pathkey(iFuseFd->iRodsPath);
+
+    assert(iFuseFd != NULL);
+    assert(readSize != NULL);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_rdlock(&shard->lock);
+
+    // overlay deltas being written, older first
+    range = shard->flushingMap->equal_range(pathkey);
+    for(it_flushingmap = range.first; it_flushingmap != range.second; it_flushingmap++) {
+        _overlayDelta(it_flushingmap->second, buf, blockID, inBlockOffset, size, readSize);
+    }
+
+    // check delta
+    it_deltamap = shard->deltaMap->find(pathkey);
+    if(it_deltamap != shard->deltaMap->end()) {
+        // has delta - overlay dirty ranges in this block
+        _overlayDelta(it_deltamap->second, buf, blockID, inBlockOffset, size, readSize);
+    }
+
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+/*
+ * Read a part of a block from inBlockOffset up to size into buf
+ * data are copied to buf at most once, buf can be NULL to only fill caches
+ * returns size of the whole block
+ */
+static int _readBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size) {
+    int status = 0;
+    off_t blockStartOffset = 0;
+    size_t readSize = 0;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    bool hasCache = false;
+
+    assert(iFuseFd != NULL);
+    assert(inBlockOffset >= 0 && inBlockOffset + size <= (size_t)g_Blocksize);
+
+    if(buf == NULL) {
+        size = 0;
+    }
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    blockStartOffset = getBlockStartOffset(blockID);
+
+    // check cache
+    hasCache = _getCachedBlock(iFuseFd, buf, blockID, inBlockOffset, size, &readSize);
+
+    if(!hasCache) {
+        char *blockBuffer = NULL;
+        char *fetchBuffer = NULL;
+        unsigned long version = _getCacheVersion(shard);
+        iFuseDiskCacheKey_t diskCacheKey;
+        bool hasDiskCacheKey = _getDiskCacheKey(shard, iFuseFd->iRodsPath, &diskCacheKey);
+
+        // read
+        status = _newBufferCache(&iFuseBufferCache);
+        if(status < 0) {
+            return status;
+        }
+
+        assert(iFuseBufferCache != NULL);
+
+        blockBuffer = iFuseBufferedFsAllocBlockBuffer();
+        if(blockBuffer == NULL) {
+            _freeBufferCache(iFuseBufferCache);
+            return SYS_MALLOC_ERR;
+        }
+
+        // whole block is requested - receive directly into buf
+        fetchBuffer = (size == (size_t)g_Blocksize) ? buf : blockBuffer;
+
+        status = -ENOENT;
+        if(hasDiskCacheKey) {
+            status = iFuseDiskCacheGet(&diskCacheKey, blockID, fetchBuffer, g_Blocksize);
+        }
+
+        if(status < 0) {
+            // read from server
+            status = iFuseFsRead(iFuseFd, fetchBuffer, blockStartOffset, g_Blocksize);
+            if (status < 0) {
+                iFuseLibLogError(LOG_ERROR, status, "_readBlock: iFuseFsRead of %s error, status = %d",
+                        iFuseFd->iRodsPath, status);
+                iFuseBufferedFsFreeBlockBuffer(blockBuffer);
+                _freeBufferCache(iFuseBufferCache);
+                return -ENOENT;
+            }
+
+            iFuseLibLog(LOG_DEBUG, "_readBlock: iFuseFsRead of %s - offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)blockStartOffset, (long long)status);
+
+            _updateFetchStat(shard, 1, status);
+
+            // nothing in the shard changed while reading
+            if(hasDiskCacheKey && _getCacheVersion(shard) == version) {
+                iFuseDiskCachePut(&diskCacheKey, blockID, fetchBuffer, status);
+            }
+        }
+
+        readSize = status;
+
+        if(fetchBuffer == buf) {
+            // keep a copy in cache
+            memcpy(blockBuffer, buf, readSize);
+        } else {
+            _copyBlockData(buf, blockBuffer, readSize, inBlockOffset, size);
+        }
+
+        iFuseBufferCache->fdId = iFuseFd->fdId;
+        iFuseBufferCache->buffer = blockBuffer;
+        iFuseBufferCache->pooled = true;
+        iFuseBufferCache->offset = blockStartOffset;
+        iFuseBufferCache->size = readSize;
+
+        status = _putCachedBlock(iFuseFd, blockID, iFuseBufferCache, version);
+        if(status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_readBlock: _putCachedBlock of %s error, status = %d",
+                    iFuseFd->iRodsPath, status);
+        }
+    }
+
+    _overlayDeltas(iFuseFd, buf, blockID, inBlockOffset, size, &readSize);
+    return readSize;
+}
+
+/*
+ * Read a part of a block that _fetchMissingBlocks has copied to buf
+ * fetchedOffset and fetchedSize tell the data fetched,
+ * only dirty ranges are copied over buf
+ * returns size of the whole block
+ */
+static int _readFetchedBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size, off_t fetchedOffset, size_t fetchedSize) {
+    off_t blockStartOffset = getBlockStartOffset(blockID);
+    off_t fetchedEnd = fetchedOffset + (off_t)fetchedSize;
+    size_t readSize = 0;
+
+    assert(iFuseFd != NULL);
+    assert(blockStartOffset >= fetchedOffset && blockStartOffset < fetchedEnd);
+
+    readSize = fetchedEnd - blockStartOffset > (off_t)g_Blocksize ? (size_t)g_Blocksize : (size_t)(fetchedEnd - blockStartOffset);
+
+    // counted as a miss as if read through _readBlock
+    _updateCacheStat(_getCacheShard(iFuseFd->iRodsPath), 0, 1, 0, 0, 0);
+
+    _overlayDeltas(iFuseFd, buf, blockID, inBlockOffset, size, &readSize);
+    return readSize;
+}
+
+/*
+ * Read a part of a block from inBlockOffset up to size into buf, fetching
+ * only IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE pages covering it if the block is
+ * not cached. The pages are not cached, as the block is not read whole.
+ * returns size of the whole block, or g_Blocksize if it is not known
+ */
+static int _readSubBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size) {
+    int status = 0;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseDiskCacheKey_t diskCacheKey;
+    bool hasDiskCacheKey = false;
+    char *blockBuffer = NULL;
+    off_t subStart = 0;
+    off_t subEnd = 0;
+    size_t readSize = 0;
+
+    assert(iFuseFd != NULL);
+    assert(buf != NULL);
+    assert(inBlockOffset >= 0 && inBlockOffset + size <= (size_t)g_Blocksize);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+    hasDiskCacheKey = _getDiskCacheKey(shard, iFuseFd->iRodsPath, &diskCacheKey);
+
+    subStart = inBlockOffset - (inBlockOffset % IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE);
+    subEnd = inBlockOffset + size + IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE - 1;
+    subEnd -= subEnd % IFUSE_BUFFER_CACHE_SUBBLOCK_SIZE;
+    if(subEnd > (off_t)g_Blocksize) {
+        subEnd = g_Blocksize;
+    }
+
+    if(subEnd - subStart >= (off_t)g_Blocksize ||
+        _hasLocalBlock(iFuseFd->iRodsPath, blockID, hasDiskCacheKey ? &diskCacheKey : NULL)) {
+        return _readBlock(iFuseFd, buf, blockID, inBlockOffset, size);
+    }
+
+    blockBuffer = iFuseBufferedFsAllocBlockBuffer();
+    if(blockBuffer == NULL) {
+        return SYS_MALLOC_ERR;
+    }
+
+    // keep the pages at their place in the block
+    status = iFuseFsRead(iFuseFd, blockBuffer + subStart, getBlockStartOffset(blockID) + subStart, subEnd - subStart);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_readSubBlock: iFuseFsRead of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+        iFuseBufferedFsFreeBlockBuffer(blockBuffer);
+        return -ENOENT;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "_readSubBlock: iFuseFsRead of %s - offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)(getBlockStartOffset(blockID) + subStart), (long long)status);
+
+    _updateFetchStat(shard, 1, status);
+    _updateCacheStat(shard, 0, 1, 0, 0, 0);
+
+    if(status < subEnd - subStart) {
+        // eof
+        readSize = subStart + status;
+    } else {
+        readSize = g_Blocksize;
+    }
+
+    _copyBlockData(buf, blockBuffer, subStart + status, inBlockOffset, size);
+
+    iFuseBufferedFsFreeBlockBuffer(blockBuffer);
+
+    _overlayDeltas(iFuseFd, buf, blockID, inBlockOffset, size, &readSize);
+    return readSize;
+}
+
+static int _writeBlock(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
+    int status = 0;
+    std::map<std::string, iFuseFileDelta_t*>::iterator it_deltamap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+    std::string pathkey(iFuseFd->iRodsPath);
+    bool needFlush = false;
+    bool needWait = false;
+
+    assert(iFuseFd != NULL);
+    assert(buf != NULL);
+    assert(size > 0);
+
+    shard = _getCacheShard(iFuseFd->iRodsPath);
+
+    pthread_rwlock_wrlock(&shard->lock);
+
+    it_deltamap = shard->deltaMap->find(pathkey);
+    if(it_deltamap != shard->deltaMap->end()) {
+        // has it
+        iFuseFileDelta = it_deltamap->second;
+    } else {
+        // no delta
+        status = _newFileDelta(&iFuseFileDelta);
+        if(status < 0) {
+            pthread_rwlock_unlock(&shard->lock);
+            return status;
+        }
+
+        iFuseFileDelta->iRodsPath = strdup(iFuseFd->iRodsPath);
+
+        (*shard->deltaMap)[pathkey] = iFuseFileDelta;
+    }
+
+    status = _addDeltaRange(iFuseFileDelta, iFuseFd, buf, off, size);
+    if(status < 0) {
+        pthread_rwlock_unlock(&shard->lock);
+        return status;
+    }
+
+    // to report write errors of the delta
+    iFuseFileDelta->writers->insert(iFuseFd->fdId);
+
+    // write behind once a batch is filled,
+    // block the writer only when too much dirty data is buffered
+    needWait = _getDirtySize() > g_DirtyLimit;
+    needFlush = needWait || (g_FlushThreadNum > 0 && iFuseFileDelta->dirtySize >= IFUSE_BUFFER_CACHE_FLUSH_BATCH_SIZE);
+
+    pthread_rwlock_unlock(&shard->lock);
+
+    if(needFlush) {
+        iFuseLibLog(LOG_DEBUG, "_writeBlock: flushing %s, wait: %d", iFuseFd->iRodsPath, needWait);
+
+        status = _flushDelta(iFuseFd, needWait);
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "_writeBlock: _flushDelta of %s error, status = %d",
+                    iFuseFd->iRodsPath, status);
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+static int _releaseAllCache() {
+    std::map<std::string, iFuseFileDelta_t*>::iterator it_deltamap;
+    std::multimap<std::string, iFuseFileDelta_t*>::iterator it_flushingmap;
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseFileDelta_t *iFuseFileDelta = NULL;
+    iFuseFileBufferCache_t *iFuseFileBufferCache = NULL;
+    int i;
+
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
+
+        pthread_rwlock_wrlock(&shard->lock);
+
+        // release all caches
+        while(!shard->deltaMap->empty()) {
+            it_deltamap = shard->deltaMap->begin();
+            if(it_deltamap != shard->deltaMap->end()) {
+                iFuseFileDelta = it_deltamap->second;
+                shard->deltaMap->erase(it_deltamap);
+
+                _freeFileDelta(iFuseFileDelta);
+            }
+        }
+
+        while(!shard->flushingMap->empty()) {
+            it_flushingmap = shard->flushingMap->begin();
+            if(it_flushingmap != shard->flushingMap->end()) {
+                iFuseFileDelta = it_flushingmap->second;
+                shard->flushingMap->erase(it_flushingmap);
+
+                _freeFileDelta(iFuseFileDelta);
+            }
+        }
+
+        while(!shard->cacheMap->empty()) {
+            it_cachemap = shard->cacheMap->begin();
+            if(it_cachemap != shard->cacheMap->end()) {
+                iFuseFileBufferCache = it_cachemap->second;
+                shard->cacheMap->erase(it_cachemap);
+
+                _freeFileBufferCache(shard, iFuseFileBufferCache);
+            }
+        }
+
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return 0;
+}
+
+static void _invalidateAllCache() {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap_next;
+    iFuseBufferCacheShard_t *shard = NULL;
+    int i;
+
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
+
+        pthread_rwlock_wrlock(&shard->lock);
+
+        // blocks being read now must not be cached
+        shard->version++;
+
+        it_cachemap = shard->cacheMap->begin();
+        while(it_cachemap != shard->cacheMap->end()) {
+            it_cachemap_next = it_cachemap;
+            it_cachemap_next++;
+
+            _invalidateFileBufferCache(shard, it_cachemap->second, -1, 0, 0);
+            _releaseFileBufferCacheIfUnused(shard, it_cachemap);
+
+            it_cachemap = it_cachemap_next;
+        }
+
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+/*
+ * Initialize buffer cache manager
+ */
+void iFuseBufferedFSInit() {
+    iFuseBufferCacheShard_t *shard = NULL;
+    int i;
+
+    if(iFuseLibGetOption()->blocksize > 0) {
+        g_Blocksize = iFuseLibGetOption()->blocksize;
+    }
+
+    if(iFuseLibGetOption()->bufferCacheSize > 0) {
+        g_CacheSize = iFuseLibGetOption()->bufferCacheSize;
+    }
+
+    // cache must be able to hold at least a block
+    if(g_CacheSize < (size_t)g_Blocksize) {
+        g_CacheSize = g_Blocksize;
+    }
+
+    if(iFuseLibGetOption()->dirtyLimit > 0) {
+        g_DirtyLimit = iFuseLibGetOption()->dirtyLimit;
+    }
+
+    if(iFuseLibGetOption()->flushThreads >= 0) {
+        g_FlushThreadNum = iFuseLibGetOption()->flushThreads;
+    }
 
-            // release
-            _freeBufferCache(iFuseBufferCache);
-        } else {
-            pthread_rwlock_unlock(&g_BufferCacheLock);
-        }
+    if(iFuseLibGetOption()->wholeFileSize >= 0) {
+        g_WholeFileSize = iFuseLibGetOption()->wholeFileSize;
     }
 
-    return 0;
-}
+    // a whole file is fetched with a single read and must fit in cache
+    if(g_WholeFileSize > IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE) {
+        g_WholeFileSize = IFUSE_BUFFER_CACHE_FETCH_MAX_SIZE;
+    }
 
-static int _readBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID) {
-    int status = 0;
-    off_t blockStartOffset = 0;
-    size_t readSize = 0;
-    std::map<unsigned long, iFuseBufferCache_t*>::iterator it_cachemap;
-    std::map<std::string, iFuseBufferCache_t*>::iterator it_deltamap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
-    bool hasCache = false;
-    std::string pathkey(iFuseFd->iRodsPath);
+    if(g_WholeFileSize > (off_t)g_CacheSize / 2) {
+        g_WholeFileSize = g_CacheSize / 2;
+    }
 
-    assert(iFuseFd != NULL);
-    assert(buf != NULL);
+    g_CachedSize = 0;
+    g_DirtySize = 0;
 
-    blockStartOffset = getBlockStartOffset(blockID);
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
 
-    pthread_rwlock_rdlock(&g_BufferCacheLock);
+        // we must use new keyword instead of calloc since it contains c++ stl map object
+        shard->cacheMap = new std::map<std::string, iFuseFileBufferCache_t*>();
+        shard->deltaMap = new std::map<std::string, iFuseFileDelta_t*>();
+        shard->flushingMap = new std::multimap<std::string, iFuseFileDelta_t*>();
+        shard->version = 0;
+        shard->lruHead = NULL;
+        shard->lruTail = NULL;
+        pthread_mutex_init(&shard->lruLock, NULL);
 
-    // check cache
-    it_cachemap = g_CacheMap.find(iFuseFd->fdId);
-    if(it_cachemap != g_CacheMap.end()) {
-        // has it
-        iFuseBufferCache = it_cachemap->second;
+        bzero(&shard->stat, sizeof(iFuseFsBufferCacheReport_t));
 
-        if(iFuseBufferCache->offset == blockStartOffset &&
-                iFuseBufferCache->buffer != NULL) {
-            memcpy(buf, iFuseBufferCache->buffer, iFuseBufferCache->size);
+        pthread_rwlockattr_init(&shard->lockAttr);
+        pthread_rwlock_init(&shard->lock, &shard->lockAttr);
 
-            readSize = iFuseBufferCache->size;
-            hasCache = true;
-        }
+        pthread_rwlockattr_init(&shard->statLockAttr);
+        pthread_rwlock_init(&shard->statLock, &shard->statLockAttr);
     }
 
-    pthread_rwlock_unlock(&g_BufferCacheLock);
+    pthread_rwlockattr_init(&g_CachedSizeLockAttr);
+    pthread_rwlock_init(&g_CachedSizeLock, &g_CachedSizeLockAttr);
 
+    pthread_rwlockattr_init(&g_DirtySizeLockAttr);
+    pthread_rwlock_init(&g_DirtySizeLock, &g_DirtySizeLockAttr);
 
-    if(!hasCache) {
-        char *blockBuffer = NULL;
+    // keep at most IFUSE_BUFFER_CACHE_POOL_SIZE of free block buffers
+    pthread_mutex_init(&g_BlockPoolLock, NULL);
+    pthread_key_create(&g_BlockPoolKey, _releaseLocalBlockPool);
+    pthread_key_create(&g_FetchBufferKey, free);
+    bzero(&g_BlockPool, sizeof(iFuseBlockBufferList_t));
+    g_BlockPoolLimit = IFUSE_BUFFER_CACHE_POOL_SIZE / g_Blocksize;
+    if(g_BlockPoolLimit < IFUSE_BUFFER_CACHE_POOL_LOCAL_NUM) {
+        g_BlockPoolLimit = IFUSE_BUFFER_CACHE_POOL_LOCAL_NUM;
+    }
 
-        // remove
-        pthread_rwlock_wrlock(&g_BufferCacheLock);
-        it_cachemap = g_CacheMap.find(iFuseFd->fdId);
-        if(it_cachemap != g_CacheMap.end()) {
-            iFuseBufferCache = it_cachemap->second;
+    pthread_mutex_init(&g_ReadStateLock, NULL);
 
-            g_CacheMap.erase(it_cachemap);
+    pthread_mutex_init(&g_FlushLock, NULL);
+    pthread_cond_init(&g_FlushJobCond, NULL);
+    pthread_cond_init(&g_FlushDoneCond, NULL);
 
-            // release
-            _freeBufferCache(iFuseBufferCache);
+    // start flusher threads - deltas are written on calling threads without them
+    g_FlushRunning = true;
+    if(g_FlushThreadNum > 0) {
+        g_FlushThreads = (pthread_t *) calloc(g_FlushThreadNum, sizeof ( pthread_t));
+        if(g_FlushThreads == NULL) {
+            g_FlushThreadNum = 0;
         }
-        pthread_rwlock_unlock(&g_BufferCacheLock);
+    }
 
-        // read
-        status = _newBufferCache(&iFuseBufferCache);
-        if(status < 0) {
-            return status;
+    for(i=0;i<g_FlushThreadNum;i++) {
+        if(pthread_create(&g_FlushThreads[i], NULL, _flushThread, NULL) != 0) {
+            iFuseLibLog(LOG_ERROR, "iFuseBufferedFSInit: cannot start flusher thread %d", i);
+            g_FlushThreadNum = i;
+            break;
         }
+    }
+}
 
-        assert(iFuseBufferCache != NULL);
+/*
+ * Destroy buffer cache manager
+ */
+void iFuseBufferedFSDestroy() {
+    iFuseBufferCacheShard_t *shard = NULL;
+    iFuseBlockBufferList_t *local = NULL;
+    char *buf = NULL;
+    int i;
+
+    // write all queued deltas and stop flusher threads
+    pthread_mutex_lock(&g_FlushLock);
+    g_FlushRunning = false;
+    pthread_cond_broadcast(&g_FlushJobCond);
+    pthread_mutex_unlock(&g_FlushLock);
+
+    for(i=0;i<g_FlushThreadNum;i++) {
+        pthread_join(g_FlushThreads[i], NULL);
+    }
 
-        // read from server
-        blockBuffer = (char*)calloc(1, g_Blocksize);
-        if(blockBuffer == NULL) {
-            _freeBufferCache(iFuseBufferCache);
-            return SYS_MALLOC_ERR;
-        }
+    if(g_FlushThreads != NULL) {
+        free(g_FlushThreads);
+        g_FlushThreads = NULL;
+    }
+    g_FlushThreadNum = 0;
 
-        status = iFuseFsRead(iFuseFd, blockBuffer, blockStartOffset, g_Blocksize);
-        if (status < 0) {
-            iFuseLibLogError(LOG_ERROR, status, "_readBlock: iFuseFsRead of %s error, status = %d",
-                    iFuseFd->iRodsPath, status);
-            free(blockBuffer);
-            _freeBufferCache(iFuseBufferCache);
-            return -ENOENT;
-        }
+    while(!g_FlushStateMap.empty()) {
+        free(g_FlushStateMap.begin()->second);
+        g_FlushStateMap.erase(g_FlushStateMap.begin());
+    }
 
-        iFuseLibLog(LOG_DEBUG, "_readBlock: iFuseFsRead of %s - offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)blockStartOffset, (long long)status);
+    while(!g_PathFlushStateMap.empty()) {
+        free(g_PathFlushStateMap.begin()->second->iRodsPath);
+        free(g_PathFlushStateMap.begin()->second);
+        g_PathFlushStateMap.erase(g_PathFlushStateMap.begin());
+    }
 
-        iFuseBufferCache->fdId = iFuseFd->fdId;
-        iFuseBufferCache->iRodsPath = strdup(iFuseFd->iRodsPath);
-        iFuseBufferCache->buffer = blockBuffer;
-        iFuseBufferCache->offset = blockStartOffset;
-        iFuseBufferCache->size = status;
+    pthread_cond_destroy(&g_FlushDoneCond);
+    pthread_cond_destroy(&g_FlushJobCond);
+    pthread_mutex_destroy(&g_FlushLock);
+
+    while(!g_ReadStateMap.empty()) {
+        free(g_ReadStateMap.begin()->second);
+        g_ReadStateMap.erase(g_ReadStateMap.begin());
+    }
+
+    pthread_mutex_destroy(&g_ReadStateLock);
+
+    _releaseAllCache();
 
-        pthread_rwlock_wrlock(&g_BufferCacheLock);
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
 
-        g_CacheMap[iFuseFd->fdId] = iFuseBufferCache;
+        delete shard->cacheMap;
+        shard->cacheMap = NULL;
+        delete shard->deltaMap;
+        shard->deltaMap = NULL;
+        delete shard->flushingMap;
+        shard->flushingMap = NULL;
 
-        // copy
-        memcpy(buf, iFuseBufferCache->buffer, iFuseBufferCache->size);
+        pthread_rwlock_destroy(&shard->lock);
+        pthread_rwlockattr_destroy(&shard->lockAttr);
 
-        readSize = iFuseBufferCache->size;
+        pthread_rwlock_destroy(&shard->statLock);
+        pthread_rwlockattr_destroy(&shard->statLockAttr);
 
-        pthread_rwlock_unlock(&g_BufferCacheLock);
+        pthread_mutex_destroy(&shard->lruLock);
     }
 
-    pthread_rwlock_rdlock(&g_BufferCacheLock);
+    pthread_rwlock_destroy(&g_CachedSizeLock);
+    pthread_rwlockattr_destroy(&g_CachedSizeLockAttr);
 
-    // check delta
-    it_deltamap = g_DeltaMap.find(pathkey);
-    if(it_deltamap != g_DeltaMap.end()) {
-        // has delta
-        iFuseBufferCache = it_deltamap->second;
+    pthread_rwlock_destroy(&g_DirtySizeLock);
+    pthread_rwlockattr_destroy(&g_DirtySizeLockAttr);
 
-        if(getBlockID(iFuseBufferCache->offset) == blockID &&
-                iFuseBufferCache->buffer != NULL) {
-            size_t deltaSize = 0;
+    // buffers in free lists of other live threads are released at exit
+    local = (iFuseBlockBufferList_t*)pthread_getspecific(g_BlockPoolKey);
+    if(local != NULL) {
+        pthread_setspecific(g_BlockPoolKey, NULL);
+        _releaseLocalBlockPool(local);
+    }
 
-            assert((iFuseBufferCache->offset - blockStartOffset) >= 0);
+    pthread_key_delete(g_BlockPoolKey);
 
-            memcpy(buf + (iFuseBufferCache->offset - blockStartOffset), iFuseBufferCache->buffer, iFuseBufferCache->size);
+    buf = (char*)pthread_getspecific(g_FetchBufferKey);
+    if(buf != NULL) {
+        pthread_setspecific(g_FetchBufferKey, NULL);
+        free(buf);
+    }
 
-            deltaSize = (iFuseBufferCache->offset - blockStartOffset) + iFuseBufferCache->size;
+    pthread_key_delete(g_FetchBufferKey);
 
-            if(readSize < deltaSize) {
-                readSize = deltaSize;
-            }
-        }
+    while((buf = _popBlockBuffer(&g_BlockPool)) != NULL) {
+        free(buf);
     }
 
-    pthread_rwlock_unlock(&g_BufferCacheLock);
-    return readSize;
+    pthread_mutex_destroy(&g_BlockPoolLock);
 }
 
-static int _writeBlock(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
-    int status = 0;
-    std::map<std::string, iFuseBufferCache_t*>::iterator it_deltamap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
-    std::string pathkey(iFuseFd->iRodsPath);
+/*
+ * Report status of buffer cache
+ */
+void iFuseBufferedFsReport(iFuseFsBufferCacheReport_t *report) {
+    iFuseBufferCacheShard_t *shard = NULL;
+    int i;
 
-    assert(iFuseFd != NULL);
-    assert(buf != NULL);
-    assert(size > 0);
+    assert(report != NULL);
 
-    pthread_rwlock_wrlock(&g_BufferCacheLock);
-
-    it_deltamap = g_DeltaMap.find(pathkey);
-    if(it_deltamap != g_DeltaMap.end()) {
-        // has it - determine flush or extend
-        iFuseBufferCache = it_deltamap->second;
-
-        if(_isSameBlock(iFuseBufferCache->offset, off) &&
-            (off_t)(iFuseBufferCache->offset + iFuseBufferCache->size) >= off &&
-            iFuseBufferCache->offset <= (off_t)(off + size)) {
-            // intersect - expand
-            off_t startOffset = off > iFuseBufferCache->offset ? iFuseBufferCache->offset : off;
-            off_t endOffset = (off + size) > (iFuseBufferCache->offset + iFuseBufferCache->size) ? (off + size) : (iFuseBufferCache->offset + iFuseBufferCache->size);
-            size_t newSize = endOffset - startOffset;
-            char *newBuf = (char*)calloc(1, newSize);
-            if(newBuf == NULL) {
-                pthread_rwlock_unlock(&g_BufferCacheLock);
-                return SYS_MALLOC_ERR;
-            }
+    bzero(report, sizeof(iFuseFsBufferCacheReport_t));
 
-            assert(newSize > 0);
-            assert((iFuseBufferCache->offset - startOffset) >= 0);
-            assert((off - startOffset) >= 0);
+    for(i=0;i<IFUSE_BUFFER_CACHE_SHARD_NUM;i++) {
+        shard = &g_CacheShards[i];
 
-            memcpy(newBuf + (iFuseBufferCache->offset - startOffset), iFuseBufferCache->buffer, iFuseBufferCache->size);
-            memcpy(newBuf + (off - startOffset), buf, size);
+        pthread_rwlock_rdlock(&shard->statLock);
 
-            free(iFuseBufferCache->buffer);
+        report->hits += shard->stat.hits;
+        report->misses += shard->stat.misses;
+        report->evictions += shard->stat.evictions;
+        report->cachedBlocks += shard->stat.cachedBlocks;
+        report->cachedBytes += shard->stat.cachedBytes;
+        report->fetches += shard->stat.fetches;
+        report->fetchedBytes += shard->stat.fetchedBytes;
 
-            iFuseBufferCache->buffer = newBuf;
-            iFuseBufferCache->offset = startOffset;
-            iFuseBufferCache->size = newSize;
+        pthread_rwlock_unlock(&shard->statLock);
+    }
 
-            pthread_rwlock_unlock(&g_BufferCacheLock);
-        } else {
-            char *newBuf = (char*)calloc(1, size);
-            char *bufFlush = iFuseBufferCache->buffer;
-            off_t offFlush = iFuseBufferCache->offset;
-            size_t sizeFlush = iFuseBufferCache->size;
+    iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsReport: hits = %lld, misses = %lld, evictions = %lld, cached blocks = %lld, cached bytes = %lld", report->hits, report->misses, report->evictions, report->cachedBlocks, report->cachedBytes);
+}
 
-            if(newBuf == NULL) {
-                pthread_rwlock_unlock(&g_BufferCacheLock);
-                return SYS_MALLOC_ERR;
-            }
+int iFuseBufferedFsGetAttr(const char *iRodsPath, struct stat *stbuf) {
+    int status = 0;
+    std::map<std::string, iFuseFileDelta_t*>::iterator it_deltamap;
+    std::multimap<std::string, iFuseFileDelta_t*>::iterator it_flushingmap;
+    std::pair<std::multimap<std::string, iFuseFileDelta_t*>::iterator, std::multimap<std::string, iFuseFileDelta_t*>::iterator> range;
+    iFuseBufferCacheShard_t *shard = NULL;
+    off_t newSize = 0;
+    std::string pathkey(iRodsPath);
 
-            // disjunction
-            // apply delta to caches
-            _applyDeltaToCache(iFuseFd->iRodsPath, iFuseBufferCache->buffer, iFuseBufferCache->offset, iFuseBufferCache->size);
+    assert(iRodsPath != NULL);
+    assert(stbuf != NULL);
 
-            memcpy(newBuf, buf, size);
+    iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsGetAttr: %s", iRodsPath);
 
-            iFuseBufferCache->buffer = newBuf;
-            iFuseBufferCache->offset = off;
-            iFuseBufferCache->size = size;
+    status = iFuseFsGetAttr(iRodsPath, stbuf);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsGetAttr: iFuseFsGetAttr of %s error, status = %d",
+                iRodsPath, status);
+        return status;
+    }
 
-            // release lock before making write request
-            pthread_rwlock_unlock(&g_BufferCacheLock);
+    shard = _getCacheShard(iRodsPath);
 
-            // flush
-            status = iFuseFsWrite(iFuseFd, bufFlush, offFlush, sizeFlush);
-            if (status < 0) {
-                iFuseLibLogError(LOG_ERROR, status, "_writeBlock: iFuseFsWrite of %s error, status = %d",
-                        iFuseFd->iRodsPath, status);
-                return -ENOENT;
-            }
+    pthread_rwlock_rdlock(&shard->lock);
 
-            free(bufFlush);
-        }
-    } else {
-        char *newBuf = (char*)calloc(1, size);
-        if(newBuf == NULL) {
-            pthread_rwlock_unlock(&g_BufferCacheLock);
-            return SYS_MALLOC_ERR;
+    // data being written may not be visible to iRODS yet
+    range = shard->flushingMap->equal_range(pathkey);
+    for(it_flushingmap = range.first; it_flushingmap != range.second; it_flushingmap++) {
+        newSize = _getDeltaEndOffset(it_flushingmap->second);
+        if(newSize > stbuf->st_size) {
+            stbuf->st_size = newSize;
         }
+    }
 
-        // no delta
-        status = _newBufferCache(&iFuseBufferCache);
-        if(status < 0) {
-            pthread_rwlock_unlock(&g_BufferCacheLock);
-            return status;
+    it_deltamap = shard->deltaMap->find(pathkey);
+    if(it_deltamap != shard->deltaMap->end()) {
+        newSize = _getDeltaEndOffset(it_deltamap->second);
+        if(newSize > stbuf->st_size) {
+            stbuf->st_size = newSize;
         }
-
-        assert(iFuseBufferCache != NULL);
-
-        memcpy(newBuf, buf, size);
-
-        iFuseBufferCache->fdId = iFuseFd->fdId;
-        iFuseBufferCache->iRodsPath = strdup(iFuseFd->iRodsPath);
-        iFuseBufferCache->buffer = newBuf;
-        iFuseBufferCache->offset = off;
-        iFuseBufferCache->size = size;
-
-        g_DeltaMap[pathkey] = iFuseBufferCache;
-
-        pthread_rwlock_unlock(&g_BufferCacheLock);
     }
 
-    return 0;
+    pthread_rwlock_unlock(&shard->lock);
+    return status;
 }
 
-static int _releaseAllCache() {
-    std::map<std::string, iFuseBufferCache_t*>::iterator it_deltamap;
-    std::map<unsigned long, iFuseBufferCache_t*>::iterator it_cachemap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
+/*
+ * Drop block cache of a file modified or removed by metadata operations
+ */
+void iFuseBufferedFsInvalidateCache(const char *iRodsPath) {
+    std::map<std::string, iFuseFileBufferCache_t*>::iterator it_cachemap;
+    iFuseBufferCacheShard_t *shard = NULL;
+    std::string pathkey(iRodsPath);
 
-    pthread_rwlock_wrlock(&g_BufferCacheLock);
+    assert(iRodsPath != NULL);
 
-    // release all caches
-    while(!g_DeltaMap.empty()) {
-        it_deltamap = g_DeltaMap.begin();
-        if(it_deltamap != g_DeltaMap.end()) {
-            iFuseBufferCache = it_deltamap->second;
-            g_DeltaMap.erase(it_deltamap);
+    iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsInvalidateCache: %s", iRodsPath);
 
-            _freeBufferCache(iFuseBufferCache);
-        }
-    }
+    shard = _getCacheShard(iRodsPath);
 
-    while(!g_CacheMap.empty()) {
-        it_cachemap = g_CacheMap.begin();
-        if(it_cachemap != g_CacheMap.end()) {
-            iFuseBufferCache = it_cachemap->second;
-            g_CacheMap.erase(it_cachemap);
+    pthread_rwlock_wrlock(&shard->lock);
 
-            _freeBufferCache(iFuseBufferCache);
-        }
+    // blocks being read now must not be cached
+    shard->version++;
+
+    it_cachemap = shard->cacheMap->find(pathkey);
+    if(it_cachemap != shard->cacheMap->end()) {
+        _invalidateFileBufferCache(shard, it_cachemap->second, -1, 0, 0);
+        _releaseFileBufferCacheIfUnused(shard, it_cachemap);
     }
 
-    pthread_rwlock_unlock(&g_BufferCacheLock);
-    return 0;
+    pthread_rwlock_unlock(&shard->lock);
 }
 
 /*
- * Initialize buffer cache manager
+ * Check if all blocks of a file can be read without a request to the server
  */
-void iFuseBufferedFSInit() {
+static bool _hasAllLocalBlocks(const char *iRodsPath, off_t fileSize) {
+    iFuseDiskCacheKey_t diskCacheKey;
+    bool hasDiskCacheKey = false;
+    unsigned int blockID;
 
-    if(iFuseLibGetOption()->blocksize > 0) {
-        g_Blocksize = iFuseLibGetOption()->blocksize;
+    assert(iRodsPath != NULL);
+    assert(fileSize > 0);
+
+    hasDiskCacheKey = _getDiskCacheKey(_getCacheShard(iRodsPath), iRodsPath, &diskCacheKey);
+
+    for(blockID=0;blockID<=getBlockID(fileSize - 1);blockID++) {
+        if(!_hasLocalBlock(iRodsPath, blockID, hasDiskCacheKey ? &diskCacheKey : NULL)) {
+            return false;
+        }
     }
 
-    pthread_rwlockattr_init(&g_BufferCacheLockAttr);
-    pthread_rwlock_init(&g_BufferCacheLock, &g_BufferCacheLockAttr);
+    return true;
 }
 
 /*
- * Destroy buffer cache manager
+ * Open a small file for read, the whole file is cached at once and
+ * the descriptor is detached from iRODS
  */
-void iFuseBufferedFSDestroy() {
-    _releaseAllCache();
-
-    pthread_rwlock_destroy(&g_BufferCacheLock);
-    pthread_rwlockattr_destroy(&g_BufferCacheLockAttr);
-}
-
-int iFuseBufferedFsGetAttr(const char *iRodsPath, struct stat *stbuf) {
+static int _openWholeFile(const char *iRodsPath, const struct stat *stbuf, iFuseFd_t **iFuseFd, int openFlag) {
     int status = 0;
-    std::map<std::string, iFuseBufferCache_t*>::iterator it_deltamap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
-    std::string pathkey(iRodsPath);
 
     assert(iRodsPath != NULL);
     assert(stbuf != NULL);
+    assert(iFuseFd != NULL);
 
-    iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsGetAttr: %s", iRodsPath);
+    status = _openFileBufferCache(iRodsPath, stbuf, false);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_openWholeFile: _openFileBufferCache of %s error, status = %d",
+                iRodsPath, status);
+        return status;
+    }
 
-    status = iFuseFsGetAttr(iRodsPath, stbuf);
+    // checks permission, cached blocks may have been read by others
+    // or at previous mounts
+    status = iFuseFsOpen(iRodsPath, iFuseFd, openFlag);
     if (status < 0) {
-        iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsGetAttr: iFuseFsGetAttr of %s error, status = %d",
+        iFuseLibLogError(LOG_ERROR, status, "_openWholeFile: iFuseFsOpen of %s error, status = %d",
                 iRodsPath, status);
+        _closeFileBufferCache(iRodsPath);
         return status;
     }
 
-    pthread_rwlock_rdlock(&g_BufferCacheLock);
+    if(_hasAllLocalBlocks(iRodsPath, stbuf->st_size)) {
+        // served from caches
+        iFuseLibLog(LOG_DEBUG, "_openWholeFile: all blocks of %s are cached", iRodsPath);
 
-    it_deltamap = g_DeltaMap.find(pathkey);
-    if(it_deltamap != g_DeltaMap.end()) {
-        // has it
-        iFuseBufferCache = it_deltamap->second;
+        iFuseFsDetach(*iFuseFd);
 
-        off_t newSize = iFuseBufferCache->offset + iFuseBufferCache->size;
-        if(newSize > stbuf->st_size) {
-            stbuf->st_size = newSize;
-        }
+        _setWholeFileReadState(*iFuseFd);
+        return 0;
     }
 
-    pthread_rwlock_unlock(&g_BufferCacheLock);
-    return status;
+    status = _fetchBlocks(*iFuseFd, 0, getBlockID(stbuf->st_size - 1) + 1, NULL, 0, 0);
+    if (status < 0) {
+        // blocks are read on demand
+        iFuseLibLogError(LOG_ERROR, status, "_openWholeFile: _fetchBlocks of %s error, status = %d",
+                iRodsPath, status);
+        return 0;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "_openWholeFile: fetched %s, size: %lld", iRodsPath, (long long)status);
+
+    // the connection is not needed while blocks are cached
+    iFuseFsDetach(*iFuseFd);
+
+    _setWholeFileReadState(*iFuseFd);
+    return 0;
 }
 
 /*
- * Create a new buffer cache
+ * Open a file and validate its block cache
  */
 int iFuseBufferedFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
     int status = 0;
+    struct stat stbuf;
+    bool hasStat = false;
 
     assert(iRodsPath != NULL);
     assert(iFuseFd != NULL);
 
     iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsOpen: %s, openFlag: 0x%08x", iRodsPath, openFlag);
 
+    // size and mtime are usually served from metadata cache
+    bzero(&stbuf, sizeof(struct stat));
+
+    if((openFlag & O_ACCMODE) == O_RDONLY && g_WholeFileSize > 0) {
+        hasStat = (iFuseFsGetAttr(iRodsPath, &stbuf) == 0);
+
+        if(hasStat && S_ISREG(stbuf.st_mode) && stbuf.st_size > 0 && stbuf.st_size <= g_WholeFileSize) {
+            return _openWholeFile(iRodsPath, &stbuf, iFuseFd, openFlag);
+        }
+    }
+
     status = iFuseFsOpen(iRodsPath, iFuseFd, openFlag);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsOpen: iFuseFsOpen of %s error, status = %d",
@@ -525,16 +2927,34 @@ int iFuseBufferedFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag
         return status;
     }
 
-    return status;
+    if(!hasStat) {
+        status = iFuseFsGetAttr(iRodsPath, &stbuf);
+        if (status == 0) {
+            hasStat = true;
+        } else {
+            iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsOpen: iFuseFsGetAttr of %s error, status = %d - dropping cache",
+                    iRodsPath, status);
+        }
+    }
+
+    status = _openFileBufferCache(iRodsPath, hasStat ? &stbuf : NULL, (openFlag & O_TRUNC) != 0);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsOpen: _openFileBufferCache of %s error, status = %d",
+                iRodsPath, status);
+        iFuseFsClose(*iFuseFd);
+        *iFuseFd = NULL;
+        return status;
+    }
+
+    return 0;
 }
 
 /*
- * Release a buffer cache
+ * Close a file, its block cache is kept for other handles
  */
 int iFuseBufferedFsClose(iFuseFd_t *iFuseFd) {
     int status = 0;
-    std::map<unsigned long, iFuseBufferCache_t*>::iterator it_cachemap;
-    iFuseBufferCache_t *iFuseBufferCache = NULL;
+    int flushStatus = 0;
     char *iRodsPath;
 
     assert(iFuseFd != NULL);
@@ -543,26 +2963,18 @@ int iFuseBufferedFsClose(iFuseFd_t *iFuseFd) {
 
     if((iFuseFd->openFlag & O_ACCMODE) != O_RDONLY) {
         // flush if necessary
-        status = _flushDelta(iFuseFd);
-        if (status < 0) {
-            iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsClose: _flushCache of %s error, status = %d",
-                    iFuseFd->iRodsPath, status);
-            return -ENOENT;
+        flushStatus = _flushDelta(iFuseFd, true);
+        _releaseFlushState(iFuseFd);
+        if (flushStatus < 0) {
+            // release the handle anyway
+            iFuseLibLogError(LOG_ERROR, flushStatus, "iFuseBufferedFsClose: _flushCache of %s error, status = %d",
+                    iFuseFd->iRodsPath, flushStatus);
         }
     }
 
-    pthread_rwlock_wrlock(&g_BufferCacheLock);
-
-    it_cachemap = g_CacheMap.find(iFuseFd->fdId);
-    if(it_cachemap != g_CacheMap.end()) {
-        // has it
-        iFuseBufferCache = it_cachemap->second;
-        g_CacheMap.erase(it_cachemap);
-
-        _freeBufferCache(iFuseBufferCache);
-    }
+    _releaseReadState(iFuseFd);
 
-    pthread_rwlock_unlock(&g_BufferCacheLock);
+    _closeFileBufferCache(iFuseFd->iRodsPath);
 
     iRodsPath = strdup(iFuseFd->iRodsPath);
 
@@ -575,6 +2987,10 @@ int iFuseBufferedFsClose(iFuseFd_t *iFuseFd) {
     }
 
     free(iRodsPath);
+
+    if (flushStatus < 0) {
+        return -ENOENT;
+    }
     return status;
 }
 
@@ -589,7 +3005,7 @@ int iFuseBufferedFsFlush(iFuseFd_t *iFuseFd) {
     iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsFlush: %s", iFuseFd->iRodsPath);
 
     if((iFuseFd->openFlag & O_ACCMODE) != O_RDONLY) {
-        status = _flushDelta(iFuseFd);
+        status = _flushDelta(iFuseFd, true);
         if (status < 0) {
             iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsFlush: _flushCache of %s error, status = %d",
                     iFuseFd->iRodsPath, status);
@@ -607,15 +3023,34 @@ int iFuseBufferedFsFlush(iFuseFd_t *iFuseFd) {
     return status;
 }
 
-int iFuseBufferedFsReadBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID) {
+/*
+ * Check if the file of a descriptor has been read whole at open
+ */
+bool iFuseBufferedFsIsWholeFile(iFuseFd_t *iFuseFd) {
+    std::map<unsigned long, iFuseFdReadState_t*>::iterator it_statemap;
+    bool wholeFile = false;
+
+    assert(iFuseFd != NULL);
+
+    pthread_mutex_lock(&g_ReadStateLock);
+
+    it_statemap = g_ReadStateMap.find(iFuseFd->fdId);
+    if(it_statemap != g_ReadStateMap.end()) {
+        wholeFile = it_statemap->second->wholeFile;
+    }
+
+    pthread_mutex_unlock(&g_ReadStateLock);
+    return wholeFile;
+}
+
+int iFuseBufferedFsReadBlock(iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size) {
     int status = 0;
 
     assert(iFuseFd != NULL);
-    assert(buf != NULL);
 
     iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsReadBlock: %s, blockID: %u", iFuseFd->iRodsPath, blockID);
 
-    status = _readBlock(iFuseFd, buf, blockID);
+    status = _readBlock(iFuseFd, buf, blockID, inBlockOffset, size);
     if(status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsReadBlock: _readBlock of %s error, status = %d",
             iFuseFd->iRodsPath, status);
@@ -633,17 +3068,53 @@ int iFuseBufferedFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
     size_t readSize = 0;
     size_t remain = 0;
     off_t curOffset = 0;
-    char *blockBuffer = (char*)calloc(1, g_Blocksize);
-    if(blockBuffer == NULL) {
-        return SYS_MALLOC_ERR;
-    }
+    unsigned int extentBlocks = 0;
+    bool random = false;
+    int priority = 0;
+    off_t fetchedOffset = 0;
+    size_t fetchedSize = 0;
 
     assert(iFuseFd != NULL);
     assert(buf != NULL);
 
     iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsRead: %s, offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)off, (long long)size);
 
-    // read in block level
+    extentBlocks = _updateReadState(iFuseFd, off, size, &random);
+
+    if(random && size > 0 && getBlockID(off) == getBlockID(off + size - 1)) {
+        // small random read - fetch only pages it covers
+        status = _readSubBlock(iFuseFd, buf, getBlockID(off), getInBlockOffset(off), size);
+        if(status < 0) {
+            iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsRead: _readSubBlock of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+            return status;
+        }
+
+        if((size_t)getInBlockOffset(off) >= (size_t)status) {
+            // eof
+            return 0;
+        }
+
+        readSize = (size_t)status - getInBlockOffset(off);
+        return readSize > size ? size : readSize;
+    }
+
+    // a sequential reader fetches ahead of its requests - it yields to other demand requests
+    priority = iFuseIOSchedGetPriority();
+    if(priority == IFUSE_IO_PRIORITY_FOREGROUND && extentBlocks > 1) {
+        iFuseIOSchedSetPriority(IFUSE_IO_PRIORITY_STREAM);
+
+        // large fetches would hold up demand requests of others
+        if(iFuseIOSchedHasForeground()) {
+            extentBlocks = 1;
+        }
+    }
+
+    _fetchMissingBlocks(iFuseFd, buf, off, size, extentBlocks, &fetchedOffset, &fetchedSize);
+
+    iFuseIOSchedSetPriority(priority);
+
+    // read in block level, directly into the caller's buffer
     remain = size;
     curOffset = off;
     while(remain > 0) {
@@ -652,7 +3123,13 @@ int iFuseBufferedFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
         size_t curSize = inBlockAvail > remain ? remain : inBlockAvail;
         size_t blockSize = 0;
 
-        status = _readBlock(iFuseFd, blockBuffer, getBlockID(curOffset));
+        if(curOffset >= fetchedOffset && curOffset < fetchedOffset + (off_t)fetchedSize) {
+            // already in buf
+            status = _readFetchedBlock(iFuseFd, buf + readSize, getBlockID(curOffset), inBlockOffset, curSize, fetchedOffset, fetchedSize);
+        } else {
+            status = _readBlock(iFuseFd, buf + readSize, getBlockID(curOffset), inBlockOffset, curSize);
+        }
+
         if(status < 0) {
             iFuseLibLogError(LOG_ERROR, status, "iFuseBufferedFsRead: _readBlock of %s error, status = %d",
                 iFuseFd->iRodsPath, status);
@@ -666,19 +3143,16 @@ int iFuseBufferedFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
 
         iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsRead: _readBlock of %s, offset: %lld, in-block offset: %lld, curSize: %lld, size: %lld", iFuseFd->iRodsPath, (long long)curOffset, (long long)inBlockOffset, (long long)curSize, (long long)blockSize);
 
-        if(inBlockOffset + curSize > blockSize) {
-            curSize = blockSize - inBlockOffset;
-        }
-
-        if (curSize == 0) {
+        if((size_t)inBlockOffset >= blockSize) {
             // eof
             break;
         }
 
-        iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsRead: block read of %s - offset %lld, size %lld", iFuseFd->iRodsPath, (long long)curOffset, (long long)curSize);
+        if(inBlockOffset + curSize > blockSize) {
+            curSize = blockSize - inBlockOffset;
+        }
 
-        // copy
-        memcpy(buf + readSize, blockBuffer + inBlockOffset, curSize);
+        iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsRead: block read of %s - offset %lld, size %lld", iFuseFd->iRodsPath, (long long)curOffset, (long long)curSize);
 
         readSize += curSize;
         remain -= curSize;
@@ -690,8 +3164,6 @@ int iFuseBufferedFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
         }
     }
 
-    free(blockBuffer);
-
     return readSize;
 }
 
@@ -733,3 +3205,34 @@ int iFuseBufferedFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t
 
     return writtenSize;
 }
+
+/*
+ * Handle ioctl for buffer cache
+ */
+int iFuseBufferedFsIoctl(const char *iRodsPath, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data) {
+    assert(iRodsPath != NULL);
+
+    iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsIoctl: %s, command = %d", iRodsPath, cmd);
+
+    switch ((unsigned int)cmd) {
+        case IFUSEIOC_SHOW_BUFFER_CACHE:
+            {
+                // show buffer cache statistics
+                iFuseFsBufferCacheReport_t report;
+                iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsIoctl: showing buffer cache statistics");
+
+                iFuseBufferedFsReport(&report);
+                *(iFuseFsBufferCacheReport_t*) data = report;
+            }
+            return 0;
+        case IFUSEIOC_RESET_METADATA_CACHE:
+            // drop block caches too, metadata cache is cleared below
+            iFuseLibLog(LOG_DEBUG, "iFuseBufferedFsIoctl: invalidating buffer caches");
+            _invalidateAllCache();
+            break;
+        default:
+            break;
+    }
+
+    return iFuseFsIoctl(iRodsPath, cmd, arg, fi, flags, data);
+}
@@ -28,11 +28,12 @@
 #include "iFuse.Lib.RodsClientAPI.hpp"
 #include "iFuse.Lib.Fd.hpp"
 #include "iFuse.Lib.Conn.hpp"
+#include "iFuse.Lib.IOSched.hpp"
 #include "iFuse.Lib.MetadataCache.hpp"
 #include "iFuse.Lib.Util.hpp"
 #include "sockComm.h"
 
-static bool g_ConnReuse = false;
+static bool g_ConnReuse = true;
 static bool g_CacheMetadata = true;
 
 static int _safeAtoi(char *str) {
@@ -130,9 +131,9 @@ int iFuseFsGetAttr(const char *iRodsPath, struct stat *stbuf) {
     // temporarily obtain a connection
     // must be marked unused and release lock after use
     if(g_ConnReuse) {
-        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     } else {
-        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE);
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE, iRodsPath);
     }
 
     if (status < 0) {
@@ -241,9 +242,9 @@ int iFuseFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
     // must be released lock after use
     // while the file is opened, connection is in-use status.
     if(g_ConnReuse) {
-        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO);
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO, iRodsPath);
     } else {
-        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE);
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE, iRodsPath);
     }
 
     if (status < 0) {
@@ -259,6 +260,11 @@ int iFuseFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
         return -ENOENT;
     }
 
+    if(openFlag & O_TRUNC) {
+        // truncated on open, marked as a change like written data
+        (*iFuseFd)->written = true;
+    }
+
     // clear stat cache
     if(g_CacheMetadata) {
         if((openFlag & O_ACCMODE) != O_RDONLY) {
@@ -270,6 +276,71 @@ int iFuseFsOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
     return 0;
 }
 
+/*
+ * Close a read-only file on iRODS and release its connection
+ * the file descriptor is kept and opened again at next read from iRODS
+ */
+int iFuseFsDetach(iFuseFd_t *iFuseFd) {
+    int status = 0;
+    iFuseConn_t *iFuseConn = NULL;
+
+    assert(iFuseFd != NULL);
+    assert(iFuseFd->iRodsPath != NULL);
+    assert((iFuseFd->openFlag & O_ACCMODE) == O_RDONLY);
+
+    iFuseLibLog(LOG_DEBUG, "iFuseFsDetach: %s", iFuseFd->iRodsPath);
+
+    status = iFuseFdDetach(iFuseFd, &iFuseConn);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "iFuseFsDetach: iFuseFdDetach of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+    }
+
+    if(iFuseConn != NULL) {
+        iFuseConnUnuse(iFuseConn);
+    }
+
+    return status;
+}
+
+/*
+ * Open the file of a detached file descriptor on iRODS
+ */
+static int _attachFd(iFuseFd_t *iFuseFd) {
+    int status = 0;
+    iFuseConn_t *iFuseConn = NULL;
+
+    assert(iFuseFd != NULL);
+
+    iFuseLibLog(LOG_DEBUG, "_attachFd: %s", iFuseFd->iRodsPath);
+
+    if(g_ConnReuse) {
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO, iFuseFd->iRodsPath);
+    } else {
+        status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE, iFuseFd->iRodsPath);
+    }
+
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_attachFd: iFuseConnGetAndUse of %s error",
+                iFuseFd->iRodsPath);
+        return -EIO;
+    }
+
+    status = iFuseFdAttach(iFuseFd, iFuseConn);
+    if (status != 0) {
+        // failed or attached by others
+        iFuseConnUnuse(iFuseConn);
+    }
+
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_attachFd: iFuseFdAttach of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+        return -ENOENT;
+    }
+
+    return 0;
+}
+
 int iFuseFsClose(iFuseFd_t *iFuseFd) {
     int status = 0;
     iFuseConn_t *iFuseConn = NULL;
@@ -278,7 +349,6 @@ int iFuseFsClose(iFuseFd_t *iFuseFd) {
 
     assert(iFuseFd != NULL);
     assert(iFuseFd->iRodsPath != NULL);
-    assert(iFuseFd->fd > 0);
 
     iFuseLibLog(LOG_DEBUG, "iFuseFsClose: %s", iFuseFd->iRodsPath);
 
@@ -295,7 +365,10 @@ int iFuseFsClose(iFuseFd_t *iFuseFd) {
         return -ENOENT;
     }
 
-    iFuseConnUnuse(iFuseConn);
+    if(iFuseConn != NULL) {
+        // not detached
+        iFuseConnUnuse(iFuseConn);
+    }
 
     // clear stat cache
     if(g_CacheMetadata) {
@@ -310,7 +383,7 @@ int iFuseFsClose(iFuseFd_t *iFuseFd) {
     return 0;
 }
 
-int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
+static int _readData(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
     int status = 0;
     int readError = 0;
     iFuseConn_t *iFuseConn = NULL;
@@ -412,6 +485,10 @@ int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
     dataObjReadInp.l1descInx = iFuseFd->fd;
     dataObjReadInp.len = size;
 
+    // receive data directly into the caller's buffer
+    dataObjReadOutBBuf.buf = buf;
+    dataObjReadOutBBuf.len = size;
+
     iFuseLibLog(LOG_DEBUG, "iFuseFsRead: iFuseRodsClientDataObjRead %s, offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)off, (long long)size);
 
     status = iFuseRodsClientDataObjRead(iFuseConn->conn, &dataObjReadInp, &dataObjReadOutBBuf);
@@ -425,6 +502,8 @@ int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
                 iFuseFdUnlock(iFuseFd);
                 return -ENOENT;
             } else {
+                dataObjReadOutBBuf.buf = buf;
+                dataObjReadOutBBuf.len = size;
                 status = iFuseRodsClientDataObjRead(iFuseConn->conn, &dataObjReadInp, &dataObjReadOutBBuf);
                 if (status < 0) {
                     iFuseLibLogError(LOG_ERROR, status, "iFuseFsRead: iFuseRodsClientDataObjRead of %s error, status = %d",
@@ -455,9 +534,9 @@ int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
 
     assert(size >= (size_t)status);
 
-    memcpy(buf, dataObjReadOutBBuf.buf, status);
-
-    if(dataObjReadOutBBuf.buf != NULL) {
+    if(dataObjReadOutBBuf.buf != buf && dataObjReadOutBBuf.buf != NULL) {
+        // client library allocated its own buffer
+        memcpy(buf, dataObjReadOutBBuf.buf, status);
         free(dataObjReadOutBBuf.buf);
         dataObjReadOutBBuf.buf = NULL;
     }
@@ -469,7 +548,29 @@ int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
     return status;
 }
 
-int iFuseFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
+int iFuseFsRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
+    int status = 0;
+
+    assert(iFuseFd != NULL);
+
+    if(iFuseFd->fd <= 0) {
+        // detached
+        status = _attachFd(iFuseFd);
+        if (status < 0) {
+            return status;
+        }
+    }
+
+    // waits for a slot, requests of higher priority start first
+    iFuseIOSchedBegin();
+
+    status = _readData(iFuseFd, buf, off, size);
+
+    iFuseIOSchedEnd();
+    return status;
+}
+
+static int _writeData(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
     int status = 0;
     int writeError = 0;
     iFuseConn_t *iFuseConn = NULL;
@@ -617,21 +718,39 @@ int iFuseFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
     }
 
     iFuseFd->lastFilePointer += status;
+    // marked as a change to the path at flush or close
+    iFuseFd->written = true;
 
     iFuseConnUnlock(iFuseConn);
     iFuseFdUnlock(iFuseFd);
     return status;
 }
 
+int iFuseFsWrite(iFuseFd_t *iFuseFd, const char *buf, off_t off, size_t size) {
+    int status = 0;
+
+    // waits for a slot, write-behind yields to demand requests
+    iFuseIOSchedBegin();
+
+    status = _writeData(iFuseFd, buf, off, size);
+
+    iFuseIOSchedEnd();
+    return status;
+}
+
 int iFuseFsFlush(iFuseFd_t *iFuseFd) {
     int status = 0;
 
     assert(iFuseFd != NULL);
     assert(iFuseFd->iRodsPath != NULL);
-    assert(iFuseFd->fd > 0);
 
     iFuseLibLog(LOG_DEBUG, "iFuseFsFlush: %s", iFuseFd->iRodsPath);
 
+    if(iFuseFd->fd <= 0) {
+        // detached - nothing is open on iRODS
+        return 0;
+    }
+
     status = iFuseFdReopen(iFuseFd);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsClose: iFuseFdReopen of %s error, status = %d",
@@ -661,7 +780,7 @@ int iFuseFsCreate(const char *iRodsPath, mode_t mode) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsCreate: iFuseConnGetAndUse of %s error", iRodsPath);
         return -EIO;
@@ -753,6 +872,9 @@ int iFuseFsCreate(const char *iRodsPath, mode_t mode) {
         }
     }
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -780,7 +902,7 @@ int iFuseFsUnlink(const char *iRodsPath) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsUnlink: iFuseConnGetAndUse of %s error",
                 iRodsPath);
@@ -831,6 +953,9 @@ int iFuseFsUnlink(const char *iRodsPath) {
 
     clearKeyVal(&dataObjInp.condInput);
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -892,9 +1017,9 @@ int iFuseFsOpenDir(const char *iRodsPath, iFuseDir_t **iFuseDir) {
         // obtain a connection for a file
         // while the file is opened, connection is in-use status.
         if(g_ConnReuse) {
-            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO);
+            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO, iRodsPath);
         } else {
-            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE);
+            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE, iRodsPath);
         }
 
         if (status < 0) {
@@ -1044,7 +1169,7 @@ int iFuseFsMakeDir(const char *iRodsPath, mode_t mode) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsMakeDir: iFuseConnGetAndUse of %s error", iRodsPath);
         return -EIO;
@@ -1084,6 +1209,9 @@ int iFuseFsMakeDir(const char *iRodsPath, mode_t mode) {
         }
     }
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -1113,7 +1241,7 @@ int iFuseFsRemoveDir(const char *iRodsPath) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsRemoveDir: iFuseConnGetAndUse of %s error",
                 iRodsPath);
@@ -1180,6 +1308,9 @@ int iFuseFsRemoveDir(const char *iRodsPath) {
 
     clearKeyVal(&collInp.condInput);
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -1210,7 +1341,7 @@ int iFuseFsRename(const char *iRodsFromPath, const char *iRodsToPath) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsFromPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsRename: iFuseConnGetAndUse of %s to %s error",
                 iRodsFromPath, iRodsToPath);
@@ -1263,6 +1394,9 @@ int iFuseFsRename(const char *iRodsFromPath, const char *iRodsToPath) {
 
     clearKeyVal(&dataObjRenameInp.destDataObjInp.condInput);
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -1300,7 +1434,7 @@ int iFuseFsTruncate(const char *iRodsPath, off_t size) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsTruncate: iFuseConnGetAndUse of %s error",
                 iRodsPath);
@@ -1343,6 +1477,9 @@ int iFuseFsTruncate(const char *iRodsPath, off_t size) {
         }
     }
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -1369,7 +1506,7 @@ int iFuseFsChmod(const char *iRodsPath, mode_t mode) {
 
     // temporarily obtain a connection
     // must be marked unused and release lock after use
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, iRodsPath);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseFsChmod: iFuseConnGetAndUse of %s error",
                 iRodsPath);
@@ -1427,6 +1564,9 @@ int iFuseFsChmod(const char *iRodsPath, mode_t mode) {
 
     clearKeyVal(&regParam);
 
+    // other connections may not see the change yet
+    iFuseConnMarkMutation(iFuseConn);
+
     iFuseConnUnlock(iFuseConn);
     iFuseConnUnuse(iFuseConn);
 
@@ -1502,9 +1642,9 @@ int iFuseFsCacheDir(const char *iRodsPath) {
         // obtain a connection for a file
         // while the file is opened, connection is in-use status.
         if(g_ConnReuse) {
-            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO);
+            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_FILE_IO, iRodsPath);
         } else {
-            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE);
+            status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE, iRodsPath);
         }
 
         if (status < 0) {
@@ -24,6 +24,7 @@
 #include <pthread.h>
 #include <list>
 #include <map>
+#include <string>
 #include "iFuse.Lib.hpp"
 #include "iFuse.Lib.RodsClientAPI.hpp"
 #include "iFuse.Lib.Conn.hpp"
@@ -32,18 +33,35 @@
 static pthread_rwlock_t g_ConnectedConnLock;
 static pthread_rwlockattr_t g_ConnectedConnLockAttr;
 
-static iFuseConn_t* g_InUseShortopConn;
+static iFuseConn_t** g_InUseShortopConn;
 static iFuseConn_t** g_InUseConn;
 static std::map<unsigned long, iFuseConn_t*> g_InUseOnetimeuseConn;
-static iFuseConn_t* g_FreeShortopConn;
+static std::list<iFuseConn_t*> g_FreeShortopConn;
 static std::list<iFuseConn_t*> g_FreeConn;
 
+static pthread_mutex_t g_ConnGenLock;
+static unsigned long g_ConnMutationGen = 0;
+// generation every view must cover, for any path
+static unsigned long g_ConnBaseGen = 0;
+// generation of the last data write to a path and to its parent collection
+static std::map<std::string, unsigned long> g_ConnPathGenMap;
+
+static pthread_mutex_t g_ConnWarmLock;
+static pthread_cond_t g_ConnWarmCond;
+static int g_WarmingConnNum = 0;
+static int g_WarmingShortopConnNum = 0;
+
+static pthread_mutex_t g_KeepAliveLock;
+static std::list<iFuseConn_t*> g_KeepAliveConn;
+
 static pthread_rwlockattr_t g_IDGenLockAttr;
 static pthread_rwlock_t g_IDGenLock;
 
 static unsigned long g_ConnIDGen;
 
 static int g_MaxConnNum = IFUSE_MAX_NUM_CONN;
+static int g_MaxShortopConnNum = IFUSE_MAX_NUM_SHORTOP_CONN;
+static int g_MinConnNum = IFUSE_MIN_NUM_CONN;
 static int g_ConnTimeoutSec = IFUSE_FREE_CONN_TIMEOUT_SEC;
 static int g_ConnKeepAliveSec = IFUSE_FREE_CONN_KEEPALIVE_SEC;
 static int g_ConnCheckIntervalSec = IFUSE_FREE_CONN_CHECK_INTERVAL_SEC;
@@ -51,9 +69,54 @@ static int g_ConnCheckIntervalSec = IFUSE_FREE_CONN_CHECK_INTERVAL_SEC;
 static time_t g_LastConnCheck = 0;
 
 /*
+ * Short operations and file IO use separate pools of connections, each
+ * with a bounded number of slots. A free connection of the pool is used
+ * first, then a new one while a slot is empty. When all slots are in use,
+ * the connection with the fewest users is shared.
+ *
+ * Metadata seen by a connection may be older than changes made through
+ * other connections, e.g., with a MySQL-backed iCAT that keeps a snapshot
+ * per agent. Every change made through a connection increases
+ * g_ConnMutationGen, and viewGen of a connection is the generation its
+ * view is known to cover: when it was set up or it made the change.
+ * Namespace and metadata changes (create, unlink, mkdir, rmdir, rename,
+ * truncate and chmod) raise g_ConnBaseGen that every view must cover.
+ * Data written through a file descriptor raises only the generation of
+ * the path and its parent collection in g_ConnPathGenMap, at flush or
+ * close, so the written file is not seen old but other paths keep using
+ * pooled connections. The map is folded into g_ConnBaseGen when it grows
+ * to IFUSE_CONN_PATH_GEN_MAX_NUM paths.
+ *
+ * A pooled connection is reused for a path only when its view covers
+ * changes made by this mount that may affect the path. A stale one is set
+ * up again if no one else uses it, or a one-time connection is used
+ * instead.
+ *
+ * A new connection is put to its slot in the pool before it is set up,
+ * and the caller connects and logs in after releasing g_ConnectedConnLock.
+ * Others sharing the slot meanwhile wait on connectCond of the connection,
+ * so lookups of other slots are not blocked by connection setup. A
+ * connection failed to set up is removed from its slot and freed by its
+ * last user.
+ *
+ * Connections can also be set up ahead of demand by warmer threads. A
+ * warmer puts a new connection to an empty slot as its only user, sets it
+ * up and releases it to the free list, so callers arriving meanwhile share
+ * and wait for it as above. iFuseConnWarmUp fills each pool up to
+ * g_MinConnNum connections in parallel, and a pool with no free connection
+ * and IFUSE_CONN_GROW_THRESHOLD_PERCENT of its slots busy warms one more.
+ * Idle connections are not closed below g_MinConnNum.
+ *
+ * Idle connections are reaped and others are kept alive by _connChecker
+ * without holding g_ConnectedConnLock during network requests.
+ *
+ * Use counts, checking and slots are guarded by g_ConnectedConnLock.
+ *
  * Lock order :
  * - g_ConnectedConnLock
  * - iFuseConn_t
+ * - connectLock of iFuseConn_t / g_ConnGenLock / g_ConnWarmLock /
+ *   g_KeepAliveLock
  */
 
 static unsigned long _genNextConnID() {
@@ -149,8 +212,52 @@ static void _disconnect(iFuseConn_t *iFuseConn) {
     }
 }
 
-static int _newConn(iFuseConn_t **iFuseConn) {
-    int status = 0;
+/*
+ * Mark a connection being set up to see all changes made through connections
+ */
+static void _setConnFresh(iFuseConn_t *iFuseConn) {
+    assert(iFuseConn != NULL);
+
+    pthread_mutex_lock(&g_ConnGenLock);
+
+    iFuseConn->viewGen = g_ConnMutationGen;
+
+    pthread_mutex_unlock(&g_ConnGenLock);
+}
+
+/*
+ * Check if a connection sees all changes that may affect a path
+ * a connection for no particular path must see all changes
+ */
+static bool _isConnFresh(iFuseConn_t *iFuseConn, const char *iRodsPath) {
+    std::map<std::string, unsigned long>::iterator it_pathgenmap;
+    bool fresh = false;
+
+    assert(iFuseConn != NULL);
+
+    pthread_mutex_lock(&g_ConnGenLock);
+
+    if(iRodsPath == NULL) {
+        fresh = iFuseConn->viewGen >= g_ConnMutationGen;
+    } else {
+        fresh = iFuseConn->viewGen >= g_ConnBaseGen;
+
+        if(fresh) {
+            it_pathgenmap = g_ConnPathGenMap.find(std::string(iRodsPath));
+            if(it_pathgenmap != g_ConnPathGenMap.end()) {
+                fresh = iFuseConn->viewGen >= it_pathgenmap->second;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&g_ConnGenLock);
+    return fresh;
+}
+
+/*
+ * Create a new connection to be set up by _setupConn
+ */
+static int _newConn(iFuseConn_t **iFuseConn, int connType) {
     iFuseConn_t *tmpIFuseConn = NULL;
 
     assert(iFuseConn != NULL);
@@ -162,17 +269,23 @@ static int _newConn(iFuseConn_t **iFuseConn) {
     }
 
     tmpIFuseConn->connId = _genNextConnID();
+    tmpIFuseConn->type = connType;
+    // set up after this
+    _setConnFresh(tmpIFuseConn);
+    tmpIFuseConn->connecting = true;
+    // not to be kept alive before set up
+    tmpIFuseConn->lastActTime = iFuseLibGetCurrentTime();
 
     iFuseLibLog(LOG_DEBUG, "_newConn: creating a new connection - %lu", tmpIFuseConn->connId);
 
+    pthread_mutex_init(&tmpIFuseConn->connectLock, NULL);
+    pthread_cond_init(&tmpIFuseConn->connectCond, NULL);
+
     pthread_rwlockattr_init(&tmpIFuseConn->lockAttr);
     pthread_rwlock_init(&tmpIFuseConn->lock, &tmpIFuseConn->lockAttr);
 
-    // connect
-    status = _connect(tmpIFuseConn);
-    tmpIFuseConn->lastActTime = iFuseLibGetCurrentTime();
     *iFuseConn = tmpIFuseConn;
-    return status;
+    return 0;
 }
 
 static int _freeConn(iFuseConn_t *iFuseConn) {
@@ -186,10 +299,311 @@ static int _freeConn(iFuseConn_t *iFuseConn) {
     pthread_rwlock_destroy(&iFuseConn->lock);
     pthread_rwlockattr_destroy(&iFuseConn->lockAttr);
 
+    pthread_cond_destroy(&iFuseConn->connectCond);
+    pthread_mutex_destroy(&iFuseConn->connectLock);
+
     free(iFuseConn);
     return 0;
 }
 
+/*
+ * Remove a connection from its slot so that no one else gets it
+ * g_ConnectedConnLock must be held
+ */
+static void _removeConnFromSlot(iFuseConn_t *iFuseConn) {
+    std::map<unsigned long, iFuseConn_t*>::iterator it_connmap;
+    int i;
+
+    assert(iFuseConn != NULL);
+
+    if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_SHORTOP) {
+        for(i=0;i<g_MaxShortopConnNum;i++) {
+            if(g_InUseShortopConn[i] == iFuseConn) {
+                g_InUseShortopConn[i] = NULL;
+                break;
+            }
+        }
+    } else if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_FILE_IO) {
+        for(i=0;i<g_MaxConnNum;i++) {
+            if(g_InUseConn[i] == iFuseConn) {
+                g_InUseConn[i] = NULL;
+                break;
+            }
+        }
+    } else if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
+        it_connmap = g_InUseOnetimeuseConn.find(iFuseConn->connId);
+        if(it_connmap != g_InUseOnetimeuseConn.end()) {
+            g_InUseOnetimeuseConn.erase(it_connmap);
+        }
+    }
+}
+
+/*
+ * Connect and log in a new or stale connection without holding
+ * g_ConnectedConnLock and wake up others waiting for it
+ */
+static int _setupConn(iFuseConn_t *iFuseConn) {
+    int status = 0;
+
+    assert(iFuseConn != NULL);
+
+    // a stale connection drops its view
+    _disconnect(iFuseConn);
+
+    status = _connect(iFuseConn);
+    iFuseConn->lastActTime = iFuseLibGetCurrentTime();
+
+    if(status < 0) {
+        // no one else gets it from now
+        pthread_rwlock_wrlock(&g_ConnectedConnLock);
+        _removeConnFromSlot(iFuseConn);
+        pthread_rwlock_unlock(&g_ConnectedConnLock);
+    }
+
+    pthread_mutex_lock(&iFuseConn->connectLock);
+
+    iFuseConn->connectStatus = status;
+    iFuseConn->connecting = false;
+    pthread_cond_broadcast(&iFuseConn->connectCond);
+
+    pthread_mutex_unlock(&iFuseConn->connectLock);
+    return status;
+}
+
+/*
+ * Wait until a connection is set up by another
+ * returns status of the setup
+ */
+static int _waitConn(iFuseConn_t *iFuseConn) {
+    int status = 0;
+
+    assert(iFuseConn != NULL);
+
+    pthread_mutex_lock(&iFuseConn->connectLock);
+
+    while(iFuseConn->connecting) {
+        pthread_cond_wait(&iFuseConn->connectCond, &iFuseConn->connectLock);
+    }
+
+    status = iFuseConn->connectStatus;
+
+    pthread_mutex_unlock(&iFuseConn->connectLock);
+    return status;
+}
+
+/*
+ * Check if a connection is set up
+ */
+static bool _isConnReady(iFuseConn_t *iFuseConn) {
+    bool ready = false;
+
+    assert(iFuseConn != NULL);
+
+    pthread_mutex_lock(&iFuseConn->connectLock);
+
+    ready = !iFuseConn->connecting && iFuseConn->connectStatus == 0;
+
+    pthread_mutex_unlock(&iFuseConn->connectLock);
+    return ready;
+}
+
+/*
+ * Drop a use of a connection failed to set up, the last user frees it
+ */
+static void _unuseFailedConn(iFuseConn_t *iFuseConn) {
+    bool release = false;
+
+    assert(iFuseConn != NULL);
+
+    pthread_rwlock_wrlock(&g_ConnectedConnLock);
+
+    _removeConnFromSlot(iFuseConn);
+
+    iFuseConn->inuseCnt--;
+    assert(iFuseConn->inuseCnt >= 0);
+    release = (iFuseConn->inuseCnt == 0);
+
+    pthread_rwlock_unlock(&g_ConnectedConnLock);
+
+    if(release) {
+        _freeConn(iFuseConn);
+    }
+}
+
+/*
+ * Count connections in slots of a pool
+ * g_ConnectedConnLock must be held
+ */
+static int _countUsedSlots(iFuseConn_t **slots, int slotNum) {
+    int count = 0;
+    int i;
+
+    for(i=0;i<slotNum;i++) {
+        if(slots[i] != NULL) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Get number of connections being warmed for a pool
+ */
+static int _getWarmingConnNum(int connType) {
+    int num = 0;
+
+    pthread_mutex_lock(&g_ConnWarmLock);
+
+    if(connType == IFUSE_CONN_TYPE_FOR_SHORTOP) {
+        num = g_WarmingShortopConnNum;
+    } else {
+        num = g_WarmingConnNum;
+    }
+
+    pthread_mutex_unlock(&g_ConnWarmLock);
+    return num;
+}
+
+/*
+ * Add to number of connections being warmed for a pool
+ */
+static void _addWarmingConnNum(int connType, int delta) {
+    pthread_mutex_lock(&g_ConnWarmLock);
+
+    if(connType == IFUSE_CONN_TYPE_FOR_SHORTOP) {
+        g_WarmingShortopConnNum += delta;
+    } else {
+        g_WarmingConnNum += delta;
+    }
+
+    assert(g_WarmingConnNum >= 0 && g_WarmingShortopConnNum >= 0);
+
+    if(g_WarmingConnNum + g_WarmingShortopConnNum == 0) {
+        pthread_cond_broadcast(&g_ConnWarmCond);
+    }
+
+    pthread_mutex_unlock(&g_ConnWarmLock);
+}
+
+/*
+ * Set up a connection in background and release it to the free list
+ */
+static void *_connWarmer(void *param) {
+    iFuseConn_t *iFuseConn = (iFuseConn_t *)param;
+    int connType;
+    int status = 0;
+
+    assert(iFuseConn != NULL);
+
+    // the connection may be freed by others after release
+    connType = iFuseConn->type;
+
+    status = _setupConn(iFuseConn);
+    if(status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_connWarmer: cannot set up connection %lu, status = %d",
+                iFuseConn->connId, status);
+        _unuseFailedConn(iFuseConn);
+    } else {
+        iFuseLibLog(LOG_DEBUG, "_connWarmer: connection %lu is ready", iFuseConn->connId);
+        iFuseConnUnuse(iFuseConn);
+    }
+
+    _addWarmingConnNum(connType, -1);
+    return NULL;
+}
+
+/*
+ * Start warming a new connection in an empty slot of a pool
+ * returns false if there is no empty slot or it cannot be started
+ * g_ConnectedConnLock must be held
+ */
+static bool _startConnWarmer(iFuseConn_t **slots, int slotNum, int connType) {
+    int status = 0;
+    iFuseConn_t *tmpIFuseConn = NULL;
+    pthread_attr_t threadAttr;
+    pthread_t thread;
+    int targetIndex;
+    int i;
+
+    targetIndex = -1;
+    for(i=0;i<slotNum;i++) {
+        if(slots[i] == NULL) {
+            targetIndex = i;
+            break;
+        }
+    }
+
+    if(targetIndex < 0) {
+        return false;
+    }
+
+    status = _newConn(&tmpIFuseConn, connType);
+    if(status < 0) {
+        return false;
+    }
+
+    // the warmer is the user until set up
+    tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
+    tmpIFuseConn->inuseCnt = 1;
+    slots[targetIndex] = tmpIFuseConn;
+
+    _addWarmingConnNum(connType, 1);
+
+    pthread_attr_init(&threadAttr);
+    pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED);
+
+    if(pthread_create(&thread, &threadAttr, _connWarmer, tmpIFuseConn) != 0) {
+        iFuseLibLog(LOG_ERROR, "_startConnWarmer: cannot start warmer thread for connection %lu", tmpIFuseConn->connId);
+
+        slots[targetIndex] = NULL;
+        _addWarmingConnNum(connType, -1);
+
+        pthread_attr_destroy(&threadAttr);
+        _freeConn(tmpIFuseConn);
+        return false;
+    }
+
+    pthread_attr_destroy(&threadAttr);
+    return true;
+}
+
+/*
+ * Warm connections of a pool up to the given number
+ * g_ConnectedConnLock must be held
+ */
+static void _warmPool(iFuseConn_t **slots, int slotNum, std::list<iFuseConn_t*> *freeConns, int connType, int connNum) {
+    int count;
+
+    count = _countUsedSlots(slots, slotNum) + (int)freeConns->size();
+    while(count < connNum) {
+        if(!_startConnWarmer(slots, slotNum, connType)) {
+            break;
+        }
+        count++;
+    }
+}
+
+/*
+ * Warm one more connection of a pool ahead of demand when most of its
+ * slots are busy and no free connection is left
+ * g_ConnectedConnLock must be held
+ */
+static void _growPool(iFuseConn_t **slots, int slotNum, std::list<iFuseConn_t*> *freeConns, int connType) {
+    int usedSlots;
+
+    if(!freeConns->empty() || _getWarmingConnNum(connType) > 0) {
+        return;
+    }
+
+    usedSlots = _countUsedSlots(slots, slotNum);
+    if(usedSlots >= slotNum || usedSlots * 100 < slotNum * IFUSE_CONN_GROW_THRESHOLD_PERCENT) {
+        return;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "_growPool: %d of %d connections are busy, warming one more", usedSlots, slotNum);
+    _startConnWarmer(slots, slotNum, connType);
+}
+
 static int _freeAllConn() {
     iFuseConn_t *tmpIFuseConn;
     std::map<unsigned long, iFuseConn_t*>::iterator it_connmap;
@@ -205,9 +619,11 @@ static int _freeAllConn() {
         _freeConn(tmpIFuseConn);
     }
 
-    if(g_FreeShortopConn != NULL) {
-        _freeConn(g_FreeShortopConn);
-        g_FreeShortopConn = NULL;
+    while(!g_FreeShortopConn.empty()) {
+        tmpIFuseConn = g_FreeShortopConn.front();
+        g_FreeShortopConn.pop_front();
+
+        _freeConn(tmpIFuseConn);
     }
 
     // disconnect all inuse connections
@@ -219,9 +635,12 @@ static int _freeAllConn() {
         }
     }
 
-    if(g_InUseShortopConn != NULL) {
-        _freeConn(g_InUseShortopConn);
-        g_InUseShortopConn = NULL;
+    for(i=0;i<g_MaxShortopConnNum;i++) {
+        if(g_InUseShortopConn[i] != NULL) {
+            tmpIFuseConn = g_InUseShortopConn[i];
+            g_InUseShortopConn[i] = NULL;
+            _freeConn(tmpIFuseConn);
+        }
     }
 
     while(!g_InUseOnetimeuseConn.empty()) {
@@ -239,6 +658,10 @@ static int _freeAllConn() {
     return 0;
 }
 
+/*
+ * Send a keep-alive request over a connection
+ * skipped if the connection is busy with a request
+ */
 static void _keepAlive(iFuseConn_t *iFuseConn) {
     int status = 0;
     char iRodsPath[MAX_NAME_LEN];
@@ -253,13 +676,16 @@ static void _keepAlive(iFuseConn_t *iFuseConn) {
         return;
     }
 
+    if(pthread_rwlock_trywrlock(&iFuseConn->lock) != 0) {
+        // the request keeps it alive
+        return;
+    }
+
     iFuseLibLog(LOG_DEBUG, "_keepAlive: connection %lu", iFuseConn->connId);
 
     bzero(&dataObjInp, sizeof ( dataObjInp_t));
     rstrcpy(dataObjInp.objPath, iRodsPath, MAX_NAME_LEN);
 
-    pthread_rwlock_wrlock(&iFuseConn->lock);
-
     status = iFuseRodsClientObjStat(iFuseConn->conn, &dataObjInp, &rodsObjStatOut);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "_keepAlive: iFuseRodsClientObjStat of %s error, status = %d",
@@ -278,7 +704,114 @@ static void _keepAlive(iFuseConn_t *iFuseConn) {
     pthread_rwlock_unlock(&iFuseConn->lock);
 }
 
+/*
+ * Take connections from g_KeepAliveConn and keep them alive
+ */
+static void *_keepAliveWorker(void *param) {
+    iFuseConn_t *iFuseConn;
+
+    UNUSED(param);
+
+    while(true) {
+        pthread_mutex_lock(&g_KeepAliveLock);
+
+        if(g_KeepAliveConn.empty()) {
+            pthread_mutex_unlock(&g_KeepAliveLock);
+            break;
+        }
+
+        iFuseConn = g_KeepAliveConn.front();
+        g_KeepAliveConn.pop_front();
+
+        pthread_mutex_unlock(&g_KeepAliveLock);
+
+        _keepAlive(iFuseConn);
+    }
+
+    return NULL;
+}
+
+/*
+ * Keep connections alive in parallel, returns when all are done
+ */
+static void _keepAliveAll(std::list<iFuseConn_t*> *conns) {
+    pthread_t threads[IFUSE_CONN_KEEPALIVE_THREAD_NUM];
+    int threadNum;
+    int i;
+
+    assert(conns != NULL);
+
+    pthread_mutex_lock(&g_KeepAliveLock);
+
+    g_KeepAliveConn.insert(g_KeepAliveConn.end(), conns->begin(), conns->end());
+
+    pthread_mutex_unlock(&g_KeepAliveLock);
+
+    threadNum = 0;
+    for(i=1;i<(int)conns->size() && i<IFUSE_CONN_KEEPALIVE_THREAD_NUM;i++) {
+        if(pthread_create(&threads[threadNum], NULL, _keepAliveWorker, NULL) != 0) {
+            iFuseLibLog(LOG_ERROR, "_keepAliveAll: cannot start keep-alive thread %d", threadNum);
+            break;
+        }
+        threadNum++;
+    }
+
+    // the checker also takes part
+    _keepAliveWorker(NULL);
+
+    for(i=0;i<threadNum;i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/*
+ * Pick ready connections of a list not used for the keep-alive time
+ * g_ConnectedConnLock must be held
+ */
+static void _pickKeepAliveConn(iFuseConn_t *iFuseConn, time_t current, std::list<iFuseConn_t*> *checkList) {
+    if(iFuseConn == NULL || !_isConnReady(iFuseConn)) {
+        return;
+    }
+
+    if(iFuseLibDiffTimeSec(current, iFuseConn->lastActTime) >= g_ConnKeepAliveSec) {
+        checkList->push_back(iFuseConn);
+    }
+}
+
+/*
+ * Move free connections not used for the timeout to removeList, keeping
+ * connNum connections of the pool at least
+ * g_ConnectedConnLock must be held
+ */
+static void _reapFreeConn(std::list<iFuseConn_t*> *freeConns, int connNum, time_t current, std::list<iFuseConn_t*> *removeList) {
+    std::list<iFuseConn_t*>::iterator it_conn;
+    iFuseConn_t *iFuseConn;
+
+    it_conn = freeConns->begin();
+    while(it_conn != freeConns->end() && connNum > g_MinConnNum) {
+        iFuseConn = *it_conn;
+
+        if(iFuseLibDiffTimeSec(current, iFuseConn->lastUseTime) >= g_ConnTimeoutSec) {
+            iFuseLibLog(LOG_DEBUG, "_reapFreeConn: release idle connection %lu", iFuseConn->connId);
+            it_conn = freeConns->erase(it_conn);
+            removeList->push_back(iFuseConn);
+            connNum--;
+        } else {
+            it_conn++;
+        }
+    }
+}
+
+/*
+ * Reap idle connections and keep others alive periodically. Candidates
+ * are picked under g_ConnectedConnLock, but network requests are made
+ * after releasing it so that getting and releasing connections are not
+ * blocked meanwhile. Picked connections are pinned until done: one-time
+ * connections by a use count, pooled connections by checking so that they
+ * are not set up again under the checker.
+ */
 static void _connChecker() {
+    std::list<iFuseConn_t*> checkList;
     std::list<iFuseConn_t*> removeList;
     std::list<iFuseConn_t*>::iterator it_conn;
     std::map<unsigned long, iFuseConn_t*>::iterator it_connmap;
@@ -291,74 +824,76 @@ static void _connChecker() {
     current = iFuseLibGetCurrentTime();
 
     if(iFuseLibDiffTimeSec(current, g_LastConnCheck) > g_ConnCheckIntervalSec) {
-        //iFuseLibLog(LOG_DEBUG, "_connChecker: sending keep-alive requests");
-        pthread_rwlock_rdlock(&g_ConnectedConnLock);
+        pthread_rwlock_wrlock(&g_ConnectedConnLock);
 
-        for(i=0;i<g_MaxConnNum;i++) {
-            if(g_InUseConn[i] != NULL) {
-                if(iFuseLibDiffTimeSec(current, g_InUseConn[i]->lastActTime) >= g_ConnKeepAliveSec) {
-                    _keepAlive(g_InUseConn[i]);
-                }
-            }
-        }
+        // release idle connections first not to keep them alive
+        _reapFreeConn(&g_FreeConn, _countUsedSlots(g_InUseConn, g_MaxConnNum) + (int)g_FreeConn.size(), current, &removeList);
+        _reapFreeConn(&g_FreeShortopConn, _countUsedSlots(g_InUseShortopConn, g_MaxShortopConnNum) + (int)g_FreeShortopConn.size(), current, &removeList);
 
-        if(g_InUseShortopConn != NULL) {
-            if(iFuseLibDiffTimeSec(current, g_InUseShortopConn->lastActTime) >= g_ConnKeepAliveSec) {
-                _keepAlive(g_InUseShortopConn);
-            }
+        for(i=0;i<g_MaxConnNum;i++) {
+            _pickKeepAliveConn(g_InUseConn[i], current, &checkList);
         }
 
-        for(it_connmap=g_InUseOnetimeuseConn.begin();it_connmap!=g_InUseOnetimeuseConn.end();it_connmap++) {
-            iFuseConn = it_connmap->second;
-
-            if(iFuseLibDiffTimeSec(current, iFuseConn->lastActTime) >= g_ConnKeepAliveSec) {
-                _keepAlive(iFuseConn);
-            }
+        for(i=0;i<g_MaxShortopConnNum;i++) {
+            _pickKeepAliveConn(g_InUseShortopConn[i], current, &checkList);
         }
 
         for(it_conn=g_FreeConn.begin();it_conn!=g_FreeConn.end();it_conn++) {
-            iFuseConn = *it_conn;
-
-            if(iFuseLibDiffTimeSec(current, iFuseConn->lastActTime) >= g_ConnKeepAliveSec) {
-                _keepAlive(iFuseConn);
-            }
+            _pickKeepAliveConn(*it_conn, current, &checkList);
         }
 
-        if(g_FreeShortopConn != NULL) {
-            if(iFuseLibDiffTimeSec(current, g_FreeShortopConn->lastActTime) >= g_ConnKeepAliveSec) {
-                _keepAlive(g_FreeShortopConn);
-            }
+        for(it_conn=g_FreeShortopConn.begin();it_conn!=g_FreeShortopConn.end();it_conn++) {
+            _pickKeepAliveConn(*it_conn, current, &checkList);
         }
 
-        pthread_rwlock_unlock(&g_ConnectedConnLock);
+        for(it_connmap=g_InUseOnetimeuseConn.begin();it_connmap!=g_InUseOnetimeuseConn.end();it_connmap++) {
+            _pickKeepAliveConn(it_connmap->second, current, &checkList);
+        }
 
-        pthread_rwlock_wrlock(&g_ConnectedConnLock);
-        // iterate free conn list to check timedout connections
-        for(it_conn=g_FreeConn.begin();it_conn!=g_FreeConn.end();it_conn++) {
+        for(it_conn=checkList.begin();it_conn!=checkList.end();it_conn++) {
             iFuseConn = *it_conn;
 
-            if(iFuseLibDiffTimeSec(current, iFuseConn->lastUseTime) >= g_ConnTimeoutSec) {
-                iFuseLibLog(LOG_DEBUG, "_connChecker: release idle connection %lu", iFuseConn->connId);
-                removeList.push_back(iFuseConn);
+            if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
+                iFuseConn->inuseCnt++;
+            } else {
+                iFuseConn->checking = true;
             }
         }
 
-        // iterate remove list
+        pthread_rwlock_unlock(&g_ConnectedConnLock);
+
+        // no one else has them
         while(!removeList.empty()) {
             iFuseConn = removeList.front();
             removeList.pop_front();
-            g_FreeConn.remove(iFuseConn);
             _freeConn(iFuseConn);
         }
 
-        if(g_FreeShortopConn != NULL) {
-            if(iFuseLibDiffTimeSec(current, g_FreeShortopConn->lastUseTime) >= g_ConnTimeoutSec) {
-                _freeConn(g_FreeShortopConn);
-                g_FreeShortopConn = NULL;
+        if(!checkList.empty()) {
+            //iFuseLibLog(LOG_DEBUG, "_connChecker: sending keep-alive requests");
+            _keepAliveAll(&checkList);
+
+            pthread_rwlock_wrlock(&g_ConnectedConnLock);
+
+            for(it_conn=checkList.begin();it_conn!=checkList.end();it_conn++) {
+                iFuseConn = *it_conn;
+
+                if(iFuseConn->type != IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
+                    iFuseConn->checking = false;
+                }
             }
-        }
 
-        pthread_rwlock_unlock(&g_ConnectedConnLock);
+            pthread_rwlock_unlock(&g_ConnectedConnLock);
+
+            // the last user frees one-time connections
+            for(it_conn=checkList.begin();it_conn!=checkList.end();it_conn++) {
+                iFuseConn = *it_conn;
+
+                if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
+                    iFuseConnUnuse(iFuseConn);
+                }
+            }
+        }
 
         g_LastConnCheck = iFuseLibGetCurrentTime();
     }
@@ -396,7 +931,7 @@ int iFuseConnTest() {
 
     iFuseLibLog(LOG_DEBUG, "iFuseConnTest: make a test connection to iRODS host - %s:%d", opt->host, opt->port);
 
-    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP);
+    status = iFuseConnGetAndUse(&iFuseConn, IFUSE_CONN_TYPE_FOR_SHORTOP, NULL);
     if (status < 0) {
         iFuseLibLogError(LOG_ERROR, status, "iFuseConnTest: iFuseConnGetAndUse error");
         fprintf(stderr, "Cannot establish a connection");
@@ -417,6 +952,14 @@ void iFuseConnInit() {
         g_MaxConnNum = iFuseLibGetOption()->maxConn;
     }
 
+    if(iFuseLibGetOption()->maxShortopConn > 0) {
+        g_MaxShortopConnNum = iFuseLibGetOption()->maxShortopConn;
+    }
+
+    if(iFuseLibGetOption()->minConn > 0) {
+        g_MinConnNum = iFuseLibGetOption()->minConn;
+    }
+
     if(iFuseLibGetOption()->connTimeoutSec > 0) {
         g_ConnTimeoutSec = iFuseLibGetOption()->connTimeoutSec;
     }
@@ -438,8 +981,26 @@ void iFuseConnInit() {
         g_InUseConn[i] = NULL;
     }
 
+    g_InUseShortopConn = (iFuseConn_t**)calloc(g_MaxShortopConnNum, sizeof(iFuseConn_t*));
+
+    for(i=0;i<g_MaxShortopConnNum;i++) {
+        g_InUseShortopConn[i] = NULL;
+    }
+
     g_ConnIDGen = 0;
 
+    pthread_mutex_init(&g_ConnGenLock, NULL);
+    g_ConnMutationGen = 0;
+    g_ConnBaseGen = 0;
+    g_ConnPathGenMap.clear();
+
+    pthread_mutex_init(&g_ConnWarmLock, NULL);
+    pthread_cond_init(&g_ConnWarmCond, NULL);
+
+    pthread_mutex_init(&g_KeepAliveLock, NULL);
+    g_WarmingConnNum = 0;
+    g_WarmingShortopConnNum = 0;
+
     pthread_rwlockattr_init(&g_IDGenLockAttr);
     pthread_rwlock_init(&g_IDGenLock, &g_IDGenLockAttr);
 
@@ -454,15 +1015,49 @@ void iFuseConnDestroy() {
 
     g_ConnIDGen = 0;
 
+    // warmers use connections in slots
+    pthread_mutex_lock(&g_ConnWarmLock);
+    while(g_WarmingConnNum + g_WarmingShortopConnNum > 0) {
+        pthread_cond_wait(&g_ConnWarmCond, &g_ConnWarmLock);
+    }
+    pthread_mutex_unlock(&g_ConnWarmLock);
+
     _freeAllConn();
 
     pthread_rwlock_destroy(&g_ConnectedConnLock);
     pthread_rwlockattr_destroy(&g_ConnectedConnLockAttr);
 
     free(g_InUseConn);
+    free(g_InUseShortopConn);
 
     pthread_rwlock_destroy(&g_IDGenLock);
     pthread_rwlockattr_destroy(&g_IDGenLockAttr);
+
+    g_ConnPathGenMap.clear();
+    pthread_mutex_destroy(&g_ConnGenLock);
+
+    pthread_cond_destroy(&g_ConnWarmCond);
+    pthread_mutex_destroy(&g_ConnWarmLock);
+
+    pthread_mutex_destroy(&g_KeepAliveLock);
+}
+
+/*
+ * Set up g_MinConnNum connections of each pool in parallel in background
+ */
+void iFuseConnWarmUp() {
+    if(g_MinConnNum <= 0) {
+        return;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "iFuseConnWarmUp: warming %d connections for each pool", g_MinConnNum);
+
+    pthread_rwlock_wrlock(&g_ConnectedConnLock);
+
+    _warmPool(g_InUseConn, g_MaxConnNum, &g_FreeConn, IFUSE_CONN_TYPE_FOR_FILE_IO, g_MinConnNum);
+    _warmPool(g_InUseShortopConn, g_MaxShortopConnNum, &g_FreeShortopConn, IFUSE_CONN_TYPE_FOR_SHORTOP, g_MinConnNum);
+
+    pthread_rwlock_unlock(&g_ConnectedConnLock);
 }
 
 /*
@@ -483,9 +1078,11 @@ void iFuseConnReport(iFuseFsConnReport_t *report) {
 
     current = iFuseLibGetCurrentTime();
 
-    if(g_InUseShortopConn != NULL) {
-        iFuseLibLog(LOG_DEBUG, "iFuseConnReport: short-op connection (%lu) is in use, last act = %d sec ago, last use = %d sec ago", g_InUseShortopConn->connId, (int)iFuseLibDiffTimeSec(current, g_InUseShortopConn->lastActTime), (int)iFuseLibDiffTimeSec(current, g_InUseShortopConn->lastUseTime));
-        report->inuseShortOpConn++;
+    for(i=0;i<g_MaxShortopConnNum;i++) {
+        if(g_InUseShortopConn[i] != NULL) {
+            iFuseLibLog(LOG_DEBUG, "iFuseConnReport: short-op connection (%lu) is in use, last act = %d sec ago, last use = %d sec ago", g_InUseShortopConn[i]->connId, (int)iFuseLibDiffTimeSec(current, g_InUseShortopConn[i]->lastActTime), (int)iFuseLibDiffTimeSec(current, g_InUseShortopConn[i]->lastUseTime));
+            report->inuseShortOpConn++;
+        }
     }
 
     for(i=0;i<g_MaxConnNum;i++) {
@@ -502,9 +1099,10 @@ void iFuseConnReport(iFuseFsConnReport_t *report) {
         report->inuseOnetimeuseConn++;
     }
 
-    if(g_FreeShortopConn != NULL) {
-        iFuseLibLog(LOG_DEBUG, "iFuseConnReport: short-op connection (%lu) is free, last act = %d sec ago, last use = %d sec ago", g_FreeShortopConn->connId, (int)iFuseLibDiffTimeSec(current, g_FreeShortopConn->lastActTime), (int)iFuseLibDiffTimeSec(current, g_FreeShortopConn->lastUseTime));
+    for(it_conn=g_FreeShortopConn.begin();it_conn!=g_FreeShortopConn.end();it_conn++) {
+        iFuseConn = *it_conn;
 
+        iFuseLibLog(LOG_DEBUG, "iFuseConnReport: short-op connection (%lu) is free, last act = %d sec ago, last use = %d sec ago", iFuseConn->connId, (int)iFuseLibDiffTimeSec(current, iFuseConn->lastActTime), (int)iFuseLibDiffTimeSec(current, iFuseConn->lastUseTime));
         report->freeShortopConn++;
     }
 
@@ -519,167 +1117,166 @@ void iFuseConnReport(iFuseFsConnReport_t *report) {
 }
 
 /*
- * Get connection and increase reference count
+ * Get a connection from a pool of slots, a new or stale connection is not
+ * set up yet. *iFuseConn is NULL if all slots are shared by others and stale
+ * g_ConnectedConnLock must be held
  */
-int iFuseConnGetAndUse(iFuseConn_t **iFuseConn, int connType) {
-    int status;
-    iFuseConn_t *tmpIFuseConn;
+static int _getPooledConn(iFuseConn_t **slots, int slotNum, std::list<iFuseConn_t*> *freeConns, int connType, const char *iRodsPath, iFuseConn_t **iFuseConn, bool *setup) {
+    int status = 0;
+    iFuseConn_t *tmpIFuseConn = NULL;
+    std::list<iFuseConn_t*>::iterator it_conn;
     int i;
     int targetIndex;
     int inUseCount;
 
+    assert(slots != NULL);
+    assert(freeConns != NULL);
     assert(iFuseConn != NULL);
+    assert(setup != NULL);
 
     *iFuseConn = NULL;
-
-    pthread_rwlock_wrlock(&g_ConnectedConnLock);
-
-    if(connType == IFUSE_CONN_TYPE_FOR_SHORTOP) {
-        if(g_InUseShortopConn != NULL) {
-            pthread_rwlock_wrlock(&g_InUseShortopConn->lock);
-            g_InUseShortopConn->lastUseTime = iFuseLibGetCurrentTime();
-            g_InUseShortopConn->inuseCnt++;
-            pthread_rwlock_unlock(&g_InUseShortopConn->lock);
-
-            *iFuseConn = g_InUseShortopConn;
-            pthread_rwlock_unlock(&g_ConnectedConnLock);
-            return 0;
+    *setup = false;
+
+    // Decide whether creating a new connection or reuse one of existing connections
+    targetIndex = -1;
+    for(i=0;i<slotNum;i++) {
+        if(slots[i] == NULL) {
+            targetIndex = i;
+            break;
         }
+    }
 
-        // not in inuseshortopconn
-        // check free conn
-        if (g_FreeShortopConn != NULL) {
-            // reuse existing connection
-            tmpIFuseConn = g_FreeShortopConn;
-            g_FreeShortopConn = NULL;
-
-            pthread_rwlock_wrlock(&tmpIFuseConn->lock);
-            tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-            tmpIFuseConn->inuseCnt++;
-            pthread_rwlock_unlock(&tmpIFuseConn->lock);
-
-            *iFuseConn = tmpIFuseConn;
-
-            g_InUseShortopConn = tmpIFuseConn;
+    if(targetIndex >= 0) {
+        if (!freeConns->empty()) {
+            // reuse existing connection, fresh one first
+            for(it_conn=freeConns->begin();it_conn!=freeConns->end();it_conn++) {
+                if(_isConnFresh(*it_conn, iRodsPath)) {
+                    tmpIFuseConn = *it_conn;
+                    break;
+                }
+            }
 
-            pthread_rwlock_unlock(&g_ConnectedConnLock);
-            return 0;
-        }
+            if(tmpIFuseConn == NULL) {
+                // no one else uses it, set up again unless being checked
+                for(it_conn=freeConns->begin();it_conn!=freeConns->end();it_conn++) {
+                    if(!(*it_conn)->checking) {
+                        tmpIFuseConn = *it_conn;
+                        break;
+                    }
+                }
 
-        // need to create new
-        status = _newConn(&tmpIFuseConn);
-        if (status < 0) {
-            _freeConn(tmpIFuseConn);
-            pthread_rwlock_unlock(&g_ConnectedConnLock);
-            return status;
-        }
+                if(tmpIFuseConn != NULL) {
+                    iFuseLibLog(LOG_DEBUG, "_getPooledConn: refreshing stale connection %lu", tmpIFuseConn->connId);
 
-        tmpIFuseConn->type = IFUSE_CONN_TYPE_FOR_SHORTOP;
-        tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-        tmpIFuseConn->inuseCnt++;
+                    _setConnFresh(tmpIFuseConn);
 
-        g_InUseShortopConn = tmpIFuseConn;
-        *iFuseConn = tmpIFuseConn;
+                    pthread_mutex_lock(&tmpIFuseConn->connectLock);
+                    tmpIFuseConn->connecting = true;
+                    pthread_mutex_unlock(&tmpIFuseConn->connectLock);
 
-        pthread_rwlock_unlock(&g_ConnectedConnLock);
-        return 0;
-    } else if(connType == IFUSE_CONN_TYPE_FOR_FILE_IO) {
-        // Decide whether creating a new connection or reuse one of existing connections
-        targetIndex = -1;
-        for(i=0;i<g_MaxConnNum;i++) {
-            if(g_InUseConn[i] == NULL) {
-                targetIndex = i;
-                break;
+                    *setup = true;
+                }
             }
         }
 
-        if(targetIndex >= 0) {
-            if (!g_FreeConn.empty()) {
-                // reuse existing connection
-                tmpIFuseConn = g_FreeConn.front();
-                pthread_rwlock_wrlock(&tmpIFuseConn->lock);
-                tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-                tmpIFuseConn->inuseCnt++;
-                pthread_rwlock_unlock(&tmpIFuseConn->lock);
-
-                *iFuseConn = tmpIFuseConn;
+        if(tmpIFuseConn != NULL) {
+            freeConns->erase(it_conn);
+        } else {
+            // create new
+            status = _newConn(&tmpIFuseConn, connType);
+            if (status < 0) {
+                return status;
+            }
 
-                g_InUseConn[targetIndex] = tmpIFuseConn;
-                g_FreeConn.remove(tmpIFuseConn);
+            *setup = true;
+        }
 
-                pthread_rwlock_unlock(&g_ConnectedConnLock);
-                return 0;
-            } else {
-                // create new
-                status = _newConn(&tmpIFuseConn);
-                if (status < 0) {
-                    _freeConn(tmpIFuseConn);
-                    pthread_rwlock_unlock(&g_ConnectedConnLock);
-                    return status;
+        slots[targetIndex] = tmpIFuseConn;
+    } else {
+        // share the least loaded connection, it cannot be set up again
+        // while others use it
+        inUseCount = -1;
+        for(i=0;i<slotNum;i++) {
+            if(slots[i] != NULL && _isConnFresh(slots[i], iRodsPath)) {
+                if(inUseCount < 0 || inUseCount > slots[i]->inuseCnt) {
+                    inUseCount = slots[i]->inuseCnt;
+                    tmpIFuseConn = slots[i];
                 }
+            }
+        }
+    }
 
-                tmpIFuseConn->type = IFUSE_CONN_TYPE_FOR_FILE_IO;
-                tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-                tmpIFuseConn->inuseCnt++;
+    *iFuseConn = tmpIFuseConn;
+    return 0;
+}
 
-                g_InUseConn[targetIndex] = tmpIFuseConn;
-                *iFuseConn = tmpIFuseConn;
+/*
+ * Get connection and increase reference count
+ * the connection sees changes made by this mount that may affect iRodsPath,
+ * or all changes if iRodsPath is NULL
+ */
+int iFuseConnGetAndUse(iFuseConn_t **iFuseConn, int connType, const char *iRodsPath) {
+    int status;
+    iFuseConn_t *tmpIFuseConn = NULL;
+    bool setup = false;
 
-                pthread_rwlock_unlock(&g_ConnectedConnLock);
-                return 0;
-            }
-        } else {
-            // reuse existing connection
-            inUseCount = -1;
-            tmpIFuseConn = NULL;
-            for(i=0;i<g_MaxConnNum;i++) {
-                if(g_InUseConn[i] != NULL) {
-                    if(inUseCount < 0) {
-                        inUseCount = g_InUseConn[i]->inuseCnt;
-                        tmpIFuseConn = g_InUseConn[i];
-                    } else {
-                        if(inUseCount > g_InUseConn[i]->inuseCnt) {
-                            inUseCount = g_InUseConn[i]->inuseCnt;
-                            tmpIFuseConn = g_InUseConn[i];
-                        }
-                    }
-                }
-            }
+    assert(iFuseConn != NULL);
 
-            assert(tmpIFuseConn != NULL);
+    *iFuseConn = NULL;
 
-            pthread_rwlock_wrlock(&tmpIFuseConn->lock);
-            tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-            tmpIFuseConn->inuseCnt++;
-            pthread_rwlock_unlock(&tmpIFuseConn->lock);
+    pthread_rwlock_wrlock(&g_ConnectedConnLock);
 
-            *iFuseConn = tmpIFuseConn;
+    if(connType == IFUSE_CONN_TYPE_FOR_SHORTOP) {
+        status = _getPooledConn(g_InUseShortopConn, g_MaxShortopConnNum, &g_FreeShortopConn, connType, iRodsPath, &tmpIFuseConn, &setup);
+        if (status < 0) {
+            pthread_rwlock_unlock(&g_ConnectedConnLock);
+            return status;
+        }
 
+        _growPool(g_InUseShortopConn, g_MaxShortopConnNum, &g_FreeShortopConn, connType);
+    } else if(connType == IFUSE_CONN_TYPE_FOR_FILE_IO) {
+        status = _getPooledConn(g_InUseConn, g_MaxConnNum, &g_FreeConn, connType, iRodsPath, &tmpIFuseConn, &setup);
+        if (status < 0) {
             pthread_rwlock_unlock(&g_ConnectedConnLock);
-            return 0;
+            return status;
         }
-    } else if(connType == IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
+
+        _growPool(g_InUseConn, g_MaxConnNum, &g_FreeConn, connType);
+    }
+
+    if(connType == IFUSE_CONN_TYPE_FOR_ONETIMEUSE || tmpIFuseConn == NULL) {
         // create new
-        status = _newConn(&tmpIFuseConn);
+        status = _newConn(&tmpIFuseConn, IFUSE_CONN_TYPE_FOR_ONETIMEUSE);
         if (status < 0) {
-            _freeConn(tmpIFuseConn);
             pthread_rwlock_unlock(&g_ConnectedConnLock);
             return status;
         }
 
-        tmpIFuseConn->type = IFUSE_CONN_TYPE_FOR_ONETIMEUSE;
-        tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
-        tmpIFuseConn->inuseCnt++;
-
         g_InUseOnetimeuseConn[tmpIFuseConn->connId] = tmpIFuseConn;
-        *iFuseConn = tmpIFuseConn;
+        setup = true;
+    }
 
-        pthread_rwlock_unlock(&g_ConnectedConnLock);
-        return 0;
+    // use count is guarded by g_ConnectedConnLock, the connection may be
+    // locked by others during a request
+    tmpIFuseConn->lastUseTime = iFuseLibGetCurrentTime();
+    tmpIFuseConn->inuseCnt++;
+
+    pthread_rwlock_unlock(&g_ConnectedConnLock);
+
+    if(setup) {
+        status = _setupConn(tmpIFuseConn);
     } else {
-        assert(0);
+        status = _waitConn(tmpIFuseConn);
+    }
+
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "iFuseConnGetAndUse: cannot set up connection %lu, status = %d",
+                tmpIFuseConn->connId, status);
+        _unuseFailedConn(tmpIFuseConn);
+        return status;
     }
-    assert(0);
+
+    *iFuseConn = tmpIFuseConn;
     return 0;
 }
 
@@ -687,13 +1284,9 @@ int iFuseConnGetAndUse(iFuseConn_t **iFuseConn, int connType) {
  * Decrease reference count
  */
 int iFuseConnUnuse(iFuseConn_t *iFuseConn) {
-    int i;
-    std::map<unsigned long, iFuseConn_t*>::iterator it_connmap;
-
     assert(iFuseConn != NULL);
 
     pthread_rwlock_wrlock(&g_ConnectedConnLock);
-    pthread_rwlock_wrlock(&iFuseConn->lock);
 
     iFuseConn->lastUseTime = iFuseLibGetCurrentTime();
     iFuseConn->inuseCnt--;
@@ -703,36 +1296,22 @@ int iFuseConnUnuse(iFuseConn_t *iFuseConn) {
     if(iFuseConn->inuseCnt == 0) {
         // move to free list
         if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_SHORTOP) {
-            assert(g_InUseShortopConn == iFuseConn);
-            assert(g_FreeShortopConn == NULL);
+            _removeConnFromSlot(iFuseConn);
 
-            g_InUseShortopConn = NULL;
-            g_FreeShortopConn = iFuseConn;
+            g_FreeShortopConn.push_front(iFuseConn);
 
-            pthread_rwlock_unlock(&iFuseConn->lock);
             pthread_rwlock_unlock(&g_ConnectedConnLock);
             return 0;
         } else if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_FILE_IO) {
-            for(i=0;i<g_MaxConnNum;i++) {
-                if(g_InUseConn[i] == iFuseConn) {
-                    g_InUseConn[i] = NULL;
-                    break;
-                }
-            }
+            _removeConnFromSlot(iFuseConn);
 
             g_FreeConn.push_front(iFuseConn);
 
-            pthread_rwlock_unlock(&iFuseConn->lock);
             pthread_rwlock_unlock(&g_ConnectedConnLock);
             return 0;
         } else if(iFuseConn->type == IFUSE_CONN_TYPE_FOR_ONETIMEUSE) {
-            it_connmap = g_InUseOnetimeuseConn.find(iFuseConn->connId);
-            if(it_connmap != g_InUseOnetimeuseConn.end()) {
-                // has it - remove
-                g_InUseOnetimeuseConn.erase(it_connmap);
-            }
+            _removeConnFromSlot(iFuseConn);
 
-            pthread_rwlock_unlock(&iFuseConn->lock);
             pthread_rwlock_unlock(&g_ConnectedConnLock);
 
             _freeConn(iFuseConn);
@@ -742,11 +1321,75 @@ int iFuseConnUnuse(iFuseConn_t *iFuseConn) {
         }
     }
 
-    pthread_rwlock_unlock(&iFuseConn->lock);
     pthread_rwlock_unlock(&g_ConnectedConnLock);
     return 0;
 }
 
+/*
+ * Mark a namespace or metadata change made through a connection,
+ * other connections may not see it
+ */
+void iFuseConnMarkMutation(iFuseConn_t *iFuseConn) {
+    bool viewCurrent = false;
+
+    assert(iFuseConn != NULL);
+
+    pthread_mutex_lock(&g_ConnGenLock);
+
+    // the view covers the change only if it covered all earlier ones
+    viewCurrent = (iFuseConn->viewGen >= g_ConnMutationGen);
+
+    g_ConnMutationGen++;
+    g_ConnBaseGen = g_ConnMutationGen;
+    if(viewCurrent) {
+        iFuseConn->viewGen = g_ConnMutationGen;
+    }
+
+    pthread_mutex_unlock(&g_ConnGenLock);
+}
+
+/*
+ * Mark data written to a path through a connection, other connections
+ * may not see new size and mtime of the path or entries of its parent
+ */
+void iFuseConnMarkPathMutation(iFuseConn_t *iFuseConn, const char *iRodsPath) {
+    char parentPath[MAX_NAME_LEN];
+    char fileName[MAX_NAME_LEN];
+    bool hasParent = false;
+    bool viewCurrent = false;
+
+    assert(iFuseConn != NULL);
+    assert(iRodsPath != NULL);
+
+    if(iFuseLibSplitPath(iRodsPath, parentPath, MAX_NAME_LEN, fileName, MAX_NAME_LEN) == 0) {
+        hasParent = (strlen(parentPath) > 0);
+    }
+
+    pthread_mutex_lock(&g_ConnGenLock);
+
+    viewCurrent = (iFuseConn->viewGen >= g_ConnMutationGen);
+
+    g_ConnMutationGen++;
+
+    if(g_ConnPathGenMap.size() + 2 > IFUSE_CONN_PATH_GEN_MAX_NUM) {
+        // too many paths to track, all views must cover them
+        g_ConnBaseGen = g_ConnMutationGen - 1;
+        g_ConnPathGenMap.clear();
+    }
+
+    g_ConnPathGenMap[std::string(iRodsPath)] = g_ConnMutationGen;
+
+    if(hasParent) {
+        g_ConnPathGenMap[std::string(parentPath)] = g_ConnMutationGen;
+    }
+
+    if(viewCurrent) {
+        iFuseConn->viewGen = g_ConnMutationGen;
+    }
+
+    pthread_mutex_unlock(&g_ConnGenLock);
+}
+
 /*
  * Update last act time
  */
@@ -777,6 +1420,7 @@ int iFuseConnReconnect(iFuseConn_t *iFuseConn) {
     _disconnect(iFuseConn);
 
     iFuseLibLog(LOG_DEBUG, "iFuseConnReconnect: connecting - %lu", iFuseConn->connId);
+    _setConnFresh(iFuseConn);
     status = _connect(iFuseConn);
 
     iFuseConn->lastActTime = iFuseLibGetCurrentTime();
@@ -0,0 +1,631 @@
+/*** Copyright (c), The Regents of the University of California            ***
+ *** For more information please refer to files in the COPYRIGHT directory ***/
+/*
+    Copyright 2020 The Trustees of University of Arizona and CyVerse
+
+    Licensed under the Apache License, Version 2.0 (the "License" );
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <map>
+#include <list>
+#include <string>
+#include <cstring>
+#include "iFuse.Lib.hpp"
+#include "iFuse.Lib.DiskCache.hpp"
+#include "iFuse.Lib.Util.hpp"
+
+/*
+ * Blocks are stored one per file under <dir>/<xx>/<hash of key>.
+ * Each file starts with a header and the full key, which are verified
+ * at read, so hash collisions or partially written files are never served.
+ *
+ * Index of stored blocks is kept in memory and rebuilt from the directory
+ * at mount. Modification time of a block file is its last access time,
+ * so LRU order survives remounts.
+ */
+
+static pthread_rwlockattr_t g_DiskCacheLockAttr;
+static pthread_rwlock_t g_DiskCacheLock;
+
+static std::map<std::string, iFuseDiskCacheEntry_t*> g_DiskCacheMap;
+static std::map<unsigned long, iFuseDiskCacheEntry_t*> g_DiskCacheLRU;
+
+static char *g_DiskCacheDir = NULL;
+static size_t g_DiskCacheLimit = 0;
+static size_t g_DiskCacheUsed = 0;
+static unsigned long g_DiskCacheAccess = 0;
+
+static int _newDiskCacheEntry(iFuseDiskCacheEntry_t **iFuseDiskCacheEntry) {
+    iFuseDiskCacheEntry_t *tmpIFuseDiskCacheEntry = NULL;
+
+    assert(iFuseDiskCacheEntry != NULL);
+
+    tmpIFuseDiskCacheEntry = (iFuseDiskCacheEntry_t *) calloc(1, sizeof ( iFuseDiskCacheEntry_t));
+    if (tmpIFuseDiskCacheEntry == NULL) {
+        *iFuseDiskCacheEntry = NULL;
+        return SYS_MALLOC_ERR;
+    }
+
+    *iFuseDiskCacheEntry = tmpIFuseDiskCacheEntry;
+    return 0;
+}
+
+static int _freeDiskCacheEntry(iFuseDiskCacheEntry_t *iFuseDiskCacheEntry) {
+    assert(iFuseDiskCacheEntry != NULL);
+
+    if(iFuseDiskCacheEntry->name != NULL) {
+        free(iFuseDiskCacheEntry->name);
+        iFuseDiskCacheEntry->name = NULL;
+    }
+
+    iFuseDiskCacheEntry->size = 0;
+    iFuseDiskCacheEntry->lastAccess = 0;
+
+    free(iFuseDiskCacheEntry);
+    return 0;
+}
+
+static std::string _makeKeyString(const iFuseDiskCacheKey_t *key, unsigned int blockID) {
+    char prefix[128];
+
+    snprintf(prefix, sizeof(prefix), "%llu:%lld:%lld:%llu:%u:",
+            (unsigned long long)key->dataId, (long long)key->mtime, (long long)key->fileSize,
+            (unsigned long long)key->blockSize, blockID);
+
+    return std::string(prefix) + key->iRodsPath;
+}
+
+static std::string _makeEntryName(const std::string &keyString) {
+    unsigned long long hash = 14695981039346656037ULL;
+    char name[32];
+    size_t i;
+
+    // fnv-1a
+    for(i=0;i<keyString.length();i++) {
+        hash ^= (unsigned char)keyString[i];
+        hash *= 1099511628211ULL;
+    }
+
+    snprintf(name, sizeof(name), "%02x/%016llx", (unsigned int)(hash % IFUSE_DISK_CACHE_DIR_NUM), hash);
+    return std::string(name);
+}
+
+static std::string _makeFullPath(const std::string &name) {
+    return std::string(g_DiskCacheDir) + "/" + name;
+}
+
+static int _readFully(int fd, char *buf, size_t size) {
+    size_t readSize = 0;
+
+    while(readSize < size) {
+        ssize_t status = read(fd, buf + readSize, size - readSize);
+        if(status < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        } else if(status == 0) {
+            break;
+        }
+
+        readSize += status;
+    }
+
+    return readSize;
+}
+
+static int _writeFully(int fd, const char *buf, size_t size) {
+    size_t writtenSize = 0;
+
+    while(writtenSize < size) {
+        ssize_t status = write(fd, buf + writtenSize, size - writtenSize);
+        if(status < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        writtenSize += status;
+    }
+
+    return writtenSize;
+}
+
+/*
+ * Move an entry to the most recently used position
+ * must be called with g_DiskCacheLock write-locked
+ */
+static void _touchDiskCacheEntry(iFuseDiskCacheEntry_t *iFuseDiskCacheEntry) {
+    g_DiskCacheLRU.erase(iFuseDiskCacheEntry->lastAccess);
+
+    iFuseDiskCacheEntry->lastAccess = ++g_DiskCacheAccess;
+    g_DiskCacheLRU[iFuseDiskCacheEntry->lastAccess] = iFuseDiskCacheEntry;
+}
+
+/*
+ * Add an entry or update its size
+ * must be called with g_DiskCacheLock write-locked
+ */
+static int _putDiskCacheEntry(const std::string &name, size_t size) {
+    int status = 0;
+    std::map<std::string, iFuseDiskCacheEntry_t*>::iterator it_entrymap;
+    iFuseDiskCacheEntry_t *iFuseDiskCacheEntry = NULL;
+
+    it_entrymap = g_DiskCacheMap.find(name);
+    if(it_entrymap != g_DiskCacheMap.end()) {
+        iFuseDiskCacheEntry = it_entrymap->second;
+        g_DiskCacheUsed -= iFuseDiskCacheEntry->size;
+    } else {
+        status = _newDiskCacheEntry(&iFuseDiskCacheEntry);
+        if(status < 0) {
+            return status;
+        }
+
+        iFuseDiskCacheEntry->name = strdup(name.c_str());
+        g_DiskCacheMap[name] = iFuseDiskCacheEntry;
+    }
+
+    iFuseDiskCacheEntry->size = size;
+    g_DiskCacheUsed += size;
+
+    _touchDiskCacheEntry(iFuseDiskCacheEntry);
+    return 0;
+}
+
+/*
+ * Remove an entry from index, returns the entry to be unlinked and freed
+ * must be called with g_DiskCacheLock write-locked
+ */
+static iFuseDiskCacheEntry_t *_removeDiskCacheEntry(const std::string &name) {
+    std::map<std::string, iFuseDiskCacheEntry_t*>::iterator it_entrymap;
+    iFuseDiskCacheEntry_t *iFuseDiskCacheEntry = NULL;
+
+    it_entrymap = g_DiskCacheMap.find(name);
+    if(it_entrymap == g_DiskCacheMap.end()) {
+        return NULL;
+    }
+
+    iFuseDiskCacheEntry = it_entrymap->second;
+
+    g_DiskCacheMap.erase(it_entrymap);
+    g_DiskCacheLRU.erase(iFuseDiskCacheEntry->lastAccess);
+    g_DiskCacheUsed -= iFuseDiskCacheEntry->size;
+
+    return iFuseDiskCacheEntry;
+}
+
+/*
+ * Remove least recently used entries until the cache fits in the limit
+ * must be called with g_DiskCacheLock write-locked, entries are unlinked by the caller
+ */
+static void _evictDiskCacheEntries(std::list<iFuseDiskCacheEntry_t*> *victims) {
+    iFuseDiskCacheEntry_t *iFuseDiskCacheEntry = NULL;
+
+    while(g_DiskCacheUsed > g_DiskCacheLimit && !g_DiskCacheLRU.empty()) {
+        iFuseDiskCacheEntry = g_DiskCacheLRU.begin()->second;
+
+        _removeDiskCacheEntry(std::string(iFuseDiskCacheEntry->name));
+        victims->push_back(iFuseDiskCacheEntry);
+    }
+}
+
+static void _unlinkDiskCacheEntries(std::list<iFuseDiskCacheEntry_t*> *victims) {
+    std::list<iFuseDiskCacheEntry_t*>::iterator it_victimlist;
+
+    for(it_victimlist = victims->begin(); it_victimlist != victims->end(); it_victimlist++) {
+        iFuseLibLog(LOG_DEBUG, "_unlinkDiskCacheEntries: evict %s", (*it_victimlist)->name);
+
+        unlink(_makeFullPath(std::string((*it_victimlist)->name)).c_str());
+        _freeDiskCacheEntry(*it_victimlist);
+    }
+
+    victims->clear();
+}
+
+static void _dropDiskCacheEntry(const std::string &name) {
+    iFuseDiskCacheEntry_t *iFuseDiskCacheEntry = NULL;
+
+    pthread_rwlock_wrlock(&g_DiskCacheLock);
+    iFuseDiskCacheEntry = _removeDiskCacheEntry(name);
+    pthread_rwlock_unlock(&g_DiskCacheLock);
+
+    unlink(_makeFullPath(name).c_str());
+
+    if(iFuseDiskCacheEntry != NULL) {
+        _freeDiskCacheEntry(iFuseDiskCacheEntry);
+    }
+}
+
+/*
+ * Rebuild index from block files left by previous mounts
+ * must be called before other threads access the cache
+ */
+static int _loadDiskCache() {
+    std::multimap<time_t, iFuseDiskCacheEntry_t*> entries;
+    std::multimap<time_t, iFuseDiskCacheEntry_t*>::iterator it_entries;
+    std::list<iFuseDiskCacheEntry_t*> victims;
+    iFuseDiskCacheEntry_t *iFuseDiskCacheEntry = NULL;
+    char subdir[8];
+    int status = 0;
+    int i;
+
+    for(i=0;i<IFUSE_DISK_CACHE_DIR_NUM;i++) {
+        DIR *dir = NULL;
+        struct dirent *dirent = NULL;
+        std::string subdirPath;
+
+        snprintf(subdir, sizeof(subdir), "%02x", i);
+        subdirPath = _makeFullPath(std::string(subdir));
+
+        if(mkdir(subdirPath.c_str(), 0700) < 0 && errno != EEXIST) {
+            status = -errno;
+            iFuseLibLogError(LOG_ERROR, status, "_loadDiskCache: cannot create %s", subdirPath.c_str());
+            return status;
+        }
+
+        dir = opendir(subdirPath.c_str());
+        if(dir == NULL) {
+            status = -errno;
+            iFuseLibLogError(LOG_ERROR, status, "_loadDiskCache: cannot open %s", subdirPath.c_str());
+            return status;
+        }
+
+        while((dirent = readdir(dir)) != NULL) {
+            struct stat stbuf;
+            std::string name;
+
+            if(dirent->d_name[0] == '.') {
+                continue;
+            }
+
+            name = std::string(subdir) + "/" + dirent->d_name;
+
+            if(strchr(dirent->d_name, '.') != NULL) {
+                // incomplete block file
+                unlink(_makeFullPath(name).c_str());
+                continue;
+            }
+
+            if(stat(_makeFullPath(name).c_str(), &stbuf) < 0 || !S_ISREG(stbuf.st_mode)) {
+                continue;
+            }
+
+            status = _newDiskCacheEntry(&iFuseDiskCacheEntry);
+            if(status < 0) {
+                closedir(dir);
+                return status;
+            }
+
+            iFuseDiskCacheEntry->name = strdup(name.c_str());
+            iFuseDiskCacheEntry->size = stbuf.st_size;
+
+            entries.insert(std::pair<time_t, iFuseDiskCacheEntry_t*>(stbuf.st_mtime, iFuseDiskCacheEntry));
+        }
+
+        closedir(dir);
+    }
+
+    // oldest first
+    for(it_entries = entries.begin(); it_entries != entries.end(); it_entries++) {
+        iFuseDiskCacheEntry = it_entries->second;
+
+        g_DiskCacheMap[std::string(iFuseDiskCacheEntry->name)] = iFuseDiskCacheEntry;
+        g_DiskCacheUsed += iFuseDiskCacheEntry->size;
+        _touchDiskCacheEntry(iFuseDiskCacheEntry);
+    }
+
+    // limit may have been lowered
+    _evictDiskCacheEntries(&victims);
+    _unlinkDiskCacheEntries(&victims);
+
+    iFuseLibLog(LOG_DEBUG, "_loadDiskCache: %lld blocks, %lld bytes in %s", (long long)g_DiskCacheMap.size(), (long long)g_DiskCacheUsed, g_DiskCacheDir);
+    return 0;
+}
+
+static void _releaseAllDiskCacheEntries() {
+    std::map<std::string, iFuseDiskCacheEntry_t*>::iterator it_entrymap;
+
+    pthread_rwlock_wrlock(&g_DiskCacheLock);
+
+    for(it_entrymap = g_DiskCacheMap.begin(); it_entrymap != g_DiskCacheMap.end(); it_entrymap++) {
+        _freeDiskCacheEntry(it_entrymap->second);
+    }
+
+    g_DiskCacheMap.clear();
+    g_DiskCacheLRU.clear();
+    g_DiskCacheUsed = 0;
+
+    pthread_rwlock_unlock(&g_DiskCacheLock);
+}
+
+/*
+ * Initialize disk cache manager
+ */
+void iFuseDiskCacheInit() {
+    int status = 0;
+
+    pthread_rwlockattr_init(&g_DiskCacheLockAttr);
+    pthread_rwlock_init(&g_DiskCacheLock, &g_DiskCacheLockAttr);
+
+    g_DiskCacheUsed = 0;
+    g_DiskCacheAccess = 0;
+
+    if(iFuseLibGetOption()->diskCacheDir == NULL || strlen(iFuseLibGetOption()->diskCacheDir) == 0) {
+        // disabled
+        return;
+    }
+
+    g_DiskCacheLimit = (size_t)IFUSE_DISK_CACHE_SIZE_GB * 1024 * 1024 * 1024;
+    if(iFuseLibGetOption()->diskCacheSize > 0) {
+        g_DiskCacheLimit = (size_t)iFuseLibGetOption()->diskCacheSize * 1024 * 1024 * 1024;
+    }
+
+    if(mkdir(iFuseLibGetOption()->diskCacheDir, 0700) < 0 && errno != EEXIST) {
+        iFuseLibLogError(LOG_ERROR, -errno, "iFuseDiskCacheInit: cannot create %s - disk cache is disabled",
+                iFuseLibGetOption()->diskCacheDir);
+        return;
+    }
+
+    g_DiskCacheDir = strdup(iFuseLibGetOption()->diskCacheDir);
+
+    status = _loadDiskCache();
+    if(status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "iFuseDiskCacheInit: cannot load %s - disk cache is disabled", g_DiskCacheDir);
+        _releaseAllDiskCacheEntries();
+
+        free(g_DiskCacheDir);
+        g_DiskCacheDir = NULL;
+    }
+}
+
+/*
+ * Destroy disk cache manager, block files are kept for next mount
+ */
+void iFuseDiskCacheDestroy() {
+    _releaseAllDiskCacheEntries();
+
+    if(g_DiskCacheDir != NULL) {
+        free(g_DiskCacheDir);
+        g_DiskCacheDir = NULL;
+    }
+
+    pthread_rwlock_destroy(&g_DiskCacheLock);
+    pthread_rwlockattr_destroy(&g_DiskCacheLockAttr);
+}
+
+bool iFuseDiskCacheEnabled() {
+    return g_DiskCacheDir != NULL;
+}
+
+/*
+ * Check if a block with the same key is stored, without reading it
+ */
+bool iFuseDiskCacheHas(const iFuseDiskCacheKey_t *key, unsigned int blockID) {
+    std::string name;
+    bool hasEntry = false;
+
+    assert(key != NULL);
+
+    if(!iFuseDiskCacheEnabled()) {
+        return false;
+    }
+
+    name = _makeEntryName(_makeKeyString(key, blockID));
+
+    pthread_rwlock_rdlock(&g_DiskCacheLock);
+    hasEntry = g_DiskCacheMap.find(name) != g_DiskCacheMap.end();
+    pthread_rwlock_unlock(&g_DiskCacheLock);
+
+    return hasEntry;
+}
+
+/*
+ * Read a block stored with the same key
+ * returns size of the block or -ENOENT if not found
+ */
+int iFuseDiskCacheGet(const iFuseDiskCacheKey_t *key, unsigned int blockID, char *buf, size_t size) {
+    int status = 0;
+    int fd = -1;
+    std::map<std::string, iFuseDiskCacheEntry_t*>::iterator it_entrymap;
+    iFuseDiskCacheHeader_t header;
+    std::string keyString;
+    std::string name;
+    char *keyBuf = NULL;
+
+    assert(key != NULL);
+    assert(buf != NULL);
+
+    if(!iFuseDiskCacheEnabled()) {
+        return -ENOENT;
+    }
+
+    keyString = _makeKeyString(key, blockID);
+    name = _makeEntryName(keyString);
+
+    pthread_rwlock_wrlock(&g_DiskCacheLock);
+
+    it_entrymap = g_DiskCacheMap.find(name);
+    if(it_entrymap == g_DiskCacheMap.end()) {
+        pthread_rwlock_unlock(&g_DiskCacheLock);
+        return -ENOENT;
+    }
+
+    _touchDiskCacheEntry(it_entrymap->second);
+
+    pthread_rwlock_unlock(&g_DiskCacheLock);
+
+    fd = open(_makeFullPath(name).c_str(), O_RDONLY);
+    if(fd < 0) {
+        _dropDiskCacheEntry(name);
+        return -ENOENT;
+    }
+
+    status = _readFully(fd, (char*)&header, sizeof(iFuseDiskCacheHeader_t));
+    if(status != sizeof(iFuseDiskCacheHeader_t) || header.magic != IFUSE_DISK_CACHE_MAGIC ||
+        header.keyLen != keyString.length() || header.dataSize > size) {
+        close(fd);
+        _dropDiskCacheEntry(name);
+        return -ENOENT;
+    }
+
+    keyBuf = (char*)calloc(1, header.keyLen);
+    if(keyBuf == NULL) {
+        close(fd);
+        return SYS_MALLOC_ERR;
+    }
+
+    status = _readFully(fd, keyBuf, header.keyLen);
+    if(status != (int)header.keyLen || memcmp(keyBuf, keyString.c_str(), header.keyLen) != 0) {
+        // hash collision - overwritten by the other key on next put
+        free(keyBuf);
+        close(fd);
+        return -ENOENT;
+    }
+
+    free(keyBuf);
+
+    status = _readFully(fd, buf, header.dataSize);
+    if(status != (int)header.dataSize) {
+        close(fd);
+        _dropDiskCacheEntry(name);
+        return -ENOENT;
+    }
+
+    // keep LRU order for next mount
+    futimens(fd, NULL);
+
+    close(fd);
+
+    iFuseLibLog(LOG_DEBUG, "iFuseDiskCacheGet: %s, blockID: %u, size: %lld", key->iRodsPath, blockID, (long long)header.dataSize);
+    return (int)header.dataSize;
+}
+
+/*
+ * Store a block, least recently used blocks are evicted to make room
+ */
+int iFuseDiskCachePut(const iFuseDiskCacheKey_t *key, unsigned int blockID, const char *buf, size_t size) {
+    int status = 0;
+    int fd = -1;
+    iFuseDiskCacheHeader_t header;
+    std::list<iFuseDiskCacheEntry_t*> victims;
+    std::string keyString;
+    std::string name;
+    std::string fullPath;
+    std::string tmpPath;
+    char *tmpPathBuf = NULL;
+    size_t entrySize = 0;
+
+    assert(key != NULL);
+    assert(buf != NULL);
+
+    if(!iFuseDiskCacheEnabled()) {
+        return 0;
+    }
+
+    keyString = _makeKeyString(key, blockID);
+    name = _makeEntryName(keyString);
+    fullPath = _makeFullPath(name);
+
+    entrySize = sizeof(iFuseDiskCacheHeader_t) + keyString.length() + size;
+    if(entrySize > g_DiskCacheLimit) {
+        return 0;
+    }
+
+    // write to a temporary file then rename so readers never see partial data
+    tmpPath = fullPath + ".XXXXXX";
+    tmpPathBuf = strdup(tmpPath.c_str());
+    if(tmpPathBuf == NULL) {
+        return SYS_MALLOC_ERR;
+    }
+
+    fd = mkstemp(tmpPathBuf);
+    if(fd < 0) {
+        status = -errno;
+        iFuseLibLogError(LOG_ERROR, status, "iFuseDiskCachePut: cannot create %s", tmpPathBuf);
+        free(tmpPathBuf);
+        return status;
+    }
+
+    bzero(&header, sizeof(iFuseDiskCacheHeader_t));
+    header.magic = IFUSE_DISK_CACHE_MAGIC;
+    header.keyLen = keyString.length();
+    header.dataSize = size;
+
+    status = _writeFully(fd, (const char*)&header, sizeof(iFuseDiskCacheHeader_t));
+    if(status >= 0) {
+        status = _writeFully(fd, keyString.c_str(), keyString.length());
+    }
+    if(status >= 0 && size > 0) {
+        status = _writeFully(fd, buf, size);
+    }
+
+    close(fd);
+
+    if(status < 0 || rename(tmpPathBuf, fullPath.c_str()) < 0) {
+        if(status >= 0) {
+            status = -errno;
+        }
+        iFuseLibLogError(LOG_ERROR, status, "iFuseDiskCachePut: cannot write %s", fullPath.c_str());
+        unlink(tmpPathBuf);
+        free(tmpPathBuf);
+        return status;
+    }
+
+    free(tmpPathBuf);
+
+    pthread_rwlock_wrlock(&g_DiskCacheLock);
+
+    status = _putDiskCacheEntry(name, entrySize);
+    _evictDiskCacheEntries(&victims);
+
+    pthread_rwlock_unlock(&g_DiskCacheLock);
+
+    _unlinkDiskCacheEntries(&victims);
+
+    if(status < 0) {
+        unlink(fullPath.c_str());
+        return status;
+    }
+
+    iFuseLibLog(LOG_DEBUG, "iFuseDiskCachePut: %s, blockID: %u, size: %lld", key->iRodsPath, blockID, (long long)size);
+    return 0;
+}
+
+/*
+ * Remove a block stored with the key, used when the content is modified locally
+ */
+int iFuseDiskCacheRemove(const iFuseDiskCacheKey_t *key, unsigned int blockID) {
+    std::string name;
+
+    assert(key != NULL);
+
+    if(!iFuseDiskCacheEnabled()) {
+        return 0;
+    }
+
+    name = _makeEntryName(_makeKeyString(key, blockID));
+
+    _dropDiskCacheEntry(name);
+    return 0;
+}
@@ -112,6 +112,11 @@ static int _closeFd(iFuseFd_t *iFuseFd) {
             }
         }
 
+        if(iFuseFd->written) {
+            // other connections may not see the data written yet
+            iFuseConnMarkPathMutation(iFuseConn, iFuseFd->iRodsPath);
+        }
+
         iFuseConnUnlock(iFuseConn);
     }
 
@@ -119,6 +124,7 @@ static int _closeFd(iFuseFd_t *iFuseFd) {
     iFuseFd->fd = 0;
     iFuseFd->openFlag = 0;
     iFuseFd->lastFilePointer = -1;
+    iFuseFd->written = false;
 
     pthread_rwlock_unlock(&iFuseFd->lock);
     return status;
@@ -293,20 +299,16 @@ void iFuseFdDestroy() {
 }
 
 /*
- * Open a new file descriptor
+ * Open a data object on the connection
+ * returns iRODS file descriptor
  */
-int iFuseFdOpen(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, const char* iRodsPath, int openFlag) {
-    int status = 0;
+static int _openDataObj(iFuseConn_t *iFuseConn, const char* iRodsPath, int openFlag) {
     dataObjInp_t dataObjOpenInp;
     int fd;
-    iFuseFd_t *tmpIFuseDesc;
 
-    assert(iFuseFd != NULL);
     assert(iFuseConn != NULL);
     assert(iRodsPath != NULL);
 
-    *iFuseFd = NULL;
-
     iFuseConnLock(iFuseConn);
 
     bzero(&dataObjOpenInp, sizeof ( dataObjInp_t));
@@ -343,6 +345,14 @@ int iFuseFdOpen(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, const char* iRodsPa
     }
 
     iFuseConnUnlock(iFuseConn);
+    return fd;
+}
+
+static int _newFd(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, int fd, const char* iRodsPath, int openFlag) {
+    iFuseFd_t *tmpIFuseDesc;
+
+    assert(iFuseFd != NULL);
+    assert(iRodsPath != NULL);
 
     tmpIFuseDesc = (iFuseFd_t *) calloc(1, sizeof ( iFuseFd_t));
     if (tmpIFuseDesc == NULL) {
@@ -367,6 +377,81 @@ int iFuseFdOpen(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, const char* iRodsPa
     g_AssignedFd.push_back(tmpIFuseDesc);
 
     pthread_rwlock_unlock(&g_AssignedFdLock);
+    return 0;
+}
+
+/*
+ * Open a new file descriptor
+ */
+int iFuseFdOpen(iFuseFd_t **iFuseFd, iFuseConn_t *iFuseConn, const char* iRodsPath, int openFlag) {
+    int fd;
+
+    assert(iFuseFd != NULL);
+    assert(iFuseConn != NULL);
+    assert(iRodsPath != NULL);
+
+    *iFuseFd = NULL;
+
+    fd = _openDataObj(iFuseConn, iRodsPath, openFlag);
+    if (fd < 0) {
+        return fd;
+    }
+
+    return _newFd(iFuseFd, iFuseConn, fd, iRodsPath, openFlag);
+}
+
+/*
+ * Open the data object of a detached file descriptor on the connection
+ * returns 1 if the descriptor is already attached, the connection is not taken
+ */
+int iFuseFdAttach(iFuseFd_t *iFuseFd, iFuseConn_t *iFuseConn) {
+    int fd;
+
+    assert(iFuseFd != NULL);
+    assert(iFuseConn != NULL);
+
+    pthread_rwlock_wrlock(&iFuseFd->lock);
+
+    if(iFuseFd->fd > 0) {
+        // attached by others
+        pthread_rwlock_unlock(&iFuseFd->lock);
+        return 1;
+    }
+
+    fd = _openDataObj(iFuseConn, iFuseFd->iRodsPath, iFuseFd->openFlag);
+    if (fd < 0) {
+        pthread_rwlock_unlock(&iFuseFd->lock);
+        return fd;
+    }
+
+    iFuseFd->conn = iFuseConn;
+    iFuseFd->fd = fd;
+    iFuseFd->lastFilePointer = -1;
+
+    pthread_rwlock_unlock(&iFuseFd->lock);
+    return 0;
+}
+
+/*
+ * Close the data object of a file descriptor but keep the descriptor
+ * the connection used is returned to be released
+ */
+int iFuseFdDetach(iFuseFd_t *iFuseFd, iFuseConn_t **iFuseConn) {
+    int status = 0;
+    int openFlag;
+
+    assert(iFuseFd != NULL);
+    assert(iFuseConn != NULL);
+
+    *iFuseConn = iFuseFd->conn;
+    openFlag = iFuseFd->openFlag;
+
+    status = _closeFd(iFuseFd);
+
+    pthread_rwlock_wrlock(&iFuseFd->lock);
+    iFuseFd->openFlag = openFlag;
+    pthread_rwlock_unlock(&iFuseFd->lock);
+
     return status;
 }
 
@@ -413,6 +498,12 @@ int iFuseFdReopen(iFuseFd_t *iFuseFd) {
         }
     }
 
+    if(iFuseFd->written) {
+        // other connections may not see the data written yet
+        iFuseConnMarkPathMutation(iFuseConn, iFuseFd->iRodsPath);
+        iFuseFd->written = false;
+    }
+
     if(status < 0) {
         iFuseConnUnlock(iFuseConn);
         pthread_rwlock_unlock(&iFuseFd->lock);
@@ -598,8 +689,6 @@ int iFuseFdClose(iFuseFd_t *iFuseFd) {
     int status = 0;
 
     assert(iFuseFd != NULL);
-    assert(iFuseFd->conn != NULL);
-    assert(iFuseFd->fd > 0);
 
     pthread_rwlock_wrlock(&g_AssignedFdLock);
 
@@ -0,0 +1,238 @@
+/*** Copyright (c), The Regents of the University of California            ***
+ *** For more information please refer to files in the COPYRIGHT directory ***/
+/*
+    Copyright 2020 The Trustees of University of Arizona and CyVerse
+
+    Licensed under the Apache License, Version 2.0 (the "License" );
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include "iFuse.Lib.hpp"
+#include "iFuse.Lib.Conn.hpp"
+#include "iFuse.Lib.IOSched.hpp"
+#include "iFuse.Lib.Util.hpp"
+
+/*
+ * Data requests to iRODS are given a priority by the calling thread.
+ * Threads are foreground by default, so demand reads and writes from
+ * FUSE callers and flushes they wait for go first. Preload and flusher
+ * threads mark themselves background. Demand reads of sequential streams
+ * fetch ahead of their requests and run as stream requests in between.
+ *
+ * At most g_IOSlotNum requests are in flight, as many as connections
+ * for file IO, since more would only wait for a connection in turn.
+ * When all slots are busy, waiting requests are started in priority
+ * order. A background request that waited IFUSE_IO_SCHED_MAX_DEFER_MSEC
+ * no longer yields to others, so write-behind still makes progress.
+ */
+
+static pthread_mutex_t g_IOSchedLock;
+static pthread_cond_t g_IOSchedCond;
+static pthread_key_t g_IOSchedPriorityKey;
+
+static int g_IOSlotNum = IFUSE_MAX_NUM_CONN;
+static int g_RunningIONum = 0;
+static int g_RunningForegroundIONum = 0;
+static int g_WaitingIONum[IFUSE_IO_PRIORITY_NUM];
+
+static void _getDeadline(struct timespec *deadline, int timeoutMsec) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += timeoutMsec / 1000;
+    deadline->tv_nsec += (long)(timeoutMsec % 1000) * 1000000;
+    if(deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+/*
+ * Check if a request of the priority can start now
+ * g_IOSchedLock must be held
+ */
+static bool _canStart(int priority, bool aged) {
+    int i;
+
+    if(g_RunningIONum >= g_IOSlotNum) {
+        return false;
+    }
+
+    if(aged) {
+        return true;
+    }
+
+    for(i=0;i<priority;i++) {
+        if(g_WaitingIONum[i] > 0) {
+            // yield to higher priority
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Initialize IO scheduler
+ */
+void iFuseIOSchedInit() {
+    pthread_condattr_t condAttr;
+    int i;
+
+    if(iFuseLibGetOption()->maxConn > 0) {
+        g_IOSlotNum = iFuseLibGetOption()->maxConn;
+    }
+
+    pthread_mutex_init(&g_IOSchedLock, NULL);
+
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_IOSchedCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    pthread_key_create(&g_IOSchedPriorityKey, NULL);
+
+    g_RunningIONum = 0;
+    g_RunningForegroundIONum = 0;
+    for(i=0;i<IFUSE_IO_PRIORITY_NUM;i++) {
+        g_WaitingIONum[i] = 0;
+    }
+}
+
+/*
+ * Destroy IO scheduler
+ */
+void iFuseIOSchedDestroy() {
+    pthread_key_delete(g_IOSchedPriorityKey);
+
+    pthread_cond_destroy(&g_IOSchedCond);
+    pthread_mutex_destroy(&g_IOSchedLock);
+}
+
+/*
+ * Set priority of requests made by the calling thread
+ */
+void iFuseIOSchedSetPriority(int priority) {
+    assert(priority >= 0 && priority < IFUSE_IO_PRIORITY_NUM);
+
+    pthread_setspecific(g_IOSchedPriorityKey, (void*)(intptr_t)priority);
+}
+
+/*
+ * Get priority of requests made by the calling thread
+ */
+int iFuseIOSchedGetPriority() {
+    return (int)(intptr_t)pthread_getspecific(g_IOSchedPriorityKey);
+}
+
+/*
+ * Check if foreground requests are running or waiting
+ */
+bool iFuseIOSchedHasForeground() {
+    bool busy = false;
+
+    pthread_mutex_lock(&g_IOSchedLock);
+
+    busy = g_RunningForegroundIONum > 0 || g_WaitingIONum[IFUSE_IO_PRIORITY_FOREGROUND] > 0;
+
+    pthread_mutex_unlock(&g_IOSchedLock);
+    return busy;
+}
+
+/*
+ * Wait until a background request can start without waiting
+ * returns false if still busy after timeoutMsec
+ */
+bool iFuseIOSchedWaitBackground(int timeoutMsec) {
+    struct timespec deadline;
+    bool ready = true;
+
+    pthread_mutex_lock(&g_IOSchedLock);
+
+    _getDeadline(&deadline, timeoutMsec);
+
+    while(!_canStart(IFUSE_IO_PRIORITY_BACKGROUND, false)) {
+        if(pthread_cond_timedwait(&g_IOSchedCond, &g_IOSchedLock, &deadline) == ETIMEDOUT) {
+            ready = _canStart(IFUSE_IO_PRIORITY_BACKGROUND, false);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_IOSchedLock);
+    return ready;
+}
+
+/*
+ * Start a data request, waits for a slot in priority order
+ */
+void iFuseIOSchedBegin() {
+    int priority = iFuseIOSchedGetPriority();
+    struct timespec deadline;
+    bool aged = false;
+
+    pthread_mutex_lock(&g_IOSchedLock);
+
+    if(!_canStart(priority, false)) {
+        g_WaitingIONum[priority]++;
+
+        _getDeadline(&deadline, IFUSE_IO_SCHED_MAX_DEFER_MSEC);
+
+        while(!_canStart(priority, aged)) {
+            if(priority == IFUSE_IO_PRIORITY_BACKGROUND && !aged) {
+                if(pthread_cond_timedwait(&g_IOSchedCond, &g_IOSchedLock, &deadline) == ETIMEDOUT) {
+                    iFuseLibLog(LOG_DEBUG, "iFuseIOSchedBegin: background request is deferred for %d msec", IFUSE_IO_SCHED_MAX_DEFER_MSEC);
+                    aged = true;
+                }
+            } else {
+                pthread_cond_wait(&g_IOSchedCond, &g_IOSchedLock);
+            }
+        }
+
+        g_WaitingIONum[priority]--;
+
+        // lower priority requests may start with remaining slots
+        pthread_cond_broadcast(&g_IOSchedCond);
+    }
+
+    g_RunningIONum++;
+    if(priority == IFUSE_IO_PRIORITY_FOREGROUND) {
+        g_RunningForegroundIONum++;
+    }
+
+    pthread_mutex_unlock(&g_IOSchedLock);
+}
+
+/*
+ * Finish a data request
+ */
+void iFuseIOSchedEnd() {
+    int priority = iFuseIOSchedGetPriority();
+
+    pthread_mutex_lock(&g_IOSchedLock);
+
+    assert(g_RunningIONum > 0);
+
+    g_RunningIONum--;
+    if(priority == IFUSE_IO_PRIORITY_FOREGROUND) {
+        assert(g_RunningForegroundIONum > 0);
+        g_RunningForegroundIONum--;
+    }
+    pthread_cond_broadcast(&g_IOSchedCond);
+
+    pthread_mutex_unlock(&g_IOSchedLock);
+}
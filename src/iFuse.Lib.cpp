@@ -29,6 +29,8 @@
 #include "iFuse.Lib.Conn.hpp"
 #include "iFuse.Lib.Fd.hpp"
 #include "iFuse.Lib.MetadataCache.hpp"
+#include "iFuse.Lib.DiskCache.hpp"
+#include "iFuse.Lib.IOSched.hpp"
 #include "iFuse.Lib.Util.hpp"
 #include "rodsClient.h"
 
@@ -102,13 +104,17 @@ void iFuseLibInit() {
     iFuseConnInit();
 
     iFuseFdInit();
+    iFuseIOSchedInit();
 
     iFuseMetadataCacheInit();
+    iFuseDiskCacheInit();
 }
 
 void iFuseLibDestroy() {
+    iFuseDiskCacheDestroy();
     iFuseMetadataCacheDestroy();
 
+    iFuseIOSchedDestroy();
     iFuseFdDestroy();
 
     iFuseConnDestroy();
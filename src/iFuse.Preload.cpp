@@ -18,38 +18,103 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <errno.h>
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
 #include <map>
+#include <set>
+#include <string>
 #include <cstring>
 #include "iFuse.FS.hpp"
 #include "iFuse.Lib.hpp"
 #include "iFuse.Lib.Fd.hpp"
+#include "iFuse.Lib.IOSched.hpp"
 #include "iFuse.Preload.hpp"
 #include "iFuse.BufferedFS.hpp"
 #include "iFuse.Lib.Util.hpp"
 #include "iFuse.Lib.RodsClientAPI.hpp"
 #include "miscUtil.h"
 
-static pthread_rwlockattr_t g_PreloadLockAttr;
-static pthread_rwlock_t g_PreloadLock;
+static pthread_mutex_t g_PreloadLock;
 
 static std::map<unsigned long, iFusePreload_t*> g_PreloadMap;
 
+static pthread_mutex_t g_PreloadHandleLock;
+static std::map<std::string, iFusePreloadHandles_t*> g_PreloadHandleMap;
+// idle handles of all paths, oldest first
+static std::list<iFuseFd_t*> g_PreloadIdleHandles;
+
 static int g_preloadNumThreads = IFUSE_PRELOAD_THREAD_NUM;
+// maximum readahead window in blocks
 static int g_preloadNumBlocks = IFUSE_PRELOAD_PBLOCK_NUM;
+// budget of preloaded blocks not read yet and of blocks being preloaded
+static int g_preloadMemBlocks = IFUSE_PRELOAD_MEM_SIZE / IFUSE_BUFFER_CACHE_BLOCK_SIZE;
+static int g_preloadInflightBlocks = IFUSE_PRELOAD_INFLIGHT_SIZE / IFUSE_BUFFER_CACHE_BLOCK_SIZE;
 
-//TODO: Need to implement preloading... - g_preloadNumThreads
-// use a thread pool to enforce a max num. of connections
-// make a active/idle queue for threads
-// make a incomplete/complete queue for blocks
-//
-static int _newPreloadPBlock(const char *iRodsPath, iFusePreloadPBlock_t **iFusePreloadPBlock) {
+/*
+ * Preload tasks are run by a fixed number of worker threads
+ * (g_preloadNumThreads) shared by all files, which also bounds the
+ * number of connections used for preloading.
+ *
+ * Status of pblocks and budget accounting are guarded by g_PreloadTaskLock.
+ * A pblock is queued with IFUSE_PRELOAD_PBLOCK_STATUS_INIT and
+ * g_PreloadTaskDoneCond is signalled when its task finishes. Queued tasks that are no longer
+ * needed are cancelled. Running tasks are abandoned instead of waited, so
+ * a seek does not wait for speculative transfers. The worker frees an
+ * abandoned pblock when its read returns, and a running task pins its
+ * preload until then. Workers take a task
+ * when the IO scheduler has a slot not wanted by demand requests, or after
+ * IFUSE_IO_SCHED_MAX_DEFER_MSEC.
+ *
+ * Readahead window of a file descriptor is zero until a read moves to the
+ * next block, or the first block of reads moves by the same stride twice
+ * (e.g. tiled layouts or backward scans). It then starts at
+ * IFUSE_PRELOAD_WINDOW_INIT_PBLOCK_NUM steps along the pattern and doubles
+ * on every matching read, up to g_preloadNumBlocks blocks. Other reads
+ * collapse it to zero and cancel queued tasks out of the pattern.
+ *
+ * Blocks are preloaded within a global budget shared by all files.
+ * Queued and running blocks count as in flight, completed blocks as
+ * resident until reads move past them. Streams (preloads with a window)
+ * get an equal share of g_preloadMemBlocks, and at least
+ * IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM blocks while the budget has room.
+ * Targets out of the budget are retried on next reads, nearest first.
+ *
+ * Workers read blocks with read-only handles shared by all preloads of
+ * the same path. Idle handles are kept in g_PreloadHandleMap and reused
+ * across blocks and file opens, until the last preload of the path is closed.
+ * Each idle handle holds a connection and an open file on iRODS, so at most
+ * g_preloadNumThreads handles are kept idle across all paths, and the
+ * oldest one is closed first.
+ *
+ * Preloads in g_PreloadMap are reference counted. The map holds one
+ * reference, and readers pin a preload with another while they wait for
+ * tasks or read blocks. g_PreloadLock only guards the map and reference
+ * counts and is never held across I/O. A preload removed from the map at
+ * close is freed when the last reader puts it.
+ *
+ * Lock order :
+ * - iFusePreload_t
+ * - g_PreloadTaskLock / g_PreloadHandleLock
+ * - g_PreloadLock
+ */
+static pthread_mutex_t g_PreloadTaskLock;
+static pthread_cond_t g_PreloadTaskCond;
+static pthread_cond_t g_PreloadTaskDoneCond;
+static std::list<iFusePreloadPBlock_t*> g_PreloadTasks;
+static pthread_t *g_PreloadThreads = NULL;
+static int g_PreloadThreadNum = 0;
+static bool g_PreloadRunning = false;
+static unsigned int g_PreloadInflightBlockNum = 0;
+static unsigned int g_PreloadResidentBlockNum = 0;
+static unsigned int g_PreloadStreamNum = 0;
+
+static int _newPreloadPBlock(iFusePreload_t *iFusePreload, iFusePreloadPBlock_t **iFusePreloadPBlock) {
     iFusePreloadPBlock_t *tmpIFusePreloadPBlock = NULL;
 
-    assert(iRodsPath != NULL);
+    assert(iFusePreload != NULL);
     assert(iFusePreloadPBlock != NULL);
 
     tmpIFusePreloadPBlock = (iFusePreloadPBlock_t *) calloc(1, sizeof ( iFusePreloadPBlock_t));
@@ -58,12 +123,9 @@ static int _newPreloadPBlock(const char *iRodsPath, iFusePreloadPBlock_t **iFuse
         return SYS_MALLOC_ERR;
     }
 
-    tmpIFusePreloadPBlock->fd = NULL;
+    tmpIFusePreloadPBlock->preload = iFusePreload;
     tmpIFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_INIT;
 
-    pthread_rwlockattr_init(&tmpIFusePreloadPBlock->lockAttr);
-    pthread_rwlock_init(&tmpIFusePreloadPBlock->lock, &tmpIFusePreloadPBlock->lockAttr);
-
     *iFusePreloadPBlock = tmpIFusePreloadPBlock;
     return 0;
 }
@@ -94,38 +156,263 @@ static int _newPreload(iFusePreload_t **iFusePreload) {
     return 0;
 }
 
-static int _freePreloadPBlock(iFusePreloadPBlock_t *iFusePreloadPBlock) {
-    assert(iFusePreloadPBlock != NULL);
+/*
+ * Get read handles of a path shared by preloads
+ */
+static iFusePreloadHandles_t *_acquirePreloadHandles(const char *iRodsPath) {
+    std::map<std::string, iFusePreloadHandles_t*>::iterator it_handlemap;
+    iFusePreloadHandles_t *iFusePreloadHandles = NULL;
+    std::string pathkey(iRodsPath);
+
+    assert(iRodsPath != NULL);
+
+    pthread_mutex_lock(&g_PreloadHandleLock);
 
-    if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING ||
-            iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_INIT ||
-            iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED ||
-            iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED) {
-        if(!iFusePreloadPBlock->threadJoined) {
-            pthread_join(iFusePreloadPBlock->thread, NULL);
+    it_handlemap = g_PreloadHandleMap.find(pathkey);
+    if(it_handlemap != g_PreloadHandleMap.end()) {
+        iFusePreloadHandles = it_handlemap->second;
+    } else {
+        iFusePreloadHandles = (iFusePreloadHandles_t *) calloc(1, sizeof ( iFusePreloadHandles_t));
+        if (iFusePreloadHandles == NULL) {
+            pthread_mutex_unlock(&g_PreloadHandleLock);
+            return NULL;
+        }
 
-            pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
+        iFusePreloadHandles->iRodsPath = strdup(iRodsPath);
+        // we must use new keyword instead of calloc since it contains c++ stl list object
+        iFusePreloadHandles->fds = new std::list<iFuseFd_t*>();
+
+        g_PreloadHandleMap[pathkey] = iFusePreloadHandles;
+    }
 
-            // set to joined
-            iFusePreloadPBlock->threadJoined = true;
+    iFusePreloadHandles->refCount++;
 
-            pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
+    pthread_mutex_unlock(&g_PreloadHandleLock);
+    return iFusePreloadHandles;
+}
+
+/*
+ * Release read handles of a path, idle handles are closed by the last user
+ */
+static void _releasePreloadHandles(iFusePreloadHandles_t *iFusePreloadHandles) {
+    std::list<iFuseFd_t*>::iterator it_fdlist;
+    std::list<iFuseFd_t*> closeList;
+    bool unused = false;
+
+    assert(iFusePreloadHandles != NULL);
+
+    pthread_mutex_lock(&g_PreloadHandleLock);
+
+    iFusePreloadHandles->refCount--;
+    if(iFusePreloadHandles->refCount == 0) {
+        g_PreloadHandleMap.erase(std::string(iFusePreloadHandles->iRodsPath));
+        closeList.swap(*iFusePreloadHandles->fds);
+
+        for(it_fdlist = closeList.begin(); it_fdlist != closeList.end(); it_fdlist++) {
+            g_PreloadIdleHandles.remove(*it_fdlist);
         }
+
+        unused = true;
+    }
+
+    pthread_mutex_unlock(&g_PreloadHandleLock);
+
+    if(!unused) {
+        return;
+    }
+
+    while(!closeList.empty()) {
+        iFuseBufferedFsClose(closeList.front());
+        closeList.pop_front();
+    }
+
+    delete iFusePreloadHandles->fds;
+    free(iFusePreloadHandles->iRodsPath);
+    free(iFusePreloadHandles);
+}
+
+/*
+ * Take an idle read handle or open a new one
+ */
+static int _getPreloadHandle(iFusePreloadHandles_t *iFusePreloadHandles, iFuseFd_t **iFuseFd) {
+    int status = 0;
+
+    assert(iFusePreloadHandles != NULL);
+    assert(iFuseFd != NULL);
+
+    *iFuseFd = NULL;
+
+    pthread_mutex_lock(&g_PreloadHandleLock);
+
+    if(!iFusePreloadHandles->fds->empty()) {
+        *iFuseFd = iFusePreloadHandles->fds->front();
+        iFusePreloadHandles->fds->pop_front();
+
+        g_PreloadIdleHandles.remove(*iFuseFd);
+    }
+
+    pthread_mutex_unlock(&g_PreloadHandleLock);
+
+    if(*iFuseFd != NULL) {
+        return 0;
+    }
+
+    status = iFuseBufferedFsOpen(iFusePreloadHandles->iRodsPath, iFuseFd, O_RDONLY);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_getPreloadHandle: iFuseBufferedFsOpen of %s error, status = %d",
+                iFusePreloadHandles->iRodsPath, status);
+        *iFuseFd = NULL;
+        return status;
+    }
+
+    return 0;
+}
+
+/*
+ * Return a read handle to be reused
+ * the oldest idle handle of any path is closed if too many are idle
+ */
+static void _putPreloadHandle(iFusePreloadHandles_t *iFusePreloadHandles, iFuseFd_t *iFuseFd) {
+    std::map<std::string, iFusePreloadHandles_t*>::iterator it_handlemap;
+    iFuseFd_t *closeFd = NULL;
+
+    assert(iFusePreloadHandles != NULL);
+    assert(iFuseFd != NULL);
+
+    pthread_mutex_lock(&g_PreloadHandleLock);
+
+    iFusePreloadHandles->fds->push_back(iFuseFd);
+    g_PreloadIdleHandles.push_back(iFuseFd);
+
+    if(g_PreloadIdleHandles.size() > (size_t)g_preloadNumThreads) {
+        closeFd = g_PreloadIdleHandles.front();
+        g_PreloadIdleHandles.pop_front();
+
+        it_handlemap = g_PreloadHandleMap.find(std::string(closeFd->iRodsPath));
+        assert(it_handlemap != g_PreloadHandleMap.end());
+
+        it_handlemap->second->fds->remove(closeFd);
+    }
+
+    pthread_mutex_unlock(&g_PreloadHandleLock);
+
+    if(closeFd != NULL) {
+        iFuseBufferedFsClose(closeFd);
+    }
+}
+
+/*
+ * Add or remove a pblock in budget accounting by its status
+ * g_PreloadTaskLock must be held
+ */
+static void _accountPreloadPBlock(iFusePreloadPBlock_t *iFusePreloadPBlock, int delta) {
+    iFusePreload_t *iFusePreload;
+
+    assert(iFusePreloadPBlock != NULL);
+
+    iFusePreload = iFusePreloadPBlock->preload;
+
+    switch(iFusePreloadPBlock->status) {
+        case IFUSE_PRELOAD_PBLOCK_STATUS_INIT:
+        case IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING:
+            g_PreloadInflightBlockNum += delta;
+            iFusePreload->inflightBlocks += delta;
+            break;
+        case IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED:
+            g_PreloadResidentBlockNum += delta;
+            iFusePreload->residentBlocks += delta;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Get the number of blocks a stream can hold
+ * g_PreloadTaskLock must be held
+ */
+static unsigned int _getPreloadShare() {
+    unsigned int share = g_preloadMemBlocks;
+
+    if(g_PreloadStreamNum > 1) {
+        share = g_preloadMemBlocks / g_PreloadStreamNum;
+    }
+
+    if(share < IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM) {
+        share = IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM;
+    }
+
+    return share;
+}
+
+/*
+ * Check if a preload can take another block within the budget
+ * g_PreloadTaskLock must be held
+ */
+static bool _admitPreloadPBlock(iFusePreload_t *iFusePreload) {
+    assert(iFusePreload != NULL);
+
+    if(g_PreloadInflightBlockNum >= (unsigned int)g_preloadInflightBlocks) {
+        return false;
+    }
+
+    if(g_PreloadInflightBlockNum + g_PreloadResidentBlockNum >= (unsigned int)g_preloadMemBlocks) {
+        return false;
+    }
+
+    return iFusePreload->inflightBlocks + iFusePreload->residentBlocks < _getPreloadShare();
+}
+
+/*
+ * Cancel a queued preload task or wait for a running one to finish
+ * returns status of the pblock after that
+ */
+static int _finishPreloadPBlock(iFusePreloadPBlock_t *iFusePreloadPBlock) {
+    int status = 0;
+
+    assert(iFusePreloadPBlock != NULL);
+
+    pthread_mutex_lock(&g_PreloadTaskLock);
+
+    if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_INIT) {
+        g_PreloadTasks.remove(iFusePreloadPBlock);
+        _accountPreloadPBlock(iFusePreloadPBlock, -1);
+        iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_CANCELLED;
     }
 
-    pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
+    while(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING) {
+        pthread_cond_wait(&g_PreloadTaskDoneCond, &g_PreloadTaskLock);
+    }
+
+    status = iFusePreloadPBlock->status;
+
+    pthread_mutex_unlock(&g_PreloadTaskLock);
+    return status;
+}
+
+/*
+ * Release a pblock without waiting, a queued task is cancelled and
+ * a running task is abandoned to the worker
+ */
+static int _freePreloadPBlock(iFusePreloadPBlock_t *iFusePreloadPBlock) {
+    assert(iFusePreloadPBlock != NULL);
+
+    pthread_mutex_lock(&g_PreloadTaskLock);
 
-    if(iFusePreloadPBlock->fd != NULL) {
-        iFuseBufferedFsClose(iFusePreloadPBlock->fd);
-        iFusePreloadPBlock->fd = NULL;
+    if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING) {
+        // still counted in flight until the worker frees it
+        iFusePreloadPBlock->abandoned = true;
+        pthread_mutex_unlock(&g_PreloadTaskLock);
+        return 0;
     }
 
-    iFusePreloadPBlock->blockID = 0;
+    if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_INIT) {
+        g_PreloadTasks.remove(iFusePreloadPBlock);
+    }
 
-    pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
+    _accountPreloadPBlock(iFusePreloadPBlock, -1);
 
-    pthread_rwlock_destroy(&iFusePreloadPBlock->lock);
-    pthread_rwlockattr_destroy(&iFusePreloadPBlock->lockAttr);
+    pthread_mutex_unlock(&g_PreloadTaskLock);
 
     free(iFusePreloadPBlock);
     return 0;
@@ -136,6 +423,7 @@ static int _freePreload(iFusePreload_t *iFusePreload) {
 
     assert(iFusePreload != NULL);
 
+    // running tasks pin the preload, others are not waited
     if(iFusePreload->pblocks != NULL) {
         while(!iFusePreload->pblocks->empty()) {
             iFusePreloadPBlock = iFusePreload->pblocks->front();
@@ -147,6 +435,18 @@ static int _freePreload(iFusePreload_t *iFusePreload) {
         delete iFusePreload->pblocks;
     }
 
+    if(iFusePreload->window > 0) {
+        pthread_mutex_lock(&g_PreloadTaskLock);
+        g_PreloadStreamNum--;
+        pthread_mutex_unlock(&g_PreloadTaskLock);
+    }
+
+    // no task uses handles at this point
+    if(iFusePreload->handles != NULL) {
+        _releasePreloadHandles(iFusePreload->handles);
+        iFusePreload->handles = NULL;
+    }
+
     if(iFusePreload->iRodsPath != NULL) {
         free(iFusePreload->iRodsPath);
         iFusePreload->iRodsPath = NULL;
@@ -159,356 +459,695 @@ static int _freePreload(iFusePreload_t *iFusePreload) {
     return 0;
 }
 
-static int _releaseAllPreload() {
+/*
+ * Find a preload of a file descriptor and pin it
+ * returns NULL if not found
+ */
+static iFusePreload_t *_getPreload(unsigned long fdId) {
     std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
     iFusePreload_t *iFusePreload = NULL;
 
-    pthread_rwlock_wrlock(&g_PreloadLock);
+    pthread_mutex_lock(&g_PreloadLock);
+
+    it_preloadmap = g_PreloadMap.find(fdId);
+    if(it_preloadmap != g_PreloadMap.end()) {
+        // has it
+        iFusePreload = it_preloadmap->second;
+        iFusePreload->refCount++;
+    }
+
+    pthread_mutex_unlock(&g_PreloadLock);
+    return iFusePreload;
+}
+
+/*
+ * Unpin a preload, the last reference frees it
+ */
+static void _putPreload(iFusePreload_t *iFusePreload) {
+    bool release = false;
+
+    assert(iFusePreload != NULL);
+
+    pthread_mutex_lock(&g_PreloadLock);
+
+    assert(iFusePreload->refCount > 0);
+    iFusePreload->refCount--;
+    release = (iFusePreload->refCount == 0);
+
+    pthread_mutex_unlock(&g_PreloadLock);
+
+    if(release) {
+        _freePreload(iFusePreload);
+    }
+}
+
+/*
+ * Remove a preload of a file descriptor from the map
+ * returns NULL if not found, the map's reference is passed to the caller
+ */
+static iFusePreload_t *_removePreload(unsigned long fdId) {
+    std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
+    iFusePreload_t *iFusePreload = NULL;
+
+    pthread_mutex_lock(&g_PreloadLock);
+
+    it_preloadmap = g_PreloadMap.find(fdId);
+    if(it_preloadmap != g_PreloadMap.end()) {
+        // has it
+        iFusePreload = it_preloadmap->second;
+        g_PreloadMap.erase(it_preloadmap);
+    }
+
+    pthread_mutex_unlock(&g_PreloadLock);
+    return iFusePreload;
+}
+
+static int _releaseAllPreload() {
+    std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
+    iFusePreload_t *iFusePreload = NULL;
 
     // release all get
-    while(!g_PreloadMap.empty()) {
+    while(true) {
+        pthread_mutex_lock(&g_PreloadLock);
+
+        iFusePreload = NULL;
         it_preloadmap = g_PreloadMap.begin();
         if(it_preloadmap != g_PreloadMap.end()) {
             iFusePreload = it_preloadmap->second;
             g_PreloadMap.erase(it_preloadmap);
+        }
 
-            _freePreload(iFusePreload);
+        pthread_mutex_unlock(&g_PreloadLock);
+
+        if(iFusePreload == NULL) {
+            break;
         }
+
+        _putPreload(iFusePreload);
     }
 
-    pthread_rwlock_unlock(&g_PreloadLock);
     return 0;
 }
 
-static void* _preloadTask(void* param) {
+/*
+ * Fill the buffer cache with a block
+ * returns status of the pblock
+ */
+static int _runPreloadTask(iFusePreloadPBlock_t *iFusePreloadPBlock) {
     int status = 0;
-    iFusePreloadThreadParam_t *iFusePreloadThreadParam;
     iFusePreload_t *iFusePreload;
-    iFusePreloadPBlock_t *iFusePreloadPBlock;
-    iFuseFd_t *iFuseFd;
-    char *blockBuffer = (char*)calloc(1, getBufferCacheBlockSize());
+    iFuseFd_t *iFuseFd = NULL;
 
-    assert(param != NULL);
+    assert(iFusePreloadPBlock != NULL);
 
-    iFusePreloadThreadParam = (iFusePreloadThreadParam_t*)param;
-    iFusePreload = iFusePreloadThreadParam->preload;
-    iFusePreloadPBlock = iFusePreloadThreadParam->pblock;
+    iFusePreload = iFusePreloadPBlock->preload;
 
-    if(blockBuffer == NULL) {
-        free(iFusePreloadThreadParam);
+    iFuseLibLog(LOG_DEBUG, "_runPreloadTask: preloading %s, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
 
-        pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
-        iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED;
-        pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-        return NULL;
+    status = _getPreloadHandle(iFusePreload->handles, &iFuseFd);
+    if (status < 0) {
+        return IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED;
     }
 
-    iFuseLibLog(LOG_DEBUG, "_preloadTask: preloading %s, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
+    // only fill the buffer cache
+    status = iFuseBufferedFsReadBlock(iFuseFd, NULL, iFusePreloadPBlock->blockID, 0, 0);
+    if (status < 0) {
+        iFuseLibLogError(LOG_ERROR, status, "_runPreloadTask: iFuseBufferedFsReadBlock of %s error, status = %d",
+                iFuseFd->iRodsPath, status);
+        // the handle may be broken
+        iFuseBufferedFsClose(iFuseFd);
+        return IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED;
+    }
 
-    if(iFusePreloadPBlock->fd == NULL) {
-        status = iFuseBufferedFsOpen(iFusePreload->iRodsPath, &iFuseFd, O_RDONLY);
-        if (status < 0) {
-            iFuseLibLogError(LOG_ERROR, status, "_preloadTask: iFuseBufferedFsOpen of %s error, status = %d",
-                    iFusePreload->iRodsPath, status);
-            free(blockBuffer);
-            free(iFusePreloadThreadParam);
+    _putPreloadHandle(iFusePreload->handles, iFuseFd);
+    return IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED;
+}
 
-            pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
-            iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED;
-            pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-            return NULL;
+static void* _preloadThread(void* param) {
+    iFusePreloadPBlock_t *iFusePreloadPBlock;
+    iFusePreload_t *iFusePreload;
+    int status;
+
+    UNUSED(param);
+
+    iFuseIOSchedSetPriority(IFUSE_IO_PRIORITY_BACKGROUND);
+
+    pthread_mutex_lock(&g_PreloadTaskLock);
+
+    while(true) {
+        while(g_PreloadRunning && g_PreloadTasks.empty()) {
+            pthread_cond_wait(&g_PreloadTaskCond, &g_PreloadTaskLock);
         }
 
-        pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
-        iFusePreloadPBlock->fd = iFuseFd;
-        pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-    }
+        if(!g_PreloadRunning) {
+            break;
+        }
 
-    status = iFuseBufferedFsReadBlock(iFusePreloadPBlock->fd, blockBuffer, iFusePreloadPBlock->blockID);
-    if (status < 0) {
-        iFuseLibLogError(LOG_ERROR, status, "_preloadTask: iFuseBufferedFsReadBlock of %s error, status = %d",
-                iFusePreloadPBlock->fd->iRodsPath, status);
-        free(blockBuffer);
-        free(iFusePreloadThreadParam);
+        // demand requests go first - tasks stay queued meanwhile,
+        // so a reader reaching a deferred block cancels and reads it itself
+        pthread_mutex_unlock(&g_PreloadTaskLock);
 
-        pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
-        iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED;
-        pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-        return NULL;
-    }
+        if(!iFuseIOSchedWaitBackground(IFUSE_IO_SCHED_MAX_DEFER_MSEC)) {
+            iFuseLibLog(LOG_DEBUG, "_preloadThread: preload is deferred for %d msec", IFUSE_IO_SCHED_MAX_DEFER_MSEC);
+        }
+
+        pthread_mutex_lock(&g_PreloadTaskLock);
+
+        if(!g_PreloadRunning) {
+            break;
+        }
+
+        if(g_PreloadTasks.empty()) {
+            // cancelled while waiting
+            continue;
+        }
+
+        iFusePreloadPBlock = g_PreloadTasks.front();
+        g_PreloadTasks.pop_front();
+        iFusePreload = iFusePreloadPBlock->preload;
+
+        // pin the preload while running
+        pthread_mutex_lock(&g_PreloadLock);
+        if(iFusePreload->refCount == 0) {
+            // being freed, the pblock is released with it
+            pthread_mutex_unlock(&g_PreloadLock);
+            continue;
+        }
+        iFusePreload->refCount++;
+        pthread_mutex_unlock(&g_PreloadLock);
+
+        iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING;
+
+        pthread_mutex_unlock(&g_PreloadTaskLock);
+
+        status = _runPreloadTask(iFusePreloadPBlock);
+
+        pthread_mutex_lock(&g_PreloadTaskLock);
+
+        _accountPreloadPBlock(iFusePreloadPBlock, -1);
+        if(iFusePreloadPBlock->abandoned) {
+            // released by the reader, data stays in the buffer cache
+            iFuseLibLog(LOG_DEBUG, "_preloadThread: abandoned preload of %s finished, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
+            free(iFusePreloadPBlock);
+        } else {
+            iFusePreloadPBlock->status = status;
+            _accountPreloadPBlock(iFusePreloadPBlock, 1);
+        }
+        pthread_cond_broadcast(&g_PreloadTaskDoneCond);
 
-    free(blockBuffer);
+        pthread_mutex_unlock(&g_PreloadTaskLock);
 
-    pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
-    iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED;
-    pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
+        _putPreload(iFusePreload);
 
-    free(iFusePreloadThreadParam);
+        pthread_mutex_lock(&g_PreloadTaskLock);
+    }
 
+    pthread_mutex_unlock(&g_PreloadTaskLock);
     return NULL;
 }
 
-int _startPreload(iFusePreload_t *iFusePreload, unsigned int blockID, iFuseFd_t *iFuseFd) {
+/*
+ * Queue a preload task of a block
+ * returns -1 if the block is out of the budget
+ */
+static int _startPreload(iFusePreload_t *iFusePreload, unsigned int blockID) {
     int status = 0;
-    iFusePreloadThreadParam_t *iFusePreloadThreadParam;
     iFusePreloadPBlock_t *iFusePreloadPBlock;
 
     assert(iFusePreload != NULL);
 
     iFuseLibLog(LOG_DEBUG, "_startPreload: preloading %s, blockID: %u", iFusePreload->iRodsPath, blockID);
 
-    status = _newPreloadPBlock(iFusePreload->iRodsPath, &iFusePreloadPBlock);
+    if(g_PreloadThreadNum <= 0 || iFusePreload->handles == NULL) {
+        return -1;
+    }
+
+    status = _newPreloadPBlock(iFusePreload, &iFusePreloadPBlock);
     if(status < 0) {
         return status;
     }
 
-    iFusePreloadPBlock->fd = iFuseFd;
     iFusePreloadPBlock->blockID = blockID;
-    iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING;
+    iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_INIT;
 
-    iFusePreloadThreadParam = (iFusePreloadThreadParam_t*) calloc(1, sizeof(iFusePreloadThreadParam_t));
-    if(iFusePreloadThreadParam == NULL) {
-        return SYS_MALLOC_ERR;
-    }
+    pthread_rwlock_wrlock(&iFusePreload->lock);
+    pthread_mutex_lock(&g_PreloadTaskLock);
 
-    iFusePreloadThreadParam->preload = iFusePreload;
-    iFusePreloadThreadParam->pblock = iFusePreloadPBlock;
+    if(!_admitPreloadPBlock(iFusePreload)) {
+        iFuseLibLog(LOG_DEBUG, "_startPreload: preload budget is full, %s, blockID: %u", iFusePreload->iRodsPath, blockID);
 
-    status = pthread_create(&iFusePreloadPBlock->thread, NULL, _preloadTask, (void*)iFusePreloadThreadParam);
-    if(status != 0) {
-        iFuseLibLogError(LOG_ERROR, status, "_startPreload: failed to create a thread for %s of block id %u, status = %d",
-                iFusePreload->iRodsPath, blockID, status);
-        iFusePreloadPBlock->status = IFUSE_PRELOAD_PBLOCK_STATUS_CREATION_FAILED;
-        _freePreloadPBlock(iFusePreloadPBlock);
-        free(iFusePreloadThreadParam);
+        pthread_mutex_unlock(&g_PreloadTaskLock);
+        pthread_rwlock_unlock(&iFusePreload->lock);
+
+        // not accounted yet
+        free(iFusePreloadPBlock);
         return -1;
     }
 
-    pthread_rwlock_wrlock(&iFusePreload->lock);
-
+    _accountPreloadPBlock(iFusePreloadPBlock, 1);
     iFusePreload->pblocks->push_back(iFusePreloadPBlock);
 
+    g_PreloadTasks.push_back(iFusePreloadPBlock);
+    pthread_cond_signal(&g_PreloadTaskCond);
+
+    pthread_mutex_unlock(&g_PreloadTaskLock);
     pthread_rwlock_unlock(&iFusePreload->lock);
     return status;
 }
 
-int _readPreload(iFusePreload_t *iFusePreload, char *buf, unsigned int blockID) {
-    size_t readSize = 0;
-    std::list<iFusePreloadPBlock_t*> removeList;
-    std::list<iFusePreloadPBlock_t*> recycleList;
-    std::list<iFusePreloadPBlock_t*>::iterator it_preloadpblock;
-    iFusePreloadPBlock_t *iFusePreloadPBlock = NULL;
-    iFuseFd_t *iFuseFd = NULL;
-    bool hasBlock = false;
-    bool *pblockExistance = (bool*)calloc(g_preloadNumBlocks, sizeof(bool));
-    int i;
-
+/*
+ * Grow the readahead window along a detected access pattern
+ */
+static void _growPreloadWindow(iFusePreload_t *iFusePreload, long long stride) {
     assert(iFusePreload != NULL);
-    assert(buf != NULL);
 
-    if(pblockExistance == NULL) {
-        return SYS_MALLOC_ERR;
+    if(iFusePreload->stride != stride || iFusePreload->window == 0) {
+        // start small
+        iFusePreload->stride = stride;
+        iFusePreload->window = IFUSE_PRELOAD_WINDOW_INIT_PBLOCK_NUM;
+    } else {
+        iFusePreload->window *= 2;
     }
 
-    bzero(pblockExistance, g_preloadNumBlocks * sizeof(bool));
+    if(iFusePreload->window > (unsigned int)g_preloadNumBlocks) {
+        iFusePreload->window = g_preloadNumBlocks;
+    }
+}
 
-    pthread_rwlock_wrlock(&iFusePreload->lock);
+/*
+ * Detect access pattern of a file descriptor from the first block of reads
+ * - sequential : a read starts in or right after blocks of the last read
+ * - stride : the first block moves by the same distance twice in a row,
+ *            which includes reading backwards (stride -1)
+ */
+static void _detectPreloadPattern(iFusePreload_t *iFusePreload, unsigned int blockID, unsigned int blockNum) {
+    long long delta = 0;
 
-    // check loaded
-    for(it_preloadpblock=iFusePreload->pblocks->begin();it_preloadpblock!=iFusePreload->pblocks->end();it_preloadpblock++) {
-        iFusePreloadPBlock = *it_preloadpblock;
+    assert(iFusePreload != NULL);
 
-        if(blockID == iFusePreloadPBlock->blockID) {
-            // has block
-            hasBlock = true;
-        } else if(blockID > iFusePreloadPBlock->blockID ||
-                blockID + g_preloadNumBlocks < iFusePreloadPBlock->blockID) {
-            // remove old blocks
-            // if block id is less than current block id
-            // or block id is far larger than current block id (for backward read)
-
-            iFuseLibLog(LOG_DEBUG, "_readPreload: found old preloaded data of %s, blockID: %u, cur blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID, blockID);
-            removeList.push_back(iFusePreloadPBlock);
+    if(!iFusePreload->accessed) {
+        // first access
+        iFusePreload->stride = 0;
+        iFusePreload->window = 0;
+    } else {
+        delta = (long long)blockID - (long long)iFusePreload->lastBlockID;
+
+        if(delta == 0) {
+            // reading the same block - keep the pattern
+        } else if(delta > 0 && delta <= (long long)iFusePreload->lastBlockNum) {
+            // sequential
+            _growPreloadWindow(iFusePreload, 1);
+        } else if(delta == iFusePreload->stride) {
+            // constant stride
+            _growPreloadWindow(iFusePreload, delta);
         } else {
-            // preloaded blocks
-            if(iFusePreloadPBlock->blockID - blockID - 1 < (unsigned int)g_preloadNumBlocks) {
-                pblockExistance[iFusePreloadPBlock->blockID - blockID - 1] = true;
-            }
+            // random access - remember the distance as a stride candidate
+            iFusePreload->stride = delta;
+            iFusePreload->window = 0;
         }
     }
 
-    // wait old blocks to be joined
-    for(it_preloadpblock=removeList.begin();it_preloadpblock!=removeList.end();it_preloadpblock++) {
-        iFusePreloadPBlock = *it_preloadpblock;
+    iFusePreload->accessed = true;
+    iFusePreload->lastBlockID = blockID;
+    iFusePreload->lastBlockNum = blockNum;
+}
 
-        if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING ||
-                iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_INIT ||
-                iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED ||
-                iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED) {
-            if(!iFusePreloadPBlock->threadJoined) {
-                iFuseLibLog(LOG_DEBUG, "_readPreload: waiting for a preload thread of %s, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
+/*
+ * Get blocks to be preloaded along the access pattern, nearest first
+ * blocks being read are not included
+ */
+static void _getPreloadTargets(iFusePreload_t *iFusePreload, std::list<unsigned int> *targets) {
+    unsigned int blockID;
+    unsigned int blockNum;
+    long long targetBlockID;
+    unsigned int i, j;
+
+    assert(iFusePreload != NULL);
+    assert(targets != NULL);
+
+    blockID = iFusePreload->lastBlockID;
+    blockNum = iFusePreload->lastBlockNum;
 
-                pthread_join(iFusePreloadPBlock->thread, NULL);
+    if(iFusePreload->stride == 1) {
+        // blocks following the read
+        for(i=1;i<=iFusePreload->window;i++) {
+            targets->push_back(blockID + blockNum - 1 + i);
+        }
+        return;
+    }
 
-                pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
+    // blocks of the next reads along the stride
+    for(i=1;i<=iFusePreload->window;i++) {
+        for(j=0;j<blockNum;j++) {
+            if(targets->size() >= (size_t)g_preloadNumBlocks) {
+                return;
+            }
 
-                // set to joined
-                iFusePreloadPBlock->threadJoined = true;
+            targetBlockID = (long long)blockID + iFusePreload->stride * (long long)i + j;
+            if(targetBlockID < 0 || targetBlockID > (long long)UINT_MAX) {
+                continue;
+            }
 
-                pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
+            if(targetBlockID >= (long long)blockID && targetBlockID < (long long)blockID + blockNum) {
+                continue;
             }
+
+            targets->push_back((unsigned int)targetBlockID);
         }
     }
+}
 
-    // find reusable pblocks -> moves to recycleList
-    // release old pblocks
-    while(!removeList.empty()) {
-        iFusePreloadPBlock = removeList.front();
+/*
+ * Update access pattern with a read of blocks and schedule preload
+ * of blocks along the pattern, others are cancelled
+ */
+static void _updatePreload(iFusePreload_t *iFusePreload, unsigned int blockID, unsigned int blockNum) {
+    std::list<unsigned int> targets;
+    std::list<unsigned int>::iterator it_target;
+    std::set<unsigned int> keepBlocks;
+    std::set<unsigned int> loadedBlocks;
+    std::list<iFusePreloadPBlock_t*> removeList;
+    std::list<iFusePreloadPBlock_t*>::iterator it_preloadpblock;
+    iFusePreloadPBlock_t *iFusePreloadPBlock = NULL;
+    unsigned int oldWindow;
+    unsigned int i;
 
-        iFuseLibLog(LOG_DEBUG, "_readPreload: removing preloaded data of %s, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
+    assert(iFusePreload != NULL);
 
-        removeList.pop_front();
-        iFusePreload->pblocks->remove(iFusePreloadPBlock);
-        if(iFusePreloadPBlock->fd != NULL &&
-                iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED &&
-                iFusePreloadPBlock->threadJoined) {
-            // reusable
-            recycleList.push_back(iFusePreloadPBlock);
+    pthread_rwlock_wrlock(&iFusePreload->lock);
+
+    oldWindow = iFusePreload->window;
+    _detectPreloadPattern(iFusePreload, blockID, blockNum);
+    _getPreloadTargets(iFusePreload, &targets);
+
+    if((oldWindow > 0) != (iFusePreload->window > 0)) {
+        // streams share the budget
+        pthread_mutex_lock(&g_PreloadTaskLock);
+        if(iFusePreload->window > 0) {
+            g_PreloadStreamNum++;
         } else {
-            _freePreloadPBlock(iFusePreloadPBlock);
+            g_PreloadStreamNum--;
         }
+        pthread_mutex_unlock(&g_PreloadTaskLock);
     }
 
-    pthread_rwlock_unlock(&iFusePreload->lock);
+    // blocks being read and targets are kept
+    for(i=0;i<blockNum;i++) {
+        keepBlocks.insert(blockID + i);
+    }
 
-    if(!hasBlock) {
-        iFuseFd = NULL;
-        if(!recycleList.empty()) {
-            iFusePreloadPBlock = recycleList.front();
-            recycleList.pop_front();
+    for(it_target=targets.begin();it_target!=targets.end();it_target++) {
+        keepBlocks.insert(*it_target);
+    }
 
-            iFuseFd = iFusePreloadPBlock->fd;
-            iFusePreloadPBlock->fd = NULL;
+    for(it_preloadpblock=iFusePreload->pblocks->begin();it_preloadpblock!=iFusePreload->pblocks->end();it_preloadpblock++) {
+        iFusePreloadPBlock = *it_preloadpblock;
 
-            _freePreloadPBlock(iFusePreloadPBlock);
+        if(keepBlocks.find(iFusePreloadPBlock->blockID) == keepBlocks.end()) {
+            // out of the pattern
+            iFuseLibLog(LOG_DEBUG, "_updatePreload: found old preloaded data of %s, blockID: %u, cur blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID, blockID);
+            removeList.push_back(iFusePreloadPBlock);
+        } else {
+            loadedBlocks.insert(iFusePreloadPBlock->blockID);
         }
+    }
+
+    // release old pblocks - queued tasks are cancelled, running tasks are abandoned
+    while(!removeList.empty()) {
+        iFusePreloadPBlock = removeList.front();
+
+        iFuseLibLog(LOG_DEBUG, "_updatePreload: removing preloaded data of %s, blockID: %u", iFusePreload->iRodsPath, iFusePreloadPBlock->blockID);
 
-        // param iFuseFd can be null
-        _startPreload(iFusePreload, blockID, iFuseFd);
+        removeList.pop_front();
+        iFusePreload->pblocks->remove(iFusePreloadPBlock);
+        _freePreloadPBlock(iFusePreloadPBlock);
     }
 
+    pthread_rwlock_unlock(&iFusePreload->lock);
+
+    for(it_target=targets.begin();it_target!=targets.end();it_target++) {
+        if(loadedBlocks.find(*it_target) == loadedBlocks.end()) {
+            // start preload
+            if(_startPreload(iFusePreload, *it_target) < 0) {
+                // farther blocks wait for the budget
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Read a block preloaded to the buffer cache with the caller's handle
+ * returns -1 if the block is not preloaded
+ */
+static int _readPreload(iFusePreload_t *iFusePreload, iFuseFd_t *iFuseFd, char *buf, unsigned int blockID, off_t inBlockOffset, size_t size) {
+    int readSize = -1;
+    std::list<iFusePreloadPBlock_t*>::iterator it_preloadpblock;
+    iFusePreloadPBlock_t *iFusePreloadPBlock = NULL;
+
+    assert(iFusePreload != NULL);
+    assert(iFuseFd != NULL);
+    assert(buf != NULL);
+
     pthread_rwlock_rdlock(&iFusePreload->lock);
 
     for(it_preloadpblock=iFusePreload->pblocks->begin();it_preloadpblock!=iFusePreload->pblocks->end();it_preloadpblock++) {
         iFusePreloadPBlock = *it_preloadpblock;
 
         if(blockID == iFusePreloadPBlock->blockID) {
+            // a task not started yet is cancelled, the block is read by the caller
+            iFuseLibLog(LOG_DEBUG, "_readPreload: waiting for a preload task of %s, blockID: %u", iFusePreload->iRodsPath, blockID);
+
+            if(_finishPreloadPBlock(iFusePreloadPBlock) == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED) {
+                iFuseLibLog(LOG_DEBUG, "_readPreload: reading a block from preloaded data of %s, blockID: %u", iFusePreload->iRodsPath, blockID);
+                readSize = iFuseBufferedFsReadBlock(iFuseFd, buf, blockID, inBlockOffset, size);
+            }
+            break;
+        }
+    }
 
-            if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_INIT ||
-                    iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_RUNNING ||
-                    iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED ||
-                    iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_TASK_FAILED) {
-                if(!iFusePreloadPBlock->threadJoined) {
-                    iFuseLibLog(LOG_DEBUG, "_readPreload: waiting for a preload thread of %s, blockID: %u", iFusePreload->iRodsPath, blockID);
+    pthread_rwlock_unlock(&iFusePreload->lock);
+    return readSize;
+}
 
-                    pthread_join(iFusePreloadPBlock->thread, NULL);
+/*
+ * Check if path is the given path or under it
+ */
+static bool _isUnderPath(const char *path, const char *parent) {
+    size_t parentLen = strlen(parent);
 
-                    pthread_rwlock_wrlock(&iFusePreloadPBlock->lock);
+    if(strncmp(path, parent, parentLen) != 0) {
+        return false;
+    }
 
-                    // set to joined
-                    iFusePreloadPBlock->threadJoined = true;
+    return path[parentLen] == 0 || path[parentLen] == '/' ||
+        (parentLen > 0 && parent[parentLen - 1] == '/');
+}
 
-                    pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-                }
-            }
+/*
+ * Report the preload budget and readahead windows of file descriptors
+ * that have read under the given path
+ */
+void iFusePreloadReport(const char *iRodsPath, iFusePreloadReport_t *report) {
+    std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
+    std::list<iFusePreload_t*> preloads;
+    iFusePreload_t *iFusePreload = NULL;
 
-            if(iFusePreloadPBlock->status == IFUSE_PRELOAD_PBLOCK_STATUS_COMPLETED &&
-                    iFusePreloadPBlock->threadJoined) {
-                pthread_rwlock_rdlock(&iFusePreloadPBlock->lock);
+    assert(iRodsPath != NULL);
+    assert(report != NULL);
 
-                if(iFusePreloadPBlock->fd != NULL) {
-                    iFuseLibLog(LOG_DEBUG, "_readPreload: reading a block from preloaded data of %s, blockID: %u", iFusePreload->iRodsPath, blockID);
-                    readSize = iFuseBufferedFsReadBlock(iFusePreloadPBlock->fd, buf, blockID);
-                } else {
-                    readSize = -1;
-                }
+    bzero(report, sizeof(iFusePreloadReport_t));
+    report->blockSize = getBufferCacheBlockSize();
+    report->maxWindow = g_preloadNumBlocks;
+    report->memBudget = (long long)g_preloadMemBlocks * report->blockSize;
+    report->inflightBudget = (long long)g_preloadInflightBlocks * report->blockSize;
 
-                pthread_rwlock_unlock(&iFusePreloadPBlock->lock);
-            } else {
-                readSize = -1;
-            }
+    pthread_mutex_lock(&g_PreloadTaskLock);
+
+    report->residentBytes = (long long)g_PreloadResidentBlockNum * report->blockSize;
+    report->inflightBytes = (long long)g_PreloadInflightBlockNum * report->blockSize;
+    report->streamNum = g_PreloadStreamNum;
+    report->streamShare = _getPreloadShare();
+
+    pthread_mutex_unlock(&g_PreloadTaskLock);
+
+    // pin preloads, their locks may be held by readers waiting for tasks
+    pthread_mutex_lock(&g_PreloadLock);
+
+    for(it_preloadmap=g_PreloadMap.begin();it_preloadmap!=g_PreloadMap.end();it_preloadmap++) {
+        iFusePreload = it_preloadmap->second;
+
+        if(_isUnderPath(iFusePreload->iRodsPath, iRodsPath)) {
+            iFusePreload->refCount++;
+            preloads.push_back(iFusePreload);
         }
     }
 
-    pthread_rwlock_unlock(&iFusePreload->lock);
+    pthread_mutex_unlock(&g_PreloadLock);
 
-    for(i=0;i<g_preloadNumBlocks;i++) {
-        if(!pblockExistance[i]) {
-            // start preload
-            iFuseFd = NULL;
-            if(!recycleList.empty()) {
-                iFusePreloadPBlock = recycleList.front();
-                recycleList.pop_front();
+    while(!preloads.empty()) {
+        iFusePreload = preloads.front();
+        preloads.pop_front();
 
-                iFuseFd = iFusePreloadPBlock->fd;
-                iFusePreloadPBlock->fd = NULL;
+        pthread_rwlock_rdlock(&iFusePreload->lock);
 
-                _freePreloadPBlock(iFusePreloadPBlock);
-            }
+        if(iFusePreload->accessed) {
+            if(report->fdNum < IFUSE_PRELOAD_REPORT_FD_NUM) {
+                report->fds[report->fdNum].fdId = iFusePreload->fdId;
+                report->fds[report->fdNum].stride = iFusePreload->window > 0 ? iFusePreload->stride : 0;
+                report->fds[report->fdNum].window = iFusePreload->window;
+
+                pthread_mutex_lock(&g_PreloadTaskLock);
+                report->fds[report->fdNum].inflightBlocks = iFusePreload->inflightBlocks;
+                report->fds[report->fdNum].residentBlocks = iFusePreload->residentBlocks;
+                pthread_mutex_unlock(&g_PreloadTaskLock);
 
-            // param iFuseFd can be null
-            _startPreload(iFusePreload, i + blockID + 1, iFuseFd);
+                report->fdNum++;
+            }
         }
+
+        pthread_rwlock_unlock(&iFusePreload->lock);
+
+        _putPreload(iFusePreload);
     }
+}
 
-    // release entries in recycleList that will not be used
-    while(!recycleList.empty()) {
-        iFusePreloadPBlock = recycleList.front();
-        removeList.pop_front();
-        _freePreloadPBlock(iFusePreloadPBlock);
+/*
+ * Handle ioctl for preload, others are passed to buffered fs
+ */
+int iFusePreloadIoctl(const char *iRodsPath, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data) {
+    assert(iRodsPath != NULL);
+
+    iFuseLibLog(LOG_DEBUG, "iFusePreloadIoctl: %s, command = %d", iRodsPath, cmd);
+
+    switch ((unsigned int)cmd) {
+        case IFUSEIOC_SHOW_PRELOAD:
+            {
+                // show readahead windows
+                iFuseLibLog(LOG_DEBUG, "iFusePreloadIoctl: showing readahead windows");
+
+                iFusePreloadReport(iRodsPath, (iFusePreloadReport_t*) data);
+            }
+            return 0;
+        default:
+            break;
     }
 
-    free(pblockExistance);
-    return readSize;
+    return iFuseBufferedFsIoctl(iRodsPath, cmd, arg, fi, flags, data);
 }
 
 /*
  * Initialize preload manager
  */
 void iFusePreloadInit() {
+    int maxWindow = 0;
+    int maxMemBlocks = 0;
+
     if(iFuseLibGetOption()->preloadNumBlocks > 0) {
         g_preloadNumBlocks = iFuseLibGetOption()->preloadNumBlocks;
+    }
+
+    // readahead window is also bounded in bytes
+    maxWindow = IFUSE_PRELOAD_MAX_WINDOW_SIZE / getBufferCacheBlockSize();
+    if(maxWindow < 1) {
+        maxWindow = 1;
+    }
+
+    if(g_preloadNumBlocks > maxWindow) {
+        g_preloadNumBlocks = maxWindow;
+    }
+
+    if(iFuseLibGetOption()->preloadMemSize > 0) {
+        g_preloadMemBlocks = iFuseLibGetOption()->preloadMemSize / (int)getBufferCacheBlockSize();
+    }
 
-        if(g_preloadNumBlocks > IFUSE_PRELOAD_MAX_PBLOCK_NUM) {
-            g_preloadNumBlocks = IFUSE_PRELOAD_MAX_PBLOCK_NUM;
+    // preloaded blocks are kept in the buffer cache, leave room for others
+    if(iFuseLibGetOption()->bufferCacheSize > 0) {
+        maxMemBlocks = iFuseLibGetOption()->bufferCacheSize / 2 / (int)getBufferCacheBlockSize();
+        if(g_preloadMemBlocks > maxMemBlocks) {
+            g_preloadMemBlocks = maxMemBlocks;
         }
     }
 
+    if(g_preloadMemBlocks < IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM) {
+        g_preloadMemBlocks = IFUSE_PRELOAD_MIN_SHARE_PBLOCK_NUM;
+    }
+
+    if(iFuseLibGetOption()->preloadInflightSize > 0) {
+        g_preloadInflightBlocks = iFuseLibGetOption()->preloadInflightSize / (int)getBufferCacheBlockSize();
+    }
+
+    if(g_preloadInflightBlocks < 1) {
+        g_preloadInflightBlocks = 1;
+    }
+
     if(iFuseLibGetOption()->preloadNumThreads > 0) {
         g_preloadNumThreads = iFuseLibGetOption()->preloadNumThreads;
 
         if(g_preloadNumThreads > IFUSE_PRELOAD_MAX_THREAD_NUM) {
             g_preloadNumThreads = IFUSE_PRELOAD_MAX_THREAD_NUM;
         }
+    }
+
+    pthread_mutex_init(&g_PreloadLock, NULL);
+
+    pthread_mutex_init(&g_PreloadHandleLock, NULL);
+
+    pthread_mutex_init(&g_PreloadTaskLock, NULL);
+    pthread_cond_init(&g_PreloadTaskCond, NULL);
+    pthread_cond_init(&g_PreloadTaskDoneCond, NULL);
 
-        // number of threads cannot be bigger than number of blocks
-        if(g_preloadNumThreads > g_preloadNumBlocks) {
-            g_preloadNumThreads = g_preloadNumBlocks;
+    g_PreloadInflightBlockNum = 0;
+    g_PreloadResidentBlockNum = 0;
+    g_PreloadStreamNum = 0;
+
+    // start worker threads - the pool is shared by all files
+    g_PreloadRunning = true;
+    g_PreloadThreadNum = 0;
+    if(iFuseLibGetOption()->preload) {
+        g_PreloadThreads = (pthread_t *) calloc(g_preloadNumThreads, sizeof ( pthread_t));
+        if(g_PreloadThreads != NULL) {
+            for(g_PreloadThreadNum=0;g_PreloadThreadNum<g_preloadNumThreads;g_PreloadThreadNum++) {
+                if(pthread_create(&g_PreloadThreads[g_PreloadThreadNum], NULL, _preloadThread, NULL) != 0) {
+                    iFuseLibLog(LOG_ERROR, "iFusePreloadInit: cannot start preload thread %d", g_PreloadThreadNum);
+                    break;
+                }
+            }
         }
     }
-
-    pthread_rwlockattr_init(&g_PreloadLockAttr);
-    pthread_rwlock_init(&g_PreloadLock, &g_PreloadLockAttr);
 }
 
 /*
  * Destroy preload manager
  */
 void iFusePreloadDestroy() {
+    int i;
+
+    // cancels queued tasks
     _releaseAllPreload();
 
-    pthread_rwlock_destroy(&g_PreloadLock);
-    pthread_rwlockattr_destroy(&g_PreloadLockAttr);
+    pthread_mutex_lock(&g_PreloadTaskLock);
+    g_PreloadRunning = false;
+    pthread_cond_broadcast(&g_PreloadTaskCond);
+    pthread_mutex_unlock(&g_PreloadTaskLock);
+
+    for(i=0;i<g_PreloadThreadNum;i++) {
+        pthread_join(g_PreloadThreads[i], NULL);
+    }
+
+    if(g_PreloadThreads != NULL) {
+        free(g_PreloadThreads);
+        g_PreloadThreads = NULL;
+    }
+    g_PreloadThreadNum = 0;
+
+    pthread_cond_destroy(&g_PreloadTaskDoneCond);
+    pthread_cond_destroy(&g_PreloadTaskCond);
+    pthread_mutex_destroy(&g_PreloadTaskLock);
+
+    pthread_mutex_destroy(&g_PreloadHandleLock);
+
+    pthread_mutex_destroy(&g_PreloadLock);
 }
 
 /*
@@ -518,7 +1157,6 @@ int iFusePreloadOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
     int status = 0;
     std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
     iFusePreload_t *iFusePreload = NULL;
-    int i;
 
     assert(iRodsPath != NULL);
     assert(iFuseFd != NULL);
@@ -532,23 +1170,26 @@ int iFusePreloadOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
         return status;
     }
 
+    if(iFuseBufferedFsIsWholeFile(*iFuseFd)) {
+        // all blocks are already cached
+        return 0;
+    }
+
     status = _newPreload(&iFusePreload);
     if (status == 0) {
         iFusePreload->fdId = (*iFuseFd)->fdId;
         iFusePreload->iRodsPath = strdup(iRodsPath);
+        iFusePreload->handles = _acquirePreloadHandles(iRodsPath);
+        // referenced by the map
+        iFusePreload->refCount = 1;
 
-        // start preload thread - only when the file is opened for read
-        if((openFlag & O_ACCMODE) == O_RDONLY || (openFlag & O_ACCMODE) == O_RDWR) {
-            for(i=0;i<g_preloadNumBlocks;i++) {
-                _startPreload(iFusePreload, i, NULL);
-            }
-        }
+        // readahead starts when sequential reads are detected
 
-        pthread_rwlock_wrlock(&g_PreloadLock);
+        pthread_mutex_lock(&g_PreloadLock);
 
         g_PreloadMap[(*iFuseFd)->fdId] = iFusePreload;
 
-        pthread_rwlock_unlock(&g_PreloadLock);
+        pthread_mutex_unlock(&g_PreloadLock);
     }
 
     return 0;
@@ -559,7 +1200,6 @@ int iFusePreloadOpen(const char *iRodsPath, iFuseFd_t **iFuseFd, int openFlag) {
  */
 int iFusePreloadClose(iFuseFd_t *iFuseFd) {
     int status = 0;
-    std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
     iFusePreload_t *iFusePreload = NULL;
     char *iRodsPath;
     unsigned long fdId;
@@ -581,19 +1221,10 @@ int iFusePreloadClose(iFuseFd_t *iFuseFd) {
 
     free(iRodsPath);
 
-    pthread_rwlock_wrlock(&g_PreloadLock);
-
-    it_preloadmap = g_PreloadMap.find(fdId);
-    if(it_preloadmap != g_PreloadMap.end()) {
-        // has it
-        iFusePreload = it_preloadmap->second;
-        g_PreloadMap.erase(it_preloadmap);
-    }
-
-    pthread_rwlock_unlock(&g_PreloadLock);
-
+    iFusePreload = _removePreload(fdId);
     if(iFusePreload != NULL) {
-        _freePreload(iFusePreload);
+        // freed here or by the last reader
+        _putPreload(iFusePreload);
     }
 
     return status;
@@ -607,8 +1238,6 @@ int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
     size_t readSize = 0;
     size_t remain = 0;
     off_t curOffset = 0;
-    char *blockBuffer = (char*)calloc(1, getBufferCacheBlockSize());
-    std::map<unsigned long, iFusePreload_t*>::iterator it_preloadmap;
     iFusePreload_t *iFusePreload = NULL;
 
     assert(iFuseFd != NULL);
@@ -616,14 +1245,14 @@ int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
 
     iFuseLibLog(LOG_DEBUG, "iFusePreloadRead: %s, offset: %lld, size: %lld", iFuseFd->iRodsPath, (long long)off, (long long)size);
 
-    pthread_rwlock_rdlock(&g_PreloadLock);
-
-    it_preloadmap = g_PreloadMap.find(iFuseFd->fdId);
-    if(it_preloadmap != g_PreloadMap.end()) {
-        // has it
-        iFusePreload = it_preloadmap->second;
+    // pinned without holding g_PreloadLock while waiting for tasks
+    iFusePreload = _getPreload(iFuseFd->fdId);
+    if(iFusePreload != NULL) {
+        if(size > 0) {
+            _updatePreload(iFusePreload, getBlockID(off), getBlockID(off + size - 1) - getBlockID(off) + 1);
+        }
 
-        // read in block level
+        // read in block level, directly into the caller's buffer
         remain = size;
         curOffset = off;
         while(remain > 0) {
@@ -632,22 +1261,20 @@ int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
             size_t curSize = inBlockAvail > remain ? remain : inBlockAvail;
             size_t blockSize = 0;
 
-            status = _readPreload(iFusePreload, blockBuffer, getBlockID(curOffset));
+            status = _readPreload(iFusePreload, iFuseFd, buf + readSize, getBlockID(curOffset), inBlockOffset, curSize);
             if(status < 0) {
-                iFuseLibLogError(LOG_ERROR, status, "iFusePreloadRead: _readPreload of %s error, status = %d",
+                iFuseLibLog(LOG_DEBUG, "iFusePreloadRead: block of %s is not preloaded, status = %d",
                         iFuseFd->iRodsPath, status);
 
                 status = iFuseBufferedFsRead(iFuseFd, buf, off, size);
                 if (status < 0) {
                     iFuseLibLogError(LOG_ERROR, status, "iFusePreloadRead: iFuseBufferedFsRead of %s error, status = %d",
                             iFuseFd->iRodsPath, status);
-                    pthread_rwlock_unlock(&g_PreloadLock);
-                    free(blockBuffer);
+                    _putPreload(iFusePreload);
                     return -ENOENT;
                 }
 
-                pthread_rwlock_unlock(&g_PreloadLock);
-                free(blockBuffer);
+                _putPreload(iFusePreload);
                 return status;
             } else if(status == 0) {
                 // eof
@@ -656,17 +1283,14 @@ int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
 
             blockSize = (size_t)status;
 
-            if(inBlockOffset + curSize > blockSize) {
-                curSize = blockSize - inBlockOffset;
-            }
-
-            if(curSize == 0) {
+            if((size_t)inBlockOffset >= blockSize) {
                 // eof
                 break;
             }
 
-            // copy
-            memcpy(buf + readSize, blockBuffer + inBlockOffset, curSize);
+            if(inBlockOffset + curSize > blockSize) {
+                curSize = blockSize - inBlockOffset;
+            }
 
             readSize += curSize;
             remain -= curSize;
@@ -678,15 +1302,11 @@ int iFusePreloadRead(iFuseFd_t *iFuseFd, char *buf, off_t off, size_t size) {
             }
         }
 
-        pthread_rwlock_unlock(&g_PreloadLock);
-        free(blockBuffer);
+        _putPreload(iFusePreload);
         return readSize;
     }
 
     // no preloaded data
-    pthread_rwlock_unlock(&g_PreloadLock);
-
-    free(blockBuffer);
 
     status = iFuseBufferedFsRead(iFuseFd, buf, off, size);
     if (status < 0) {
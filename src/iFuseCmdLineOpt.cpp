@@ -28,6 +28,7 @@
 #include "iFuseCmdLineOpt.hpp"
 #include "iFuse.FS.hpp"
 #include "iFuse.Lib.Conn.hpp"
+#include "iFuse.Lib.DiskCache.hpp"
 #include "iFuse.Lib.MetadataCache.hpp"
 #include "iFuse.Lib.RodsClientAPI.hpp"
 #include "iFuse.Lib.Util.hpp"
@@ -102,18 +103,23 @@ void iFuseCmdOptsInit() {
     g_Opt.preload = true;
     g_Opt.cacheMetadata = true;
     g_Opt.maxConn = IFUSE_MAX_NUM_CONN;
+    g_Opt.maxShortopConn = IFUSE_MAX_NUM_SHORTOP_CONN;
+    g_Opt.minConn = IFUSE_MIN_NUM_CONN;
     g_Opt.blocksize = IFUSE_BUFFER_CACHE_BLOCK_SIZE;
-#ifdef USE_CONNREUSE
+    g_Opt.bufferCacheSize = IFUSE_BUFFER_CACHE_SIZE;
+    g_Opt.dirtyLimit = IFUSE_BUFFER_CACHE_DIRTY_LIMIT;
+    g_Opt.flushThreads = IFUSE_BUFFER_CACHE_FLUSH_THREAD_NUM;
+    g_Opt.wholeFileSize = IFUSE_BUFFER_CACHE_WHOLE_FILE_SIZE;
+    g_Opt.diskCacheSize = IFUSE_DISK_CACHE_SIZE_GB;
     g_Opt.connReuse = true;
-#else
-    g_Opt.connReuse = false;
-#endif
     g_Opt.connTimeoutSec = IFUSE_FREE_CONN_TIMEOUT_SEC;
     g_Opt.connKeepAliveSec = IFUSE_FREE_CONN_KEEPALIVE_SEC;
     g_Opt.connCheckIntervalSec = IFUSE_FREE_CONN_CHECK_INTERVAL_SEC;
     g_Opt.rodsapiTimeoutSec = IFUSE_RODSCLIENTAPI_TIMEOUT_SEC;
     g_Opt.preloadNumThreads = IFUSE_PRELOAD_THREAD_NUM;
     g_Opt.preloadNumBlocks = IFUSE_PRELOAD_PBLOCK_NUM;
+    g_Opt.preloadMemSize = IFUSE_PRELOAD_MEM_SIZE;
+    g_Opt.preloadInflightSize = IFUSE_PRELOAD_INFLIGHT_SIZE;
     g_Opt.metadataCacheTimeoutSec = IFUSE_METADATA_CACHE_TIMEOUT_SEC;
 
     // check environmental variables
@@ -139,11 +145,51 @@ void iFuseCmdOptsInit() {
         g_Opt.maxConn = atoi(value);
     }
 
+    value = getenv("IRODSFS_MAXSHORTOPCONN"); // number
+    if(value != NULL) {
+        g_Opt.maxShortopConn = atoi(value);
+    }
+
+    value = getenv("IRODSFS_MINCONN"); // number
+    if(value != NULL) {
+        g_Opt.minConn = atoi(value);
+    }
+
     value = getenv("IRODSFS_BLOCKSIZE"); // number
     if(value != NULL) {
         g_Opt.blocksize = atoi(value);
     }
 
+    value = getenv("IRODSFS_CACHESIZE"); // number
+    if(value != NULL) {
+        g_Opt.bufferCacheSize = atoi(value);
+    }
+
+    value = getenv("IRODSFS_DIRTYLIMIT"); // number
+    if(value != NULL) {
+        g_Opt.dirtyLimit = atoi(value);
+    }
+
+    value = getenv("IRODSFS_FLUSHTHREADS"); // number
+    if(value != NULL) {
+        g_Opt.flushThreads = atoi(value);
+    }
+
+    value = getenv("IRODSFS_WHOLEFILESIZE"); // number
+    if(value != NULL) {
+        g_Opt.wholeFileSize = atoi(value);
+    }
+
+    value = getenv("IRODSFS_DISKCACHEDIR"); // string
+    if(value != NULL && strlen(value) > 0) {
+        g_Opt.diskCacheDir = strdup(value);
+    }
+
+    value = getenv("IRODSFS_DISKCACHESIZE"); // number
+    if(value != NULL) {
+        g_Opt.diskCacheSize = atoi(value);
+    }
+
     value = getenv("IRODSFS_CONNREUSE"); // true/false
     if(_atob(value)) {
         g_Opt.connReuse = true;
@@ -184,6 +230,16 @@ void iFuseCmdOptsInit() {
         g_Opt.preloadNumBlocks = atoi(value);
     }
 
+    value = getenv("IRODSFS_PRELOADMEM"); // number
+    if(value != NULL) {
+        g_Opt.preloadMemSize = atoi(value);
+    }
+
+    value = getenv("IRODSFS_PRELOADINFLIGHT"); // number
+    if(value != NULL) {
+        g_Opt.preloadInflightSize = atoi(value);
+    }
+
     value = getenv("IRODSFS_METADATACACHETIMEOUT"); // number
     if(value != NULL) {
         g_Opt.metadataCacheTimeoutSec = atoi(value);
@@ -243,6 +299,11 @@ void iFuseCmdOptsDestroy() {
         g_Opt.ticket = NULL;
     }
 
+    if(g_Opt.diskCacheDir != NULL) {
+        free(g_Opt.diskCacheDir);
+        g_Opt.diskCacheDir = NULL;
+    }
+
     peopt = g_Opt.extendedOpts;
     while(peopt != NULL) {
         iFuseExtendedOpt_t *next = peopt->next;
@@ -367,11 +428,54 @@ int iFuseCmdOptsParse(int argc, char **argv) {
                     g_Opt.maxConn = atoi(cmd.value);
                 }
                 processed = true;
+            } else if(strcmp(cmd.command, "maxshortopconn") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.maxShortopConn = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "minconn") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.minConn = atoi(cmd.value);
+                }
+                processed = true;
             } else if(strcmp(cmd.command, "blocksize") == 0) {
                 if(strlen(cmd.value) > 0) {
                     g_Opt.blocksize = atoi(cmd.value);
                 }
                 processed = true;
+            } else if(strcmp(cmd.command, "cachesize") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.bufferCacheSize = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "dirtylimit") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.dirtyLimit = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "flushthreads") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.flushThreads = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "wholefilesize") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.wholeFileSize = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "diskcachedir") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    if(g_Opt.diskCacheDir != NULL) {
+                        free(g_Opt.diskCacheDir);
+                    }
+                    g_Opt.diskCacheDir = strdup(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "diskcachesize") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.diskCacheSize = atoi(cmd.value);
+                }
+                processed = true;
             } else if(strcmp(cmd.command, "connreuse") == 0) {
                 g_Opt.connReuse = true;
                 processed = true;
@@ -414,6 +518,16 @@ int iFuseCmdOptsParse(int argc, char **argv) {
                     g_Opt.preloadNumBlocks = 0;
                 }
                 processed = true;
+            } else if(strcmp(cmd.command, "preloadmem") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.preloadMemSize = atoi(cmd.value);
+                }
+                processed = true;
+            } else if(strcmp(cmd.command, "preloadinflight") == 0) {
+                if(strlen(cmd.value) > 0) {
+                    g_Opt.preloadInflightSize = atoi(cmd.value);
+                }
+                processed = true;
             } else if(strcmp(cmd.command, "metadatacachetimeout") == 0) {
                 if(strlen(cmd.value) > 0) {
                     g_Opt.metadataCacheTimeoutSec = atoi(cmd.value);
@@ -45,6 +45,9 @@ void *iFuseInit(struct fuse_conn_info *conn) {
 
     iFuseLibInitTimerThread();
 
+    // threads do not survive daemonizing, set up connections from here
+    iFuseConnWarmUp();
+
     int status = 0;
     char iRodsPath[MAX_NAME_LEN];
     bzero(iRodsPath, MAX_NAME_LEN);
@@ -151,7 +154,7 @@ int iFuseClose(const char *path, struct fuse_file_info *fi) {
 
     iFuseFd = (iFuseFd_t *)fi->fh;
 
-    assert(iFuseFd->fd > 0);
+    assert(iFuseFd->fd > 0 || (iFuseFd->openFlag & O_ACCMODE) == O_RDONLY);
 
     bzero(iRodsPath, MAX_NAME_LEN);
     status = iFuseRodsClientMakeRodsPath(path, iRodsPath);
@@ -199,7 +202,7 @@ int iFuseFlush(const char *path, struct fuse_file_info *fi) {
 
     iFuseFd = (iFuseFd_t *)fi->fh;
 
-    assert(iFuseFd->fd > 0);
+    assert(iFuseFd->fd > 0 || (iFuseFd->openFlag & O_ACCMODE) == O_RDONLY);
 
     bzero(iRodsPath, MAX_NAME_LEN);
     status = iFuseRodsClientMakeRodsPath(path, iRodsPath);
@@ -239,7 +242,7 @@ int iFuseFsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
 
     iFuseFd = (iFuseFd_t *)fi->fh;
 
-    assert(iFuseFd->fd > 0);
+    assert(iFuseFd->fd > 0 || (iFuseFd->openFlag & O_ACCMODE) == O_RDONLY);
 
     bzero(iRodsPath, MAX_NAME_LEN);
     status = iFuseRodsClientMakeRodsPath(path, iRodsPath);
@@ -281,7 +284,7 @@ int iFuseRead(const char *path, char *buf, size_t size, off_t offset, struct fus
 
     iFuseFd = (iFuseFd_t *)fi->fh;
 
-    assert(iFuseFd->fd > 0);
+    assert(iFuseFd->fd > 0 || (iFuseFd->openFlag & O_ACCMODE) == O_RDONLY);
 
     bzero(iRodsPath, MAX_NAME_LEN);
     status = iFuseRodsClientMakeRodsPath(path, iRodsPath);
@@ -400,6 +403,10 @@ int iFuseUnlink(const char *path) {
         return status;
     }
 
+    if(iFuseLibGetOption()->bufferedFS) {
+        iFuseBufferedFsInvalidateCache(iRodsPath);
+    }
+
     return 0;
 }
 
@@ -615,6 +622,11 @@ int iFuseRename(const char *from, const char *to) {
         return status;
     }
 
+    if(iFuseLibGetOption()->bufferedFS) {
+        iFuseBufferedFsInvalidateCache(iRodsFromPath);
+        iFuseBufferedFsInvalidateCache(iRodsToPath);
+    }
+
     return 0;
 }
 
@@ -638,6 +650,10 @@ int iFuseTruncate(const char *path, off_t size) {
         return status;
     }
 
+    if(iFuseLibGetOption()->bufferedFS) {
+        iFuseBufferedFsInvalidateCache(iRodsPath);
+    }
+
     return 0;
 }
 
@@ -801,11 +817,24 @@ int iFuseIoctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
         return -ENOTDIR;
     }
 
-    status = iFuseFsIoctl(iRodsPath, cmd, arg, fi, flags, data);
-    if (status < 0) {
-        iFuseLibLogError(LOG_ERROR, status,
-                "iFuseIoctl: cannot peform ioctl of a file for %s error", iRodsPath);
-        return status;
+    if(iFuseLibGetOption()->bufferedFS) {
+        if(iFuseLibGetOption()->preload) {
+            status = iFusePreloadIoctl(iRodsPath, cmd, arg, fi, flags, data);
+        } else {
+            status = iFuseBufferedFsIoctl(iRodsPath, cmd, arg, fi, flags, data);
+        }
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status,
+                    "iFuseIoctl: cannot peform ioctl of a file for %s error", iRodsPath);
+            return status;
+        }
+    } else {
+        status = iFuseFsIoctl(iRodsPath, cmd, arg, fi, flags, data);
+        if (status < 0) {
+            iFuseLibLogError(LOG_ERROR, status,
+                    "iFuseIoctl: cannot peform ioctl of a file for %s error", iRodsPath);
+            return status;
+        }
     }
 
     return 0;
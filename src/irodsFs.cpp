@@ -235,15 +235,25 @@ static void usage() {
         " --nocache                        Disable all caching features (Buffered IO, Preload, Metadata Cache)",
         " --nopreload                      Disable Preload feature that pre-fetches file blocks in advance",
         " --nocachemetadata                Disable metadata caching feature",
-        " --connreuse                      Set to reuse network connections for performance. This may provide inconsistent metadata with mysql-backed iCAT. By default, connections are not reused",
+        " --noconnreuse                    Set to use a new network connection for every metadata operation and file open. By default, connections are reused and a connection that may not see changes made through another connection is set up again before reuse",
         " --maxconn <num_conn>             Set max number of network connection to be established at the same time. By default, this is set to 10",
+        " --maxshortopconn <num_conn>      Set max number of network connections for metadata operations, such as stat, create and rename. These are separate from connections for file IO. By default, this is set to 4",
+        " --minconn <num_conn>             Set number of network connections to be set up in advance at mount, for file IO and for metadata operations each. Idle connections are not closed below this number. By default, this is set to 0",
         " --blocksize <block_size>         Set block size at data transfer. All transfer is made in a block-level for performance. By default, this is set to 1048576 (1MB)",
+        " --cachesize <cache_size>         Set max size of block cache shared by all opened files. Cached blocks are kept after close and validated with file size and modification time at next open. Least recently used blocks are evicted when the cache is full. By default, this is set to 67108864 (64MB)",
+        " --dirtylimit <dirty_size>        Set max size of written data buffered before sending to iRODS. Buffered data are merged and written in offset order when the limit is reached or the file is flushed. By default, this is set to 16777216 (16MB)",
+        " --flushthreads <num_threads>     Set number of threads writing buffered data to iRODS in background. Set 0 to write on the calling thread. By default, this is set to 2",
+        " --wholefilesize <size>           Set max size of files read whole at open. The file is fetched with a single request and its iRODS handle is released until blocks are evicted. Set 0 to disable. By default, this is set to 1048576 (1MB)",
+        " --diskcachedir <dir>             Cache file blocks in given local dir. Cached blocks are kept across mounts and served while size and modification time of files are unchanged. By default, disk cache is disabled",
+        " --diskcachesize <size_in_GB>     Set max size of disk cache. Least recently used blocks are evicted. By default, this is set to 10 (10GB)",
         " --conntimeout <timeout>          Set timeout of a network connection. After the timeout, idle connections will be automatically closed. By default, this is set to 300 (5 minutes)",
         " --connkeepalive <interval>       Set interval of keepalive requests. For every keepalive interval, keepalive message is sent to iCAT to keep network connections live. By default, this is set to 180 (3 minutes)",
         " --conncheckinterval <interval>   Set intervals of connection timeout check. For every check intervals, all connections established are checked to figure out if they are timed-out. By default, this is set to 10 (10 seconds)",
         " --apitimeout <timeout>           Set timeout of iRODS client API calls. If an API call does not respond before the timeout, the API call and the network connection associated with are killed. By default, this is set to 90 (90 seconds)",
-        " --preloadblocks <num_blocks>     Set the number of blocks pre-fetched. By default, this is set to 3 (next 3 blocks are pre-fetched)",
-        " --preloadthreads <num_threads>   Set the number of threads to be used in pre-fetching. By default, this is set to 3",
+        " --preloadblocks <num_blocks>     Set the maximum number of blocks pre-fetched. The readahead window grows up to this while reads are sequential or strided. By default, this is set to 64",
+        " --preloadthreads <num_threads>   Set the number of threads shared by all files in pre-fetching. By default, this is set to 3",
+        " --preloadmem <size>              Set max size of pre-fetched data not yet read, shared fairly by all files being read. By default, this is set to 33554432 (32MB)",
+        " --preloadinflight <size>         Set max size of pre-fetch requests queued or sent to iRODS at the same time. By default, this is set to 8388608 (8MB)",
         " --metadatacachetimeout <timeout> Set timeout of a metadata cache. Metadata caches are invalidated after the timeout. By default, this is set to 180 (3 minutes)",
         ""
     };
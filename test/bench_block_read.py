@@ -0,0 +1,88 @@
+#! /usr/bin/env python3
+
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Measures per-read overhead of irodsFs on cached data. A file is read once
+# to warm the buffer cache, then read repeatedly with small requests while
+# minor/major page faults and CPU time of the irodsFs process are sampled
+# from /proc. Block buffers are allocated per read when they are not pooled,
+# which shows up as page faults growing with the number of reads.
+#
+# usage: ./bench_block_read.py <mount_dir> <irodsFs_pid> [file_size_in_MB] [read_size_in_KB]
+# mount irodsFs with --cachesize larger than the file and compare --blocksize values
+
+import os
+import sys
+import time
+
+from bench_util import make_file
+
+PASSES = 10
+
+def proc_stat(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        # fields after the command name, which may contain spaces
+        fields = f.read().rsplit(")", 1)[1].split()
+    minflt = int(fields[7])
+    majflt = int(fields[9])
+    cpu = (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+    return minflt, majflt, cpu
+
+def read_file(path, read_size, passes):
+    total = 0
+    reads = 0
+    fd = os.open(path, os.O_RDONLY)
+    for _ in range(passes):
+        off = 0
+        while True:
+            buf = os.pread(fd, read_size, off)
+            if not buf:
+                break
+            off += len(buf)
+            total += len(buf)
+            reads += 1
+    os.close(fd)
+    return total, reads
+
+def main(argv):
+    if len(argv) < 2:
+        print("usage: ./bench_block_read.py <mount_dir> <irodsFs_pid> [file_size_in_MB] [read_size_in_KB]")
+        return 1
+
+    dir = argv[0]
+    pid = int(argv[1])
+    size = (int(argv[2]) if len(argv) > 2 else 32) * 1024 * 1024
+    read_size = (int(argv[3]) if len(argv) > 3 else 4) * 1024
+
+    path = make_file(dir, "bench_block_read.dat", size)
+
+    # warm up caches
+    read_file(path, 1024 * 1024, 1)
+
+    minflt0, majflt0, cpu0 = proc_stat(pid)
+    start = time.time()
+    total, reads = read_file(path, read_size, PASSES)
+    elapsed = time.time() - start
+    minflt1, majflt1, cpu1 = proc_stat(pid)
+
+    print("reads\tMB/s\tminflt/read\tmajflt\tcpu_us/read")
+    print("%d\t%.1f\t%.3f\t\t%d\t%.1f" % (reads, total / elapsed / (1024 * 1024),
+        (minflt1 - minflt0) / reads, majflt1 - majflt0, (cpu1 - cpu0) * 1000000 / reads))
+
+    os.remove(path)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
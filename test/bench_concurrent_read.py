@@ -0,0 +1,93 @@
+#! /usr/bin/env python3
+
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Measures read throughput of independent files with increasing number of
+# concurrent readers. Files are read once to warm the buffer cache, so the
+# numbers mostly reflect locking overhead in irodsFs rather than network.
+#
+# usage: ./bench_concurrent_read.py <mount_dir> [max_threads] [file_size_in_MB]
+# mount irodsFs with --cachesize large enough to hold all files
+
+import os
+import sys
+import time
+import threading
+
+from bench_util import make_file
+
+READ_SIZE = 64 * 1024
+PASSES = 5
+
+def make_files(dir, count, size):
+    data = os.urandom(1024 * 1024)
+    return [make_file(dir, "bench_concurrent_read_%d.dat" % i, size, data) for i in range(count)]
+
+def read_file(path, passes, result, idx):
+    total = 0
+    fd = os.open(path, os.O_RDONLY)
+    for _ in range(passes):
+        off = 0
+        while True:
+            buf = os.pread(fd, READ_SIZE, off)
+            if not buf:
+                break
+            off += len(buf)
+            total += len(buf)
+    os.close(fd)
+    result[idx] = total
+
+def run(paths, passes):
+    result = [0] * len(paths)
+    threads = [threading.Thread(target=read_file, args=(p, passes, result, i)) for i, p in enumerate(paths)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+    return sum(result), elapsed
+
+def main(argv):
+    if len(argv) < 1:
+        print("usage: ./bench_concurrent_read.py <mount_dir> [max_threads] [file_size_in_MB]")
+        return 1
+
+    dir = argv[0]
+    max_threads = int(argv[1]) if len(argv) > 1 else 32
+    size = (int(argv[2]) if len(argv) > 2 else 4) * 1024 * 1024
+
+    paths = make_files(dir, max_threads, size)
+
+    # warm up caches
+    run(paths, 1)
+
+    print("threads\tMB/s\tscaling")
+    base = None
+    n = 1
+    while n <= max_threads:
+        total, elapsed = run(paths[:n], PASSES)
+        mbps = total / elapsed / (1024 * 1024)
+        if base is None:
+            base = mbps
+        print("%d\t%.1f\t%.2fx" % (n, mbps, mbps / base))
+        n *= 2
+
+    for p in paths:
+        os.remove(p)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,104 @@
+#! /usr/bin/env python3
+
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Measures latency of opening and reading the first byte of distinct files
+# from many threads at once, and of stat calls made at the same time.
+# Each open needs a connection, so a burst of opens makes irodsFs set up
+# new connections. Stat calls should not wait for them.
+#
+# usage: ./bench_parallel_open.py <mount_dir> [threads] [files_per_thread]
+# run right after mounting, or after idle connections are closed
+# (--conntimeout), so that connections are set up during the run
+
+import os
+import sys
+import time
+import threading
+
+def make_files(dir, count):
+    paths = []
+    for i in range(count):
+        path = os.path.join(dir, "bench_parallel_open_%d.dat" % i)
+        if not os.path.exists(path):
+            with open(path, "wb") as f:
+                f.write(b"x" * 4096)
+        paths.append(path)
+    return paths
+
+def open_files(paths, latencies):
+    for path in paths:
+        start = time.time()
+        fd = os.open(path, os.O_RDONLY)
+        os.pread(fd, 1, 0)
+        os.close(fd)
+        latencies.append(time.time() - start)
+
+def stat_files(paths, latencies, stop):
+    i = 0
+    while not stop.is_set():
+        start = time.time()
+        os.stat(paths[i % len(paths)])
+        latencies.append(time.time() - start)
+        i += 1
+        time.sleep(0.01)
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+def main(argv):
+    if len(argv) < 1:
+        print("usage: ./bench_parallel_open.py <mount_dir> [threads] [files_per_thread]")
+        return 1
+
+    dir = argv[0]
+    threads = int(argv[1]) if len(argv) > 1 else 16
+    per_thread = int(argv[2]) if len(argv) > 2 else 4
+
+    paths = make_files(dir, threads * per_thread)
+
+    open_latencies = []
+    stat_latencies = []
+    stop = threading.Event()
+
+    stater = threading.Thread(target=stat_files, args=(paths, stat_latencies, stop))
+    openers = [threading.Thread(target=open_files, args=(paths[i::threads], open_latencies)) for i in range(threads)]
+
+    start = time.time()
+    stater.start()
+    for t in openers:
+        t.start()
+    for t in openers:
+        t.join()
+    elapsed = time.time() - start
+    stop.set()
+    stater.join()
+
+    print("%d opens from %d threads in %.2f sec" % (len(open_latencies), threads, elapsed))
+    print("op\tcount\tp50 ms\tp90 ms\tp99 ms\tmax ms")
+    for name, values in (("open", open_latencies), ("stat", stat_latencies)):
+        print("%s\t%d\t%.1f\t%.1f\t%.1f\t%.1f" % (name, len(values),
+            percentile(values, 50) * 1000, percentile(values, 90) * 1000,
+            percentile(values, 99) * 1000, max(values or [0]) * 1000))
+
+    for p in paths:
+        os.remove(p)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,89 @@
+#! /usr/bin/env python3
+
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Measures read round trips to iRODS per MB of sequentially read data.
+# The buffer cache is reset before each run, then a file is read with the
+# given request size and the number of server reads is taken from the buffer
+# cache statistics (same as "irodsFsCtl.py show_buffer_cache").
+# A last run reads 4KB at random offsets and shows data fetched per read.
+#
+# usage: ./bench_read_rpc.py <mount_dir> [file_size_in_MB] [read_sizes_in_KB...]
+# mount irodsFs without --diskcachedir and with -o max_read large enough for
+# the read sizes, otherwise the kernel splits requests
+
+import os
+import sys
+import time
+import random
+
+from bench_util import make_file, reset_cache, fetch_stat
+
+def read_file(path, read_size):
+    total = 0
+    fd = os.open(path, os.O_RDONLY)
+    off = 0
+    while True:
+        buf = os.pread(fd, read_size, off)
+        if not buf:
+            break
+        off += len(buf)
+        total += len(buf)
+    os.close(fd)
+    return total
+
+def read_random(path, size, read_size, count):
+    fd = os.open(path, os.O_RDONLY)
+    for i in range(count):
+        os.pread(fd, read_size, random.randrange(0, size - read_size))
+    os.close(fd)
+
+def main(argv):
+    if len(argv) < 1:
+        print("usage: ./bench_read_rpc.py <mount_dir> [file_size_in_MB] [read_sizes_in_KB...]")
+        return 1
+
+    dir = argv[0]
+    size = (int(argv[1]) if len(argv) > 1 else 64) * 1024 * 1024
+    read_sizes = [int(s) * 1024 for s in argv[2:]] if len(argv) > 2 else [64 * 1024, 128 * 1024, 1024 * 1024]
+
+    path = make_file(dir, "bench_read_rpc.dat", size)
+
+    print("read_KB\tMB/s\tfetches/MB\tfetched_MB")
+    for read_size in read_sizes:
+        reset_cache(dir)
+        fetches0, bytes0 = fetch_stat(dir)
+        start = time.time()
+        total = read_file(path, read_size)
+        elapsed = time.time() - start
+        fetches1, bytes1 = fetch_stat(dir)
+
+        mb = total / (1024 * 1024)
+        print("%d\t%.1f\t%.2f\t\t%.1f" % (read_size / 1024, mb / elapsed,
+            (fetches1 - fetches0) / mb, (bytes1 - bytes0) / (1024 * 1024)))
+
+    count = 1000
+    reset_cache(dir)
+    fetches0, bytes0 = fetch_stat(dir)
+    read_random(path, size, 4096, count)
+    fetches1, bytes1 = fetch_stat(dir)
+    print("random 4KB reads: %.2f fetches/read, %.1f KB fetched/read" % (
+        (fetches1 - fetches0) / count, (bytes1 - bytes0) / 1024 / count))
+
+    os.remove(path)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,98 @@
+#! /usr/bin/env python3
+
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Replays synthetic read traces against a file and measures throughput.
+# Traces are sequential, backward (reverse scan with small reads), strided
+# (fixed size chunks at a constant distance, like tiled or column-oriented
+# layouts) and random. The buffer cache is reset before each trace so every
+# trace starts cold, and a short think time between reads lets the preload
+# run ahead as a real application computing on the data would.
+#
+# usage: ./bench_strided_read.py <mount_dir> [file_size_in_MB] [block_size_in_KB] [think_time_in_ms]
+# block_size_in_KB must match --blocksize of irodsFs (64 by default)
+# compare results of irodsFs mounted with and without --nopreload
+
+import os
+import sys
+import time
+import random
+
+from bench_util import make_file, reset_cache
+
+def sequential_trace(size, block_size):
+    read_size = block_size // 4
+    return [(off, read_size) for off in range(0, size, read_size)]
+
+def backward_trace(size, block_size):
+    read_size = 4096
+    return [(off, read_size) for off in range(size - read_size, -1, -read_size)]
+
+def strided_trace(size, block_size, stride_blocks, chunk_blocks):
+    chunk = chunk_blocks * block_size
+    stride = stride_blocks * block_size
+    return [(off, chunk) for off in range(0, size - chunk + 1, stride)]
+
+def random_trace(size, block_size):
+    rand = random.Random(0)
+    count = size // block_size // 8
+    return [(rand.randrange(size // block_size) * block_size, block_size) for _ in range(count)]
+
+def replay(path, trace, think_time):
+    total = 0
+    fd = os.open(path, os.O_RDONLY)
+    start = time.time()
+    for off, size in trace:
+        total += len(os.pread(fd, size, off))
+        if think_time > 0:
+            time.sleep(think_time)
+    elapsed = time.time() - start - think_time * len(trace)
+    os.close(fd)
+    return total, elapsed
+
+def main(argv):
+    if len(argv) < 1:
+        print("usage: ./bench_strided_read.py <mount_dir> [file_size_in_MB] [block_size_in_KB] [think_time_in_ms]")
+        return 1
+
+    dir = argv[0]
+    size = (int(argv[1]) if len(argv) > 1 else 64) * 1024 * 1024
+    block_size = (int(argv[2]) if len(argv) > 2 else 64) * 1024
+    think_time = (float(argv[3]) if len(argv) > 3 else 1) / 1000
+
+    path = make_file(dir, "bench_strided_read.dat", size)
+
+    traces = [
+        ("sequential", sequential_trace(size, block_size)),
+        ("backward", backward_trace(size, block_size)),
+        ("stride 4 x1", strided_trace(size, block_size, 4, 1)),
+        ("stride 16 x1", strided_trace(size, block_size, 16, 1)),
+        ("stride 16 x4", strided_trace(size, block_size, 16, 4)),
+        ("random", random_trace(size, block_size)),
+    ]
+
+    print("trace\t\treads\tMB\tMB/s\tms/read")
+    for name, trace in traces:
+        reset_cache(dir)
+        total, elapsed = replay(path, trace, think_time)
+        mb = total / (1024 * 1024)
+        print("%-12s\t%d\t%.1f\t%.1f\t%.3f" % (name, len(trace), mb,
+            mb / elapsed if elapsed > 0 else 0, elapsed * 1000 / len(trace)))
+
+    os.remove(path)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,53 @@
+#    Copyright 2020 The Trustees of University of Arizona and CyVerse
+#
+#    Licensed under the Apache License, Version 2.0 (the "License" );
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+# Fixtures shared by bench_*.py scripts: test files of a given size and
+# irodsFs control ioctls (same as irodsFsCtl.py).
+
+import os
+import fcntl
+import array
+
+IOCTL_APP_NUMBER = 0xEE
+IFUSEIOC_RESET_METADATA_CACHE = 0
+IFUSEIOC_SHOW_BUFFER_CACHE = 2
+
+def _IOC(dir, type, nr, size):
+    return (dir << 30) | (size << 16) | (type << 8) | nr
+
+def reset_cache(mount_dir):
+    fd = os.open(mount_dir, os.O_DIRECTORY)
+    fcntl.ioctl(fd, _IOC(0, IOCTL_APP_NUMBER, IFUSEIOC_RESET_METADATA_CACHE, 0))
+    os.close(fd)
+
+def fetch_stat(mount_dir):
+    # server reads and bytes read, from buffer cache statistics
+    fd = os.open(mount_dir, os.O_DIRECTORY)
+    buf = array.array('q', [0,0,0,0,0,0,0])
+    fcntl.ioctl(fd, _IOC(2, IOCTL_APP_NUMBER, IFUSEIOC_SHOW_BUFFER_CACHE, 56), buf, 1)
+    os.close(fd)
+    return buf[5], buf[6]
+
+def make_file(dir, name, size, data=None):
+    # an existing file of the same size is reused
+    path = os.path.join(dir, name)
+    if not os.path.exists(path) or os.path.getsize(path) != size:
+        if data is None:
+            data = os.urandom(1024 * 1024)
+        with open(path, "wb") as f:
+            written = 0
+            while written < size:
+                f.write(data[:min(len(data), size - written)])
+                written += min(len(data), size - written)
+    return path